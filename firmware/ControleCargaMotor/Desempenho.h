@@ -0,0 +1,142 @@
+﻿/*
+ *		Desempenho.h
+ *
+ *		Medição do tempo de execução das interrupções, do período de amostragem do ADC, das
+ *		iterações do laço principal e da latência de processamento dos pacotes ModBus.
+ *
+ *		O timer 0 conta livremente com prescaler /64 (4us por contagem a 16MHz), e a interrupção
+ *		de overflow estende a contagem, formando uma marca de tempo de 16 bits que dá a volta a
+ *		cada 262ms. Os tempos das interrupções são medidos do início ao fim do corpo da rotina,
+ *		sem o prólogo e o epílogo gerados pelo compilador (cerca de 2 a 4us). Os tempos das interrupções
+ *		da ModBus incluem as interrupções do controle que as interromperem.
+ *
+ *		Deve ser incluído antes da ModbusSlave.h, que usa os ganchos ModBusIsrInicio, ModBusIsrFim
+ *		e ModBusPacoteRecebido.
+ */
+
+// ganchos opcionais, podem ser definidos antes de incluir este arquivo
+#ifndef PerfOverflow
+#define PerfOverflow() // a cada overflow do timer 0, aproximadamente 1ms
+#endif
+#ifndef PerfPacote
+#define PerfPacote() // pacote ModBus completo aguardando o processamento
+#endif
+
+#define PERF_TICK_US (64000000UL/F_CPU) // duração de uma contagem do timer 0 em us
+#define PERF_OVF_POR_SEGUNDO ((uint16_t)(F_CPU/64/256)) // overflows do timer 0 em aproximadamente 1s
+
+// Interrupções medidas
+enum perf_isr {PERF_ADC, PERF_COMPB, PERF_RXC, PERF_TXC, PERF_UDRE, PERF_TIMER2, PERF_NUM_ISR};
+
+struct perf_tempo {
+	uint8_t ultimo; // em contagens do timer 0
+	uint8_t pior;
+};
+
+struct perf {
+	struct perf_tempo isr[PERF_NUM_ISR];
+	uint8_t adc_descarta; // conversões a descartar antes de medir o período
+	uint16_t adc_anterior; // marca de tempo da conversão anterior
+	uint16_t adc_periodo;
+	uint16_t adc_periodo_max;
+	uint16_t pacote; // marca de tempo do fim do último pacote ModBus recebido
+	uint16_t latencia; // do fim do pacote até o início do ModBusProcess
+	uint16_t latencia_max;
+};
+
+volatile struct perf perf;
+volatile uint16_t perf_overflows;
+
+ISR(TIMER0_OVF_vect)
+{
+	perf_overflows++;
+	PerfOverflow();
+}
+
+// Marca de tempo em contagens do timer 0, deve ser chamada com as interrupções desabilitadas
+static inline uint16_t perf_agora(void)
+{
+	const uint8_t t = TCNT0;
+	uint8_t ovf = (uint8_t)perf_overflows;
+	if ((TIFR & (1<<TOV0)) && (t < 128)) ovf++; // o timer deu a volta mas o overflow ainda não foi atendido
+	return ((uint16_t)ovf<<8) | t;
+}
+
+static inline void perf_registra(volatile struct perf_tempo *tempo, uint8_t inicio)
+{
+	const uint8_t dt = TCNT0 - inicio;
+	tempo->ultimo = dt;
+	if (dt > tempo->pior) tempo->pior = dt;
+}
+
+#define PerfIsrInicio()	const uint8_t perf_inicio = TCNT0
+#define PerfIsrFim(id)	perf_registra(&perf.isr[id], perf_inicio)
+
+// Ganchos da ModbusSlave.h
+#define ModBusIsrInicio()		PerfIsrInicio()
+#define ModBusIsrFim(isr)		PerfIsrFim(PERF_##isr)
+#define ModBusPacoteRecebido()	perf_pacote()
+
+// Chamada na interrupção de recepção, que pode estar com as interrupções habilitadas
+static inline void perf_pacote(void)
+{
+	const uint8_t sreg = SREG;
+	cli();
+	perf.pacote = perf_agora();
+	SREG = sreg;
+	PerfPacote();
+}
+
+// Chamada na interrupção do ADC a cada conversão
+static inline void perf_adc(void)
+{
+	const uint16_t agora = perf_agora();
+	if (perf.adc_descarta) {
+		perf.adc_descarta--;
+	} else {
+		const uint16_t periodo = agora - perf.adc_anterior;
+		perf.adc_periodo = periodo;
+		if (periodo > perf.adc_periodo_max) perf.adc_periodo_max = periodo;
+	}
+	perf.adc_anterior = agora;
+}
+
+// Chamada no laço principal antes de processar um pacote ModBus
+static inline void perf_latencia(void)
+{
+	cli();
+	const uint16_t latencia = perf_agora() - perf.pacote;
+	perf.latencia = latencia;
+	if (latencia > perf.latencia_max) perf.latencia_max = latencia;
+	sei();
+}
+
+// Zera os piores casos
+void perf_reset(void)
+{
+	cli();
+	for (uint8_t i = 0; i < PERF_NUM_ISR; i++) {
+		perf.isr[i].ultimo = 0;
+		perf.isr[i].pior = 0;
+	}
+	perf.adc_descarta = 1;
+	perf.adc_periodo = 0;
+	perf.adc_periodo_max = 0;
+	perf.latencia = 0;
+	perf.latencia_max = 0;
+	sei();
+}
+
+// Converte contagens do timer 0 para us, saturando em 65535
+static inline uint16_t perf_us(uint16_t contagens)
+{
+	return (contagens > 0xFFFF/PERF_TICK_US) ? 0xFFFF : (uint16_t)(contagens*PERF_TICK_US);
+}
+
+void perf_init(void)
+{
+	perf.adc_descarta = 2; // a primeira conversão depois de ligar o ADC leva 25 ciclos em vez de 13
+	TCNT0 = 0;
+	TCCR0 = (1<<CS01)|(1<<CS00); // prescaler /64
+	TIMSK |= (1<<TOIE0);
+}
@@ -0,0 +1,60 @@
+﻿/*
+ *		Eventos.h
+ *
+ *		Escalonador cooperativo do laço principal. As interrupções sinalizam eventos em uma máscara de bits,
+ *		e o laço principal trata os eventos pendentes e dorme no modo idle enquanto não houver nenhum. Os
+ *		timers, a serial e o ADC continuam funcionando no modo idle, e qualquer interrupção acorda o processador.
+ *
+ *		As tarefas periódicas são contadas em ticks de um evento periódico, e cada uma guarda o tick da
+ *		última execução.
+ */
+
+#include <avr/sleep.h>
+
+volatile uint8_t eventos; // eventos sinalizados e ainda não tratados
+
+// Sinaliza eventos, pode ser chamada nas interrupções e no laço principal
+static inline void evento_sinaliza(uint8_t evento)
+{
+	const uint8_t sreg = SREG;
+	cli();
+	eventos |= evento;
+	SREG = sreg;
+}
+
+// Espera e retorna os eventos pendentes, dormindo enquanto não houver nenhum.
+// O sei só tem efeito depois da instrução seguinte, então um evento sinalizado entre o teste e o sleep
+// acorda o processador em vez de ficar esperando a próxima interrupção.
+static inline uint8_t evento_espera(void)
+{
+	cli();
+	while (eventos == 0) {
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		cli();
+	}
+	const uint8_t pendentes = eventos;
+	eventos = 0;
+	sei();
+	return pendentes;
+}
+
+void evento_init(void)
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+struct Periodica {
+	uint16_t periodo; // em ticks
+	uint16_t ultima; // tick da última execução
+};
+
+// Indica se a tarefa periódica deve ser executada no tick agora
+static inline uint8_t periodica_vence(struct Periodica *tarefa, uint16_t agora)
+{
+	if ((uint16_t)(agora - tarefa->ultima) < tarefa->periodo) return 0;
+	tarefa->ultima = agora;
+	return 1;
+}
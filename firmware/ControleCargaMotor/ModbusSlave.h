@@ -9,21 +9,92 @@
  *  	Read Holding Registers (FC=03)
  *  	Preset Single Register (FC=06)
  *  	Preset Multiple Registers (FC=16)
+ *  	Read/Write Multiple Registers (FC=23)
+ *  	Diagnostics (FC=08), subfunções 0, 10 a 15 e 18
+ *
+ *  	Pedidos de difusão (endereço 0) são aceitos nas funções 6 e 16, e não têm resposta.
+ *
+ *  	As interrupções da ModBus podem ser interrompidas pelas demais interrupções do programa, mas não umas
+ *  	pelas outras: na entrada desabilitam as próprias fontes e reabilitam as interrupções globais, e na saída
+ *  	religam as fontes. Assim as interrupções do controle não esperam o fim de uma interrupção da serial.
+ *
+ *  	Os contadores de diagnóstico ficam nos registradores a partir de ModBusRegDiagnostico, e podem ser lidos
+ *  	pela função 3 ou pelas subfunções da função 8. As interrupções só os alteram durante a recepção e o
+ *  	ModBusProcess só durante o processamento, então não é preciso desabilitar as interrupções para acessá-los.
  */
 
+#include <avr/pgmspace.h>
+
 // Configuração ModBus
 #define endereco_modbus 1 // endereço inicial da modbus, pode ser mudado depois
-#define num_reg_words_modbus 3 // número de registradores (words) usados na modbus (variável data_word) funções 3 e 16
-#define tam_buff_recep 255
-#define tam_buff_trans 255
-#define TxDelay 100 // TX Delay ms
+#define endereco_difusao 0 // endereço dos pedidos de difusão, aceitos por todos os escravos
+#define num_reg_words_modbus 240 // número de registradores (words) usados na modbus (variável data_word) funções 3 e 16
+#define ModBusRegDiagnostico 233 // primeiro registrador dos contadores de diagnóstico, na ordem de enum ModBusContador
+#define ModBusMaxRegistros 64 // máximo de registradores lidos ou gravados em uma transação (o protocolo permite até 125)
+#define tam_buff_modbus (13+2*ModBusMaxRegistros) // maior pacote: pedido da função 23 gravando ModBusMaxRegistros
+#define TxDelay 0 // atraso adicional da resposta em ms, somado ao intervalo t3,5 entre pacotes
 // final Configuração ModBus
 
+// ganchos opcionais para instrumentação, podem ser definidos antes de incluir este arquivo
+#ifndef ModBusIsrInicio
+#define ModBusIsrInicio() // início do corpo das interrupções
+#endif
+#ifndef ModBusIsrFim
+#define ModBusIsrFim(isr) // fim do corpo das interrupções, isr = RXC, TXC, UDRE ou TIMER2
+#endif
+#ifndef ModBusPacoteRecebido
+#define ModBusPacoteRecebido() // pacote completo aguardando o ModBusProcess
+#endif
+
+// registradores virtuais, opcionais: os registradores de ModBusVirtualInicio a ModBusVirtualFim-1 não ocupam
+// espaço em data_reg, são lidos por ModBusLeVirtual(reg) e as escritas neles são aceitas e descartadas. Os demais
+// ficam em data_reg na mesma ordem, sem o intervalo, e são acessados por ModBusReg(reg).
+#ifndef ModBusVirtualInicio
+#define ModBusVirtualInicio num_reg_words_modbus
+#define ModBusVirtualFim num_reg_words_modbus
+#define ModBusLeVirtual(reg) 0
+#endif
+#define ModBusNumVirtuais (ModBusVirtualFim-ModBusVirtualInicio)
+#define ModBusVirtual(reg) ((uint16_t)((reg)-ModBusVirtualInicio) < ModBusNumVirtuais)
+#define ModBusReg(reg) (ModBus.data_reg[(reg) < ModBusVirtualInicio ? (reg) : (reg)-ModBusNumVirtuais])
+
 // configuração da serial
-#define USART_BAUDRATE 19200 // taxa de transmissão desejada
-#define BAUD_PRESCALE ((F_CPU / (USART_BAUDRATE * (long)16))-1) //calcula o valor do prescaler da usart
+#define ModBusTaxaPadrao 1 // índice da taxa de transmissão padrão na tabela ModBusTaxas (19200bps)
+#define BAUD_PRESCALE(baud) ((F_CPU + 4UL*(baud)) / (8UL*(baud)) - 1) //calcula o valor do prescaler da usart no modo U2X, arredondado
 // fim da configuração da serial
 
+// temporização do ModBus RTU, derivada da taxa de transmissão
+#define ModBusTick_us 100 // período da interrupção do timer da modbus em us
+#define ModBusTicksPorMs (1000/ModBusTick_us)
+#define ModBusTicks(us) (((us)+ModBusTick_us-1)/ModBusTick_us) // converte us em ticks, arredondando para cima
+#define ModBusTempoCaractere_us(baud) (11000000UL/(baud)) // um caractere RTU tem 11 bits
+#define ModBusT15_us(baud) ((baud) > 19200 ? 750UL : (3*ModBusTempoCaractere_us(baud))/2) // acima de 19200bps a norma fixa t1,5 em 750us
+#define ModBusT35_us(baud) ((baud) > 19200 ? 1750UL : (7*ModBusTempoCaractere_us(baud))/2) // acima de 19200bps a norma fixa t3,5 em 1750us
+#define ModBusTimeoutRecepcao(baud) ModBusTicks(ModBusTempoCaractere_us(baud)+ModBusT15_us(baud)) // silêncio maior que t1,5 entre bytes descarta o pacote
+#define ModBusTurnaround(baud) ModBusTicks(ModBusT35_us(baud)) // intervalo mínimo entre o fim da pergunta e o início da resposta
+
+// taxas de transmissão selecionáveis, todas no modo U2X
+struct ModBusTaxa
+{
+	uint16_t ubrr; // valor do registrador UBRR
+	uint8_t timeout_recepcao; // em ticks
+	uint8_t turnaround; // em ticks
+};
+#define ModBusTaxa(baud) {BAUD_PRESCALE(baud), ModBusTimeoutRecepcao(baud), ModBusTurnaround(baud)}
+
+const struct ModBusTaxa ModBusTaxas[] PROGMEM =
+{
+	ModBusTaxa(9600),		// 0: erro de 0,2% a 16MHz
+	ModBusTaxa(19200),		// 1: erro de 0,2%
+	ModBusTaxa(38400),		// 2: erro de 0,2%
+	ModBusTaxa(57600),		// 3: erro de -0,8%
+	ModBusTaxa(115200),		// 4: erro de 2,1%, no limite da tolerância de alguns mestres
+	ModBusTaxa(250000)		// 5: exata
+	// acima de 250000bps um caractere dura menos que a interrupção de recepção e a serial perde bytes; como a
+	// taxa fica gravada na EEPROM, o controlador perderia a comunicação até ser regravado
+};
+#define ModBusNumTaxas (sizeof(ModBusTaxas)/sizeof(ModBusTaxas[0]))
+
 // configuração do pino do driver RS485
 #define ModBusTxEnablePort PORTD
 #define ModBusTxEnablePin PD2
@@ -41,61 +112,144 @@ struct mb
 	uint8_t end_modbus; // armazena o endereço na modbus
 	uint16_t rxsize; // tamanho do pacote na recepção
 	uint16_t txsize; // tamanho do pacote na transmissão
-	uint8_t rxbuf[tam_buff_recep]; // buffer de recepção
-	uint8_t txbuf[tam_buff_trans]; // buffer de transmissão
+	uint8_t buf[tam_buff_modbus]; // buffer de recepção e transmissão, a resposta é montada sobre o pacote recebido
 	uint8_t funcao;
-	uint16_t data_reg[num_reg_words_modbus]; // dados de words a serem transmitidos e recebidos pela modbus
+	uint16_t data_reg[num_reg_words_modbus-ModBusNumVirtuais]; // dados de words a serem transmitidos e recebidos pela modbus, sem os virtuais
 	uint16_t rxpt; // ponteiro para o buffer de recepçao, necessario em algumas arquiteturas
 	uint16_t txpt; // ponteiro para o buffer de transmissão, necessario em algumas arquiteturas
+	uint16_t rxcrc; // crc do pacote calculado byte a byte durante a recepção, vale 0 se o pacote for válido
+	uint8_t atraso_resposta; // atraso adicional da resposta em ms, ajustável pelo mestre
+	uint8_t taxa; // índice da taxa de transmissão em uso na tabela ModBusTaxas
+	uint8_t nova_taxa; // taxa a ser aplicada assim que o barramento estiver livre
+	uint8_t timeout_recepcao; // intervalo em ticks que descarta um pacote truncado, depende da taxa
+	uint8_t turnaround; // intervalo mínimo em ticks até a resposta, depende da taxa
+	uint8_t funcao_rx; // função do pacote em recepção, mesmo dos pacotes ignorados
+	uint8_t difusao; // o pacote em recepção foi enviado para o endereço de difusão
+	uint16_t fim_pedido; // posição do último byte se o pacote for um pedido
+	uint16_t fim_resposta; // posição do último byte se o pacote for uma resposta
+	uint8_t na_isr; // uma interrupção da ModBus está em execução com as próprias fontes desabilitadas
+	uint8_t fontes_usart; // fontes da serial a religar no fim da interrupção
+	uint8_t fontes_timer; // fonte do timer a religar no fim da interrupção
+	uint16_t escrita_inicio; // primeiro registrador gravado pelo último pacote processado
+	uint8_t escrita_num; // número de registradores gravados pelo último pacote processado, 0 se nenhum
 } ModBus;
 
-// Liga o temporizador usado na modBus com o intervalor ajustado para 1ms
+// O último pacote processado gravou o registrador reg, mesmo que com o valor que ele já tinha
+#define ModBusEscrito(reg) ((uint16_t)((reg)-ModBus.escrita_inicio) < ModBus.escrita_num)
+
+// contadores de diagnóstico
+enum ModBusContador
+{
+	ModBusMensagensBarramento, // pacotes detectados no barramento, para qualquer endereço (subfunção 11)
+	ModBusErrosCrc, // pacotes com crc inválido, para qualquer endereço (subfunção 12)
+	ModBusExcecoes, // respostas de exceção enviadas, sem as de difusão (subfunção 13)
+	ModBusMensagensEscravo, // pacotes para este escravo ou de difusão processados (subfunção 14)
+	ModBusSemResposta, // pacotes processados sem resposta, os de difusão (subfunção 15)
+	ModBusSobrecargas, // bytes perdidos por sobrecarga da recepção da serial (subfunção 18)
+	ModBusTimeouts, // pacotes para este escravo descartados por silêncio no meio do pacote
+	ModBusNumContadores
+};
+#define ModBusContador(contador) ModBusReg(ModBusRegDiagnostico+(contador))
+
+#define ModBusFontesUsart ((1<<RXCIE)|(1<<TXCIE)|(1<<UDRIE))
+
+// Entrada e saída das interrupções da ModBus
+#define ModBusIsrAbre() do { \
+	ModBus.fontes_usart = UCSRB & ModBusFontesUsart; \
+	UCSRB &= ~ModBusFontesUsart; \
+	ModBus.fontes_timer = TIMSK & (1<<OCIE2); \
+	TIMSK &= ~(1<<OCIE2); \
+	ModBus.na_isr = 1; \
+	sei(); \
+} while(0)
+
+#define ModBusIsrFecha() do { \
+	cli(); \
+	ModBus.na_isr = 0; \
+	UCSRB |= ModBus.fontes_usart; \
+	TIMSK |= ModBus.fontes_timer; \
+} while(0)
+
+// Habilita e desabilita fontes de interrupção da serial. Dentro das interrupções da ModBus altera a cópia
+// que será aplicada na saída, senão altera o registrador, sempre com as interrupções desabilitadas.
+void ModBusHabilitaUsart(uint8_t fontes)
+{
+	if(ModBus.na_isr) ModBus.fontes_usart |= fontes;
+	else UCSRB |= fontes;
+}
+
+void ModBusDesabilitaUsart(uint8_t fontes)
+{
+	if(ModBus.na_isr) ModBus.fontes_usart &= ~fontes;
+	else UCSRB &= ~fontes;
+}
+
+// Liga o temporizador usado na modBus com o intervalo ajustado para ModBusTick_us
 // Ajustar para o clock utilizado
-void inicia_timer_1ms()
+void inicia_timer_modbus()
 {
-	OCR2 = 250;			// Ajusta o valor de comparação do timer 2
+	OCR2 = (uint8_t)((F_CPU/8/1000000UL)*ModBusTick_us-1);	// Ajusta o valor de comparação do timer 2
 	TCNT2 = 0;			// Zera a contagem do timer 2
-	TCCR2 = (1<<CS22);	// habilita o clock do timer 2 com prescaller /64
-	TIMSK |= (1<<OCIE2);	// habilita a interrupção do timer 2
+	TCCR2 = (1<<WGM21)|(1<<CS21);	// habilita o clock do timer 2 com prescaller /8, modo CTC
+	if(ModBus.na_isr) ModBus.fontes_timer = (1<<OCIE2); // habilita a interrupção do timer 2 na saída da interrupção
+	else TIMSK |= (1<<OCIE2);	// habilita a interrupção do timer 2
 }
 
-// Liga o temporizador usado na modBus, deve ficar antes do #include "ModBusSlave.h"
-void liga_timer_modbus(unsigned char t_ms)
+// Liga o temporizador usado na modBus para contar t_ticks intervalos de ModBusTick_us
+// Chamada somente dentro das interrupções da ModBus ou com as interrupções desabilitadas
+void liga_timer_modbus(unsigned int t_ticks)
 {
-	cli();
 	ModBusTimerCont=0;
-	ModBusTimerInterval=t_ms;
-	inicia_timer_1ms();
-	sei();
+	ModBusTimerInterval=t_ticks;
+	inicia_timer_modbus();
 }
 
 //	desliga o temporizador usado na modBus
 #define desliga_timer_modbus() (TCCR2 = 0) // desliga o timer da modbus
 
 // reseta o temporizador usado na modBus
-#define reset_timer_modbus() (TCNT2 = 0) // reseta o timer da modbus
+#define reset_timer_modbus() (TCNT2 = 0, ModBusTimerCont = 0) // reseta o timer da modbus
 
-uint16_t CRC16Table256(uint16_t i) // gera tabela de crc
+// tabela do crc16 modbus (polinômio 0xA001) gravada na memória de programa
+const uint16_t CRC16Table256[256] PROGMEM =
 {
-	uint16_t crc,c,j;
-	crc = 0;
-	c   = (uint16_t) i;
-	for (j=0; j<8; j++)
-	{
-		if ( (crc ^ c) & 0x0001 ) crc = ( crc >> 1 ) ^ 0xA001;
-		else crc =   crc >> 1;
-		c = c >> 1;
-    }
-	return crc;
-}
+	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+	0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+	0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+	0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+	0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+	0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+	0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+	0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+	0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+	0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+	0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+	0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+	0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+	0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+	0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+	0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+	0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+	0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+	0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+	0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+	0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+	0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+	0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+	0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+	0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+	0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+	0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+	0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+	0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+	0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+	0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
 
 uint16_t update_crc_16(uint16_t crc, uint8_t c) // atualiza o valor do crc
 {
-	uint16_t tmp, short_c;
-	short_c = 0x00ff & (uint16_t) c;
-	tmp =  crc       ^ short_c;
-	crc = (crc >> 8) ^ CRC16Table256((uint16_t) tmp & 0xff);
-	return crc;
+	return (crc >> 8) ^ pgm_read_word(&CRC16Table256[(uint8_t)(crc ^ c)]);
 }
 
 uint16_t CRC16(uint8_t *ptr,uint16_t npts) // calcula o crc de um vetor
@@ -110,19 +264,70 @@ uint16_t CRC16(uint8_t *ptr,uint16_t npts) // calcula o crc de um vetor
 	return crc;
 }
 
+// Ajusta a usart e a temporização para a taxa ModBus.nova_taxa
+void ModBusAplicaTaxa()
+{
+	const uint16_t ubrr = pgm_read_word(&ModBusTaxas[ModBus.nova_taxa].ubrr);
+	UBRRH = (uint8_t)(ubrr >> 8); // Load upper 8-bits of the baud rate value into the high byte of the UBRR register
+	UBRRL = (uint8_t)ubrr; // Load lower 8-bits of the baud rate value into the low byte of the UBRR register
+	ModBus.timeout_recepcao = pgm_read_byte(&ModBusTaxas[ModBus.nova_taxa].timeout_recepcao);
+	ModBus.turnaround = pgm_read_byte(&ModBusTaxas[ModBus.nova_taxa].turnaround);
+	ModBus.taxa = ModBus.nova_taxa;
+}
+
 void ModBusReset()
 {
+	if(ModBus.nova_taxa!=ModBus.taxa) ModBusAplicaTaxa(); // troca de taxa pendente, o barramento acabou de ficar livre
 	ModBusRxEnable();
 	ModBus.rxsize=6;
-	ModBus.end_modbus=endereco_modbus;
 	ModBus.status=aguardando;
 	ModBus.rxpt=0;
 	ModBus.txpt=0;
+	ModBus.rxcrc=0xffff; // valor inicial para CRC16modbus
+}
+
+// Envia o primeiro byte da resposta, os seguintes são transmitidos na interrupção da serial
+void ModBusIniciaTransmissao()
+{
+	ModBusTxEnable(); // Habilita a transmissão do driver 485 se necessário
+	ModBus.status = transmitindo; // indica que está transmitindo
+	UDR = ModBus.buf[ModBus.txpt]; // transmite o primeiro byte
+	ModBus.txpt++; // incrementa o ponteiro de transmissão
+	ModBusHabilitaUsart(1 << UDRIE); // habilita a interrupção da serial
+}
+
+// Solicita a troca da taxa de transmissão, aplicada somente depois que a resposta em andamento for enviada
+void ModBusAlteraTaxa(uint8_t indice)
+{
+	if(indice>=ModBusNumTaxas) return; // taxa inválida
+	cli();
+	ModBus.nova_taxa=indice;
+	if(ModBus.status==aguardando && ModBus.rxpt==0) ModBusAplicaTaxa(); // barramento livre
+	sei();
+}
+
+// Agenda a resposta para o fim do intervalo entre pacotes, contado a partir do último byte da pergunta
+void ModBusAgendaTransmissao()
+{
+	cli();
+	if(ModBus.difusao) // pedidos de difusão não têm resposta
+	{
+		ModBusContador(ModBusSemResposta)++;
+		ModBusReset();
+	}
+	else if(ModBusTimerCont>ModBusTimerInterval) // o intervalo terminou durante o processamento
+	{
+		ModBusIniciaTransmissao();
+	}
+	else // a interrupção do timer inicia a transmissão
+	{
+		ModBus.status = iniciandoTransmisao;
+	}
+	sei();
 }
 
 void ModBusDefineFunction(uint8_t rchar)
 {
-	uint16_t tmp;
 	if(rchar==3) //função 3 (identifica a função 3 do modbus)
 	{
 		ModBus.rxsize = 7; // prepara para receber 7 bytes conforme função 3
@@ -135,30 +340,144 @@ void ModBusDefineFunction(uint8_t rchar)
 		ModBus.funcao=6;
 		return;
 	}
+	if(rchar==8) //função 8 (identifica a função 8 do modbus)
+	{
+		ModBus.rxsize = 7; // prepara para receber 7 bytes, as subfunções implementadas têm um dado de 16 bits
+		ModBus.funcao=8;
+		return;
+	}
 	if(rchar==16) //função 16 (identifica a função 16 do modbus)
 	{
-		tmp=(uint16_t)((ModBus.rxbuf[4]<<8)|ModBus.rxbuf[5]);
-		ModBus.rxsize = 8+(tmp*2); // depende do número de registradores a ser alterados
+		ModBus.rxsize = 8+ModBus.buf[6]; // depende do número de bytes, conferido com a quantidade no processamento
 		ModBus.funcao=16;
 		return;
 	}
+	if(rchar==23) //função 23 (identifica a função 23 do modbus)
+	{
+		ModBus.rxsize = 11; // o tamanho depende do número de bytes a gravar, recebido no byte 10
+		ModBus.funcao=23;
+		return;
+	}
 	// função inválida, ignorando
 	ModBus.status=ignorando;
-	ModBus.rxsize = tam_buff_recep; // tamanho máximo	
+	ModBus.rxsize = tam_buff_modbus; // tamanho máximo	
+}
+
+#define ModBusFimDesconhecido 0xFFFF // função sem tamanho conhecido, o pacote termina pelo intervalo entre pacotes
+
+// Calcula a partir do cabeçalho a posição do último byte do pacote, nas funções padrão. Como um pacote
+// ignorado pode ser tanto um pedido quanto uma resposta de outro escravo, as duas posições são guardadas
+// e o crc confirma qual delas é o fim do pacote.
+void ModBusFimPacote(uint8_t c)
+{
+	switch(ModBus.rxpt)
+	{
+		case 1: // função
+			ModBus.funcao_rx=c;
+			ModBus.fim_pedido=ModBusFimDesconhecido;
+			ModBus.fim_resposta=ModBusFimDesconhecido;
+			if(c&0x80) ModBus.fim_resposta=4; // resposta de exceção
+			else if((c>=1 && c<=6) || c==8) ModBus.fim_pedido=7; // pedidos das funções 1 a 6 e de diagnóstico têm 8 bytes
+			if(c==5 || c==6 || c==8 || c==15 || c==16) ModBus.fim_resposta=7; // respostas de escrita e de diagnóstico têm 8 bytes
+			break;
+		case 2: // número de bytes das respostas de leitura
+			if((ModBus.funcao_rx>=1 && ModBus.funcao_rx<=4) || ModBus.funcao_rx==23) ModBus.fim_resposta=4+c;
+			break;
+		case 6: // número de bytes dos pedidos de escrita múltipla
+			if(ModBus.funcao_rx==15 || ModBus.funcao_rx==16) ModBus.fim_pedido=8+c;
+			break;
+		case 10: // número de bytes do pedido da função 23
+			if(ModBus.funcao_rx==23) ModBus.fim_pedido=12+c;
+			break;
+	}
 }
 
 void ModBusSendErrorMessage(uint8_t function, uint8_t code)
 {
 	uint16_t crc; // armazena o valor do crc do pacote
-	ModBus.txbuf[0]=ModBus.end_modbus; // inicia o pacote de resposta com o endereço
-	ModBus.txbuf[1]=function|0x80; // indica a função 1 na resposta com erro
-	ModBus.txbuf[2]=code; // indica o número de registradores transmitidos em bytes
-	crc=CRC16(ModBus.txbuf,3); // calcula o crc da resposta
-	ModBus.txbuf[3]=(uint8_t)(crc&0x00ff); // monta 8 bits do crc para transmitir
-	ModBus.txbuf[4]=(uint8_t)(crc>>8); // monta mais 8 bits do crc para transmitir
+	if(!ModBus.difusao) ModBusContador(ModBusExcecoes)++; // as exceções de difusão não são enviadas
+	ModBus.buf[0]=ModBus.end_modbus; // inicia o pacote de resposta com o endereço
+	ModBus.buf[1]=function|0x80; // indica a função 1 na resposta com erro
+	ModBus.buf[2]=code; // indica o número de registradores transmitidos em bytes
+	crc=CRC16(ModBus.buf,3); // calcula o crc da resposta
+	ModBus.buf[3]=(uint8_t)(crc&0x00ff); // monta 8 bits do crc para transmitir
+	ModBus.buf[4]=(uint8_t)(crc>>8); // monta mais 8 bits do crc para transmitir
 	ModBus.txsize=5; // armazena o tamanho do pacote para transmissão
-	ModBus.status = iniciandoTransmisao; // atualiza o status para o main ativar o timer
-	liga_timer_modbus(TxDelay);
+	ModBusAgendaTransmissao(); // transmite após o intervalo entre pacotes
+}
+
+// Menor entre o fim de um pedido e um limite dos registradores virtuais
+#define ModBusAte(fim, limite) ((fim) < (limite) ? (fim) : (limite))
+
+// Monta e transmite a resposta com num_reg registradores a partir do endereço inicio (funções 3 e 23)
+// Os registradores antes e depois dos virtuais são contínuos em data_reg e são copiados sem testar cada um.
+void ModBusEnviaRegistradores(uint8_t funcao, uint16_t inicio, uint16_t num_reg)
+{
+	uint16_t crc; // armazena o valor do crc do pacote
+	uint16_t cont_tx; // armazena o tamanho do pacote de transmissão
+	uint16_t reg; // registrador transmitido
+	uint16_t ate; // fim do trecho de registradores transmitido
+	uint16_t valor; // valor do registrador transmitido
+	const uint16_t fim=inicio+num_reg; // registrador seguinte ao último transmitido
+
+	ModBus.buf[0]=ModBus.end_modbus; // inicia o pacote de resposta com o endereço
+	ModBus.buf[1]=funcao; // indica a função na resposta
+	ModBus.buf[2]=(uint8_t)(num_reg*2); // indica o número de registradores transmitidos em bytes
+	cont_tx=3; // inicia o contador de tamanho do pacote de resposta
+	ate=ModBusAte(fim, ModBusVirtualInicio);
+	for(reg=inicio; reg<ate; reg++) // registradores antes dos virtuais
+	{
+		valor=ModBus.data_reg[reg];
+		ModBus.buf[cont_tx++]=(uint8_t)(valor>>8); // envia os 8 bits mais altos do registrador
+		ModBus.buf[cont_tx++]=(uint8_t)(valor&0x00ff); // envia os 8 bits mais baixos do registrador
+	}
+	ate=ModBusAte(fim, ModBusVirtualFim);
+	for(; reg<ate; reg++) // registradores virtuais, lidos pela aplicação
+	{
+		valor=ModBusLeVirtual(reg);
+		ModBus.buf[cont_tx++]=(uint8_t)(valor>>8);
+		ModBus.buf[cont_tx++]=(uint8_t)(valor&0x00ff);
+	}
+	for(; reg<fim; reg++) // registradores depois dos virtuais
+	{
+		valor=ModBus.data_reg[reg-ModBusNumVirtuais];
+		ModBus.buf[cont_tx++]=(uint8_t)(valor>>8);
+		ModBus.buf[cont_tx++]=(uint8_t)(valor&0x00ff);
+	}
+	crc=CRC16(ModBus.buf,(uint16_t)((num_reg*2)+3)); // calcula o crc da resposta
+	ModBus.buf[cont_tx]=(uint8_t)(crc&0x00ff); // monta 8 bits do crc para transmitir
+	cont_tx++; // incrementa o contador do tamanho da resposta
+	ModBus.buf[cont_tx]=(uint8_t)(crc>>8); // monta mais 8 bits do crc para transmitir
+	cont_tx++; // incrementa o contador do tamanho da resposta
+	ModBus.txsize=(uint8_t)(cont_tx); // armazena o tamanho do pacote para transmissão
+	ModBusAgendaTransmissao(); // transmite após o intervalo entre pacotes
+}
+
+// Grava num_reg registradores a partir do endereço inicio com os valores do pacote a partir de ModBus.buf[pos]
+// (funções 16 e 23). As escritas nos registradores virtuais são descartadas.
+void ModBusGravaRegistradores(uint16_t inicio, uint16_t num_reg, uint8_t pos)
+{
+	uint16_t reg; // registrador gravado
+	uint16_t ate; // fim do trecho de registradores gravado
+	const uint16_t fim=inicio+num_reg; // registrador seguinte ao último gravado
+
+	ModBus.escrita_inicio=inicio;
+	ModBus.escrita_num=(uint8_t)num_reg;
+	ate=ModBusAte(fim, ModBusVirtualInicio);
+	for(reg=inicio; reg<ate; reg++, pos+=2) // registradores antes dos virtuais
+	{
+		ModBus.data_reg[reg]=((ModBus.buf[pos]<<8)|ModBus.buf[pos+1]);
+	}
+	if(reg<ModBusVirtualFim) // pula os virtuais
+	{
+		if(fim<=ModBusVirtualFim) return;
+		pos+=2*(ModBusVirtualFim-reg);
+		reg=ModBusVirtualFim;
+	}
+	for(; reg<fim; reg++, pos+=2) // registradores depois dos virtuais
+	{
+		ModBus.data_reg[reg-ModBusNumVirtuais]=((ModBus.buf[pos]<<8)|ModBus.buf[pos+1]);
+	}
 }
 
 void ModBusProcess()
@@ -166,38 +485,25 @@ void ModBusProcess()
 	uint16_t crc; // armazena o valor do crc do pacote
 	uint16_t temp; // variável para valores temporários
 	uint16_t num_reg; // número de registradores que estão sendo lidos
-	uint16_t cont_tx; // armazena o tamanho do pacote de transmissão
+	uint16_t temp_esc; // endereço dos registradores gravados na função 23
+	uint16_t num_reg_esc; // número de registradores gravados na função 23
 	uint16_t cont; // variável para contar os registradores transmitidos
 	
-	//verificar se é rxsize-1 ou rxsize-2 nas duas linhas a seguir
-	crc=CRC16(ModBus.rxbuf,ModBus.rxsize-1); // calcula o crc do pacote
-	if((uint8_t)(crc&0x00ff)==ModBus.rxbuf[ModBus.rxsize-1]&&(uint8_t)(crc>>8)==ModBus.rxbuf[ModBus.rxsize]) // testa se o crc é válido
+	ModBus.escrita_num=0;
+	if(ModBus.rxcrc==0) // o crc calculado na recepção incluindo os próprios bytes de crc é zero se o pacote for válido
 	{
+		ModBusContador(ModBusMensagensEscravo)++;
 		if(ModBus.funcao==3) // se for a função 3
 		{
-			temp=(uint16_t)((ModBus.rxbuf[2]<<8)|ModBus.rxbuf[3]); //recebe o endereço dos registradores a serem lidos
-			num_reg=(uint16_t)((ModBus.rxbuf[4]<<8)|ModBus.rxbuf[5]); // recebe a quantidade de registradores a serem lidos
-			if((temp+num_reg-1)<num_reg_words_modbus) // verifica se é válido
+			temp=(uint16_t)((ModBus.buf[2]<<8)|ModBus.buf[3]); //recebe o endereço dos registradores a serem lidos
+			num_reg=(uint16_t)((ModBus.buf[4]<<8)|ModBus.buf[5]); // recebe a quantidade de registradores a serem lidos
+			if(num_reg<1 || num_reg>ModBusMaxRegistros) // quantidade nula ou resposta que não cabe no buffer
 			{
-				ModBus.txbuf[0]=ModBus.end_modbus; // inicia o pacote de resposta com o endereço
-				ModBus.txbuf[1]=3; // indica a função 3 na resposta
-				ModBus.txbuf[2]=(uint8_t)(num_reg*2); // indica o número de registradores transmitidos em bytes
-				cont_tx=3; // inicia o contador de tamanho do pacote de resposta
-				for(cont=0; cont<num_reg; cont++) // conta os registradores enviados
-				{
-					ModBus.txbuf[cont_tx]=(uint8_t)((ModBus.data_reg[cont+temp])>>8); // envia os 8 bits mais altos do registrador
-					cont_tx++; // incrementa o contador do tamanho da resposta
-					ModBus.txbuf[cont_tx]=(uint8_t)((ModBus.data_reg[cont+temp])&0x00ff); // envia os 8 bits mais baixos do registrador
-					cont_tx++; // incrementa o contador do tamanho da resposta
-				}
-				crc=CRC16(ModBus.txbuf,(uint16_t)((num_reg*2)+3)); // calcula o crc da resposta
-				ModBus.txbuf[cont_tx]=(uint8_t)(crc&0x00ff); // monta 8 bits do crc para transmitir
-				cont_tx++; // incrementa o contador do tamanho da resposta
-				ModBus.txbuf[cont_tx]=(uint8_t)(crc>>8); // monta mais 8 bits do crc para transmitir
-				cont_tx++; // incrementa o contador do tamanho da resposta
-				ModBus.txsize=(uint8_t)(cont_tx); // armazena o tamanho do pacote para transmissão
-				ModBus.status = iniciandoTransmisao; // atualiza o status para o main ativar o timer
-				liga_timer_modbus(TxDelay);
+				ModBusSendErrorMessage(3, 3); // retorna erro de valor ilegal
+			}
+			else if(temp<num_reg_words_modbus && num_reg<=num_reg_words_modbus-temp) // verifica se é válido, sem estourar a soma
+			{
+				ModBusEnviaRegistradores(3, temp, num_reg); // responde com os registradores lidos
 			}
 			else
 			{
@@ -207,22 +513,15 @@ void ModBusProcess()
 
 		if(ModBus.funcao==6) // se for a função 6
 		{
-			temp=(uint16_t)((ModBus.rxbuf[2]<<8)|ModBus.rxbuf[3]); //recebe o endereço do registrador a ser gravado
+			temp=(uint16_t)((ModBus.buf[2]<<8)|ModBus.buf[3]); //recebe o endereço do registrador a ser gravado
 			if(temp<num_reg_words_modbus) // verifica se é válido
 			{
-				ModBus.data_reg[temp]=((ModBus.rxbuf[4]<<8)|ModBus.rxbuf[5]); // grava o valor do registrador
-				ModBus.txbuf[0]=ModBus.end_modbus; // inicia o pacote de resposta com o endereço
-				ModBus.txbuf[1]=6; // indica a função 16
-				ModBus.txbuf[2]=ModBus.rxbuf[2]; // retorna 8 bits do dado gravado
-				ModBus.txbuf[3]=ModBus.rxbuf[3]; // retorna 8 bits do dado gravado
-				ModBus.txbuf[4]=ModBus.rxbuf[4];
-				ModBus.txbuf[5]=ModBus.rxbuf[5];
-				crc=CRC16(ModBus.txbuf,6); // calcula o crc da resposta
-				ModBus.txbuf[6]=(uint8_t)(crc&0x00ff); // monta 8 bits do crc para transmitir
-				ModBus.txbuf[7]=(uint8_t)(crc>>8); // monta mais 8 bits do crc para transmitir
+				if(!ModBusVirtual(temp)) ModBusReg(temp)=((ModBus.buf[4]<<8)|ModBus.buf[5]); // grava o valor do registrador, se não for virtual
+				ModBus.escrita_inicio=temp;
+				ModBus.escrita_num=1;
+				// a resposta é igual ao pacote recebido, que já está no buffer com o seu crc
 				ModBus.txsize=8; // armazena o tamanho do pacote para transmissão
-				ModBus.status = iniciandoTransmisao; // atualiza o status para o main ativar o timer
-				liga_timer_modbus(TxDelay);
+				ModBusAgendaTransmissao(); // transmite após o intervalo entre pacotes
 			}
 			else
 			{
@@ -230,38 +529,93 @@ void ModBusProcess()
 			}
 		}
 
-		if(ModBus.funcao==16) // se for a função 16
+		if(ModBus.funcao==8) // se for a função 8, diagnóstico
 		{
-			temp=(uint16_t)((ModBus.rxbuf[2]<<8)|ModBus.rxbuf[3]); //recebe o endereço do registrador a ser gravado
-			num_reg=(uint16_t)((ModBus.rxbuf[4]<<8)|ModBus.rxbuf[5]); // recebe a quantidade de registradores a serem gravados
-			if((temp+num_reg-1)<num_reg_words_modbus) // verifica se é válido
+			temp=(uint16_t)((ModBus.buf[2]<<8)|ModBus.buf[3]); // recebe a subfunção
+			if(temp==0x00) // retorna o dado recebido
 			{
-				ModBus.txbuf[0]=ModBus.end_modbus; // inicia o pacote de resposta com o endereço
-				ModBus.txbuf[1]=16; // indica a função 16
-				ModBus.txbuf[2]=ModBus.rxbuf[2]; // retorna 8 bits do dado gravado
-				ModBus.txbuf[3]=ModBus.rxbuf[3]; // retorna 8 bits do dado gravado
-				ModBus.txbuf[4]=ModBus.rxbuf[4]; // retorna 8 bits número de registradores gravados
-				ModBus.txbuf[5]=ModBus.rxbuf[5]; // retorna 8 bits número de registradores gravados
-				for(cont=0; cont<num_reg; cont++) // conta os registradores enviados
+				// a resposta é igual ao pacote recebido, que já está no buffer com o seu crc
+				ModBus.txsize=8; // armazena o tamanho do pacote para transmissão
+				ModBusAgendaTransmissao(); // transmite após o intervalo entre pacotes
+			}
+			else if(temp!=0x0A && (temp<0x0B || temp>0x0F) && temp!=0x12) // subfunção não implementada
+			{
+				ModBusSendErrorMessage(8, 1); // retorna erro de função ilegal
+			}
+			else if(ModBus.buf[4]!=0 || ModBus.buf[5]!=0) // o dado das demais subfunções deve ser 0
+			{
+				ModBusSendErrorMessage(8, 3); // retorna erro de valor ilegal
+			}
+			else
+			{
+				if(temp==0x0A) // zera os contadores, a resposta é igual ao pedido
 				{
-					ModBus.data_reg[temp]=((ModBus.rxbuf[(cont*2)+7]<<8)|ModBus.rxbuf[(cont*2)+8]);
-					temp++;
+					for(cont=0; cont<ModBusNumContadores; cont++) ModBusContador(cont)=0;
 				}
-				crc=CRC16(ModBus.txbuf,6); // calcula o crc da resposta
-				ModBus.txbuf[6]=(uint8_t)(crc&0x00ff); // monta 8 bits do crc para transmitir
-				ModBus.txbuf[7]=(uint8_t)(crc>>8); // monta mais 8 bits do crc para transmitir
+				else // retorna um contador, a subfunção 18 corresponde ao contador depois do da subfunção 15
+				{
+					cont=(temp==0x12) ? ModBusSobrecargas : temp-0x0B;
+					ModBus.buf[4]=(uint8_t)(ModBusContador(cont)>>8); // envia os 8 bits mais altos do contador
+					ModBus.buf[5]=(uint8_t)(ModBusContador(cont)&0x00ff); // envia os 8 bits mais baixos do contador
+				}
+				crc=CRC16(ModBus.buf,6); // calcula o crc da resposta
+				ModBus.buf[6]=(uint8_t)(crc&0x00ff); // monta 8 bits do crc para transmitir
+				ModBus.buf[7]=(uint8_t)(crc>>8); // monta mais 8 bits do crc para transmitir
 				ModBus.txsize=8; // armazena o tamanho do pacote para transmissão
-				ModBus.status = iniciandoTransmisao; // atualiza o status para o main ativar o timer
-				liga_timer_modbus(TxDelay);
+				ModBusAgendaTransmissao(); // transmite após o intervalo entre pacotes
+			}
+		}
+
+		if(ModBus.funcao==16) // se for a função 16
+		{
+			temp=(uint16_t)((ModBus.buf[2]<<8)|ModBus.buf[3]); //recebe o endereço do registrador a ser gravado
+			num_reg=(uint16_t)((ModBus.buf[4]<<8)|ModBus.buf[5]); // recebe a quantidade de registradores a serem gravados
+			if(num_reg<1 || num_reg>ModBusMaxRegistros || ModBus.buf[6]!=num_reg*2) // quantidade inválida ou diferente do número de bytes
+			{
+				ModBusSendErrorMessage(16, 3); // retorna erro de valor ilegal
+			}
+			else if(temp<num_reg_words_modbus && num_reg<=num_reg_words_modbus-temp) // verifica se é válido, sem estourar a soma
+			{
+				// a resposta repete os 6 primeiros bytes do pacote recebido (endereço, função, registrador e quantidade)
+				ModBusGravaRegistradores(temp, num_reg, 7);
+				crc=CRC16(ModBus.buf,6); // calcula o crc da resposta, depois de ler os dados que ele sobrescreve
+				ModBus.buf[6]=(uint8_t)(crc&0x00ff); // monta 8 bits do crc para transmitir
+				ModBus.buf[7]=(uint8_t)(crc>>8); // monta mais 8 bits do crc para transmitir
+				ModBus.txsize=8; // armazena o tamanho do pacote para transmissão
+				ModBusAgendaTransmissao(); // transmite após o intervalo entre pacotes
 			}
 			else
 			{
 				ModBusSendErrorMessage(16, 2); // retorna erro de endereço ilegal
 			}
 		}
+
+		if(ModBus.funcao==23) // se for a função 23, grava e depois lê na mesma transação
+		{
+			temp=(uint16_t)((ModBus.buf[2]<<8)|ModBus.buf[3]); //recebe o endereço dos registradores a serem lidos
+			num_reg=(uint16_t)((ModBus.buf[4]<<8)|ModBus.buf[5]); // recebe a quantidade de registradores a serem lidos
+			temp_esc=(uint16_t)((ModBus.buf[6]<<8)|ModBus.buf[7]); //recebe o endereço dos registradores a serem gravados
+			num_reg_esc=(uint16_t)((ModBus.buf[8]<<8)|ModBus.buf[9]); // recebe a quantidade de registradores a serem gravados
+			if(num_reg<1 || num_reg>ModBusMaxRegistros || num_reg_esc<1 || num_reg_esc>ModBusMaxRegistros
+				|| ModBus.buf[10]!=num_reg_esc*2) // quantidades inválidas ou diferentes do número de bytes
+			{
+				ModBusSendErrorMessage(23, 3); // retorna erro de valor ilegal
+			}
+			else if(temp<num_reg_words_modbus && num_reg<=num_reg_words_modbus-temp
+				&& temp_esc<num_reg_words_modbus && num_reg_esc<=num_reg_words_modbus-temp_esc) // verifica se é válido
+			{
+				ModBusGravaRegistradores(temp_esc, num_reg_esc, 11); // grava os registradores antes de montar a resposta sobre eles
+				ModBusEnviaRegistradores(23, temp, num_reg); // responde com os registradores lidos
+			}
+			else
+			{
+				ModBusSendErrorMessage(23, 2); // retorna erro de endereço ilegal
+			}
+		}
 	}
 	else // CRC inválido
 	{		
+		ModBusContador(ModBusErrosCrc)++;
 		ModBusReset();
 	}
 }
@@ -269,100 +623,153 @@ void ModBusProcess()
 // Interrupção de recepção de caractere
 ISR(USART_RXC_vect)
 {
-	cli();
-	ModBus.rxbuf[ModBus.rxpt] = UDR; // recebe o byte
-	reset_timer_modbus(); // reseta o timer da modbus
+	ModBusIsrAbre();
+	ModBusIsrInicio();
+	const uint8_t sobrecarga = UCSRA & (1<<DOR); // lido antes do UDR, cuja leitura limpa o bit
+	const uint8_t c = UDR; // recebe o byte
+	if(ModBus.status==aguardando || ModBus.status==recebendo || ModBus.status==ignorando)
+	{
+		reset_timer_modbus(); // reseta o timer da modbus
+	}
+	// durante o processamento o timer conta o intervalo até a resposta, e um byte perdido não o reinicia:
+	// se o intervalo já terminou, ModBusAgendaTransmissao esperaria por um timer parado
 	if(ModBus.status==aguardando && ModBus.rxpt==0) // primeiro byte do pacote
 	{
-		liga_timer_modbus(1); // liga o timer para detectar pacotes truncados
+		liga_timer_modbus(ModBus.timeout_recepcao); // liga o timer para detectar pacotes truncados
+		ModBusContador(ModBusMensagensBarramento)++;
+		ModBus.difusao = (c==endereco_difusao);
+		if((ModBus.end_modbus != 0) && ((c==ModBus.end_modbus) || ModBus.difusao)) //se o endereço confere inicia a recepção
+		{
+			ModBus.status=recebendo;
+		}
+		else // senão ignora o pacote sem guardá-lo
+		{
+			ModBus.status=ignorando;
+		}
+	}
+
+	if(ModBus.status==recebendo || ModBus.status==ignorando)
+	{
+		ModBus.rxcrc = update_crc_16(ModBus.rxcrc, c); // atualiza o crc a cada byte recebido
+		ModBusFimPacote(c);
+		if(sobrecarga) ModBusContador(ModBusSobrecargas)++; // um ou mais bytes anteriores a este foram perdidos
 	}
 
-	if(ModBus.status==aguardando && ModBus.rxpt==6) // recebe o começo do pacote
+	if(ModBus.status==recebendo) // só guarda os pacotes endereçados a este escravo
 	{
-		if((ModBus.end_modbus != 0) && (ModBus.rxbuf[0]==ModBus.end_modbus)) //se o endereço confere inicia a recepção
+		ModBus.buf[ModBus.rxpt] = c;
+		if(ModBus.rxpt==6) // recebe o começo do pacote
 		{
-			ModBus.status=recebendo;
-			ModBusDefineFunction(ModBus.rxbuf[1]); // seta a função
+			ModBusDefineFunction(ModBus.buf[1]); // seta a função
+			if(ModBus.difusao && ModBus.funcao!=6 && ModBus.funcao!=16) // só as funções de escrita aceitam difusão
+			{
+				ModBus.status=ignorando;
+			}
+		}
+		if(ModBus.funcao==23 && ModBus.rxpt==10) // recebe o número de bytes a gravar na função 23
+		{
+			ModBus.rxsize = 12+ModBus.buf[10]; // conferido com a quantidade de registradores no processamento
 		}
-		else // senão ignora o pacote
+		if(ModBus.rxsize>=tam_buff_modbus) // pacote maior do que o buffer
 		{
 			ModBus.status=ignorando;
-			ModBus.rxsize = tam_buff_recep; // tamanho máximo
+		}
+		else if(ModBus.rxpt==ModBus.rxsize) // recebeu o restante do pacote
+		{
+			liga_timer_modbus(ModBus.turnaround+ModBus.atraso_resposta*ModBusTicksPorMs); // conta o intervalo até a resposta
+			ModBus.status = processando;
+			ModBusPacoteRecebido();
 		}
 	}
-	if(ModBus.status==recebendo && ModBus.rxpt==ModBus.rxsize) // recebeu o restante do pacote
+
+	if(ModBus.status==ignorando && (ModBus.rxpt==ModBus.fim_pedido || ModBus.rxpt==ModBus.fim_resposta) && ModBus.rxcrc==0)
 	{
-		desliga_timer_modbus(); // desliga o timer da modbus
-		ModBus.status = processando;
+		// o pacote ignorado terminou, prepara para o próximo sem esperar o intervalo entre pacotes
+		desliga_timer_modbus();
+		ModBusReset();
 	}
-	if(ModBus.rxpt<tam_buff_recep) ModBus.rxpt++; // incrementa o ponteiro de recepção se o tamanho não chegou no limite
-	sei();
+	else if(ModBus.status==recebendo || ModBus.status==ignorando)
+	{
+		ModBus.rxpt++; // incrementa o ponteiro de recepção
+	}
+	ModBusIsrFim(RXC);
+	ModBusIsrFecha();
 }
 
 // Interrupção de fim de transmissão
 ISR(USART_TXC_vect)
 {
-	cli();
-	UCSRB &= ~(1 << TXCIE);	// desabilita a interrupção de final de transmissão
+	ModBusIsrAbre();
+	ModBusIsrInicio();
+	ModBusDesabilitaUsart(1 << TXCIE);	// desabilita a interrupção de final de transmissão
 	ModBusReset();				// prepara para receber nova transmissão
-	sei();
+	ModBusIsrFim(TXC);
+	ModBusIsrFecha();
 }
 
 // Interrupção de caractere transmitido
 ISR(USART_UDRE_vect)
 {
-	cli();
+	ModBusIsrAbre();
+	ModBusIsrInicio();
 	if(ModBus.txpt==ModBus.txsize-1) // se transmitiu o penultimo caractere do pacote
 	{
-		UDR = ModBus.txbuf[ModBus.txpt]; // transmite o ultimo byte
-		UCSRB &= ~(1 << UDRIE); // desabilita a interrupção e transmissão
-		UCSRB |= (1 << TXCIE); // habilita a interrupção de final de transmissão
+		UDR = ModBus.buf[ModBus.txpt]; // transmite o ultimo byte
+		// se esta interrupção atrasou mais que um caractere o registrador de deslocamento esvaziou e a flag TXC
+		// ficou ligada; limpa antes de habilitar a interrupção para não desligar o driver antes do último byte
+		UCSRA = (1<<U2X)|(1<<TXC);
+		ModBusDesabilitaUsart(1 << UDRIE); // desabilita a interrupção e transmissão
+		ModBusHabilitaUsart(1 << TXCIE); // habilita a interrupção de final de transmissão
 	}
 	else // se ainda não é o ultimo byte do pacote
 	{
-		UDR = ModBus.txbuf[ModBus.txpt]; // transmite o byte
+		UDR = ModBus.buf[ModBus.txpt]; // transmite o byte
 		ModBus.txpt++; // incrementa o ponteiro de transmissão
 	}
-	sei();
+	ModBusIsrFim(UDRE);
+	ModBusIsrFecha();
 }
 
 //Interrupção do temporizador
 ISR(TIMER2_COMP_vect)
 {
-	cli();
+	ModBusIsrAbre();
+	ModBusIsrInicio();
 	if(ModBusTimerCont<ModBusTimerInterval) ModBusTimerCont++;
 	if(ModBusTimerCont==ModBusTimerInterval) // intervalo finalizado
 	{
 		ModBusTimerCont++;
-		if(ModBus.status==iniciandoTransmisao)
+		desliga_timer_modbus(); // desliga o timer da modbus
+		if(ModBus.status==iniciandoTransmisao) // a resposta ficou pronta antes do fim do intervalo
 		{
-			ModBusTxEnable(); // Habilita a transmissão do driver 485 se necessário
-			ModBus.status = transmitindo; // indica que está transmitindo
-			desliga_timer_modbus(); // desliga o timer da modbus
-			UDR = ModBus.txbuf[ModBus.txpt]; // transmite o primeiro byte, os seguintes são transmitidos na interrupção da serial
-			UCSRB |= (1 << UDRIE); // habilita a interrupção da serial
-			ModBus.txpt++; // incrementa o ponteiro de transmissção
+			ModBusIniciaTransmissao();
 		}
 		
 		if(ModBus.status==aguardando || ModBus.status==recebendo|| ModBus.status==ignorando) // se o timer disparou na recepção houve erro
 		{
+			if(ModBus.status==recebendo) ModBusContador(ModBusTimeouts)++; // pacote para este escravo truncado
+			else if(ModBus.status==ignorando && ModBus.rxcrc!=0) ModBusContador(ModBusErrosCrc)++; // pacote corrompido ou truncado
+
 			ModBusReset(); // prepara para receber nova transmissão
-			desliga_timer_modbus(); // desliga o timer da modbus
 		}
 	}
-	sei();
+	ModBusIsrFim(TIMER2);
+	ModBusIsrFecha();
 }
 
-//	Inicializa a comunicação serial
-void usart_init()
+//	Inicializa a comunicação serial com a taxa de índice taxa na tabela ModBusTaxas
+void usart_init(uint8_t taxa)
 {
 	UCSRB = (1<<RXEN)|(1<<TXEN); // Turn on the transmission and reception circuitry
 	UCSRC = (1<<USBS)|(1<<UCSZ1)|(3<<UCSZ0);
-	UBRRL = BAUD_PRESCALE; // Load lower 8-bits of the baud rate value into the low byte of the UBRR register
-	UBRRH = (BAUD_PRESCALE >> 8); // Load upper 8-bits of the baud rate value into the high byte of the UBRR register
+	UCSRA = (1<<U2X); // modo de velocidade dupla, permite taxas mais altas e precisas a 16MHz
+	ModBus.nova_taxa = (taxa<ModBusNumTaxas) ? taxa : ModBusTaxaPadrao;
+	ModBusAplicaTaxa();
 	
 	UCSRB |= (1 << RXCIE); // Enable the USART Recieve Complete interrupt (USART_RXC)
 
 	ModBusTxEnableDDR |= (1<<ModBusTxEnablePin); // Habilita TX do driver RS485 como saída
 	ModBusRxEnable(); // Habilita a recepção do driver RS485
+	ModBus.atraso_resposta = TxDelay;
+	ModBus.end_modbus = endereco_modbus; // só no início, depois o endereço vem das dip switches
 }
\ No newline at end of file
@@ -1,10 +1,29 @@
 //-------------------------------------------------------------------------------------------------------
+#ifndef F_CPU
 #define F_CPU 16000000UL
+#endif
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/eeprom.h>
 #include <util/delay.h>
-#include "ModBusSlave.h"
+#include "Eventos.h"
+
+// Eventos do lao principal, sinalizados pelas interrupes
+#define EVENTO_PACOTE			(1<<0)	// pacote ModBus aguardando o ModBusProcess
+#define EVENTO_TICK				(1<<1)	// overflow do timer 0, a cada 1,024ms
+#define EVENTO_ESTATISTICA		(1<<2)	// janela das estatsticas concluda
+#define PerfOverflow()			evento_sinaliza(EVENTO_TICK)
+#define PerfPacote()			evento_sinaliza(EVENTO_PACOTE)
+
+// As amostras do scope (REG_SCOPE_DATA) ficam compactadas em scope_buffer, fora de data_reg
+#define ModBusVirtualInicio		32	// REG_SCOPE_DATA
+#define ModBusVirtualFim		176	// REG_SCOPE_DATA + 3*SCOPE_SAMPLES
+#define ModBusLeVirtual(reg)	scope_le(reg)
+uint16_t scope_le(uint16_t reg);
+
+#include "Desempenho.h"
+#include "ModbusSlave.h"
 
 //-------------------------------------------------------------------------------------------------------
 // Constants
@@ -25,23 +44,194 @@
 #define ANALOG_INPUT_OFFSET ((uint32_t)3769)
 #define CURRENT_GAIN		((int32_t)1311)
 #define CURRENT_OFFSET		((int32_t)-45462)
+// Os mesmos ajustes em ponto fixo (Q16), para trocar a diviso por 1000 por um deslocamento de 16 bits
+// na interrupo do ADC. O resultado difere do clculo com diviso em no mximo 1 unidade.
+#define ANALOG_INPUT_GAIN_Q16	((uint32_t)((ANALOG_INPUT_GAIN*65536ULL + 500)/1000))
+#define ANALOG_INPUT_OFFSET_Q16	((uint32_t)((ANALOG_INPUT_OFFSET*65536ULL + 500)/1000))
+#define CURRENT_GAIN_Q16		((int32_t)((CURRENT_GAIN*65536LL + 500)/1000))
+#define CURRENT_OFFSET_Q16		((int32_t)((CURRENT_OFFSET*65536LL - 500)/1000))
+
+// Tarefas peridicas do lao principal, contadas em overflows do timer 0
+#define TICKS_MS(ms)			((uint16_t)(((uint32_t)(ms)*PERF_OVF_POR_SEGUNDO + 999)/1000))
+#define TAREFA_COMANDOS_MS		10	// comandos do mestre, dip switch e espelho dos registradores
+#define TAREFA_LED_MS			500	// pisca o led verde e mede a folga da pilha
+#define GANHOS_GRAVACAO_MS		2000	// ganhos sem mudanas por esse tempo so gravados na EEPROM
 
 // Mximos valores para o PWM e setpoint
 #define PWM_MAX					800
 #define PWM_LIMIT				180
 #define SETPOINT_MAX			1000
 
+// Dither do PWM
+// A sada do controle tem PWM_FRAC_BITS bits fracionrios. Com o dither ligado, um modulador sigma-delta de
+// primeira ordem na interrupo de comparao B distribui a frao entre os perodos do PWM, e a mdia da largura
+// do pulso sobre a constante de tempo da bobina tem a resoluo da sada do PI, e no s os PWM_LIMIT degraus.
+#define PWM_FRAC_BITS			8
+#define PWM_DITHER_PADRAO		1
+#if (PWM_LIMIT << PWM_FRAC_BITS) > 0xFFFF
+#error "a sada do controle com PWM_FRAC_BITS bits fracionrios no cabe em 16 bits"
+#endif
+
 // Parametros da entrada analgica
 #define ANALOG_INPUT_TOO_LOW	150
 #define ANALOG_INPUT_MIN		200
 #define ANALOG_INPUT_MAX		1000
+// Escala da entrada analgica para o setpoint (Q16): SETPOINT_MAX/(ANALOG_INPUT_MAX-ANALOG_INPUT_MIN)
+#define SETPOINT_SCALE_Q16		(((uint32_t)SETPOINT_MAX*65536)/(ANALOG_INPUT_MAX - ANALOG_INPUT_MIN))
 
 // Modo de controle de corrente (open or closed loop)
 #define CLOSED_LOOP				1
 
+// Amostragem do ADC sincronizada com o PWM
+// Cada converso leva 13 ciclos do ADC (104us com prescaler /128), e  iniciada a cada ADC_TRIGGER_DIV
+// perodos de PWM, sempre na contagem ADC_TRIGGER_PHASE do timer 1. A converso s comea na borda seguinte
+// do clock do ADC (at 128 contagens depois do ADSC) e a amostra  retida 1,5 ciclo de ADC depois do incio,
+// ento a reteno acontece entre 250 e 430 contagens depois da fase, somada a latncia da interrupo.
+// Com a fase em 150 ela cai no meio do trecho desligado, longe das comutaes do PWM em 0 e em OCR1A <= PWM_LIMIT.
+#define ADC_TRIGGER_PHASE		150
+#define ADC_TRIGGER_DIV			3
+// Os dois canais so lidos alternadamente, logo o controle roda a cada 2*ADC_TRIGGER_DIV perodos de PWM
+#define CONTROL_PERIOD_CYCLES	(2UL*ADC_TRIGGER_DIV*(PWM_MAX+1)) // 4806 ciclos de clock
+#define CONTROL_PERIOD_US		((CONTROL_PERIOD_CYCLES*1000000UL)/F_CPU) // 300us
+
+// Filtro de mdia mvel das entradas analgicas (oversampling)
+// A mdia de 2^FILTER_LOG2 amostras ganha FILTER_LOG2/2 bits efetivos e  atualizada a cada amostra,
+// com custo fixo de uma soma e uma subtrao por canal na interrupo do ADC. Mximo 6 (soma em 16 bits).
+#define FILTER_LOG2				4
+#define FILTER_SIZE				(1<<FILTER_LOG2)
+// Realimentao do controlador: 0 = ltima amostra, 1 = mdia mvel (atrasa a malha em (FILTER_SIZE-1)/2 amostras)
+#define CONTROL_FILTERED_FEEDBACK	0
+#if CONTROL_FILTERED_FEEDBACK && FILTER_LOG2 > 4
+#error "a realimentao filtrada em Q16 exige FILTER_LOG2 <= 4 (produto em 32 bits)"
+#endif
+
 // Controller adjust
-#define GAIN_K1					200
+// Ajustado para CONTROL_PERIOD_US: a parcela integral GAIN_K1-GAIN_K2 foi escalada de 10 para 14
+// ao passar do perodo varivel de ~220us para 300us, mantendo a mesma constante de tempo.
+#define GAIN_K1					204
 #define GAIN_K2					190
+// O sinal de controle  calculado com PI_SCALE_LOG2 bits fracionrios, em vez de x1000, para que a
+// sada seja um deslocamento. Os ganhos so reescalados aqui, arredondados para o 1/1024 mais prximo: a
+// parcela integral K1-K2 fica em 14/1024 em vez de 14/1000, 2,3% menor (constante de tempo 2,3% maior),
+// e K2 em 195/1024 em vez de 190/1000, 0,2% maior.
+#define PI_SCALE_LOG2			10
+#if PI_SCALE_LOG2 < PWM_FRAC_BITS
+#error "o PI deve ter pelo menos PWM_FRAC_BITS bits fracionrios"
+#endif
+#define PI_GAIN_K1				((((int32_t)GAIN_K1<<PI_SCALE_LOG2) + 500)/1000)
+#define PI_GAIN_K2				(PI_GAIN_K1 - ((((int32_t)(GAIN_K1 - GAIN_K2)<<PI_SCALE_LOG2) + 500)/1000))
+// Ganhos padro do PI na forma de posio, equivalentes ao PI incremental acima: Kp = K2 e Ki = K1-K2 por perodo
+// de controle. O feedforward soma Kff*setpoint  sada e fica desligado por padro.
+// Os ganhos podem ser alterados pela ModBus ou pela auto-sintonia e ficam gravados na EEPROM.
+#define PI_KP_PADRAO			PI_GAIN_K2
+#define PI_KI_PADRAO			(PI_GAIN_K1 - PI_GAIN_K2)
+#define PI_KFF_PADRAO			0
+#define PI_GAIN_MAX				0xFFFE	// 0xFFFF  o valor da EEPROM apagada, que carrega o ganho padro
+
+// Auto-sintonia por rel
+// A sada alterna entre bias+d e bias-d em torno do setpoint, com histerese, e a corrente oscila no perodo
+// crtico Tu. A amplitude a da oscilao d o ganho crtico Ku = 4d/(pi*a), e os ganhos de Ziegler-Nichols
+// para PI so Kp = 0,45*Ku e Ti = Tu/1,2. O bias  a sada do PI no incio, que deve estar em regime.
+#define AUTOTUNE_HYST			10	// histerese do rel, em unidades de corrente
+#define AUTOTUNE_SKIP			2	// ciclos de oscilao descartados at o regime
+#define AUTOTUNE_CYCLES			4	// ciclos de oscilao medidos
+#define AUTOTUNE_TIMEOUT_MS		2000
+#define AUTOTUNE_TIMEOUT		((uint16_t)(AUTOTUNE_TIMEOUT_MS*1000UL/CONTROL_PERIOD_US))	// em perodos de controle
+#define AUTOTUNE_SETPOINT_MIN	100
+#define AUTOTUNE_RELAY_MIN		10	// menor amplitude do rel d, em contagens do PWM
+#define AUTOTUNE_KP_Q10			1174	// 0,45*4/pi*2*1024: Kp em funo de d/(pico a pico)
+#define AUTOTUNE_PARADO			0
+#define AUTOTUNE_EXECUTANDO		1
+#define AUTOTUNE_CONCLUIDO		2
+#define AUTOTUNE_FALHA			3
+#define AUTOTUNE_MEDIDO			4	// oscilao medida, os ganhos ainda sero calculados no lao principal
+
+// Registradores ModBus
+#define REG_ANALOG_INPUT		0
+#define REG_CURRENT				1
+#define REG_SETPOINT			2
+#define REG_TX_DELAY			3	// atraso adicional da resposta em ms
+#define TX_DELAY_MAX			255
+#define REG_BAUD_RATE			4	// ndice da taxa de transmisso (tabela ModBusTaxas), gravado na EEPROM
+#define REG_ANALOG_INPUT_FILT	5	// entrada analgica filtrada, em dcimos
+#define REG_CURRENT_FILT		6	// corrente filtrada, em dcimos
+#define REG_STACK_FREE			7	// menor folga da pilha desde o reset, em bytes
+#define REG_PERF_RESET			8	// escrever um valor diferente de 0 zera os piores casos medidos
+#define REG_PERF_ISR			9	// ltimo e pior tempo de cada interrupo em us, na ordem de enum perf_isr
+#define REG_ADC_PERIOD			(REG_PERF_ISR + 2*PERF_NUM_ISR)	// ltimo e maior perodo do ADC em us
+#define REG_LOOP_RATE			(REG_ADC_PERIOD + 2)	// vezes por segundo que o lao principal acordou para tratar eventos
+#define REG_MODBUS_LATENCY		(REG_LOOP_RATE + 1)	// ltima e maior latncia do ModBusProcess em us
+#define REG_SCOPE_CTRL			26	// escrever 1 arma a captura, 0 para; lido como estado da captura
+#define REG_SCOPE_TRIGGER		27	// condio de disparo (SCOPE_TRIGGER_*)
+#define REG_SCOPE_LEVEL			28	// nvel de corrente dos disparos por limiar
+#define REG_SCOPE_DECIMATION	29	// uma amostra a cada N perodos de controle
+#define REG_SCOPE_PRETRIGGER	30	// amostras guardadas antes do disparo
+#define REG_SCOPE_START			31	// ndice da amostra mais antiga no buffer
+#define REG_SCOPE_DATA			32	// amostras (corrente, setpoint, OCR1A), SCOPE_SAMPLES*3 registradores
+#define REG_SETPOINT_STAGED		176	// setpoint preparado, aplicado pelo registrador REG_SETPOINT_COMMIT
+#define REG_SETPOINT_COMMIT		177	// escrever um valor diferente de 0 copia o setpoint preparado para REG_SETPOINT, se armado
+#define REG_PROFILE_CTRL		178	// escrever 1 inicia o perfil de setpoint, 0 para; lido como 1 durante a execuo
+#define REG_PROFILE_MODE		179	// PROFILE_RAMP e PROFILE_LOOP
+#define REG_PROFILE_POINTS		180	// nmero de pontos usados da tabela
+#define REG_PROFILE_POSITION	181	// ndice do ponto onde comea o trecho em execuo
+#define REG_PROFILE_TIME		182	// tempo desde o incio do perfil, em unidades de PROFILE_TICK_MS
+#define REG_PROFILE_TABLE		183	// pontos (tempo, setpoint), PROFILE_MAX_POINTS*2 registradores
+#define REG_PI_KP				215	// ganho proporcional, em 1/1024 de contagem do PWM por unidade de corrente, gravado na EEPROM
+#define REG_PI_KI				216	// ganho integral por perodo de controle, mesma escala, gravado na EEPROM
+#define REG_PI_KFF				217	// ganho do feedforward do setpoint, mesma escala (0 desliga), gravado na EEPROM
+#define REG_AUTOTUNE			218	// escrever 1 inicia a auto-sintonia, 0 cancela; lido como estado (AUTOTUNE_*)
+#define REG_AUTOTUNE_PERIOD		219	// perodo da oscilao medida, em perodos de controle
+#define REG_AUTOTUNE_AMPLITUDE	220	// amplitude pico a pico da oscilao medida, em unidades de corrente
+#define REG_PWM_DITHER			221	// 1 liga o dither da largura do pulso, 0 desliga
+#define REG_STATS_WINDOW		222	// tamanho da janela das estatsticas, em perodos de controle
+#define REG_STATS_SEQUENCE		223	// incrementado a cada janela publicada
+#define REG_STATS_MIN			224	// menor corrente da janela
+#define REG_STATS_MAX			225	// maior corrente da janela
+#define REG_STATS_MEAN			226	// corrente mdia da janela, em dcimos
+#define REG_STATS_RMS			227	// corrente RMS da janela, em dcimos
+#define REG_STATS_ERROR			228	// mdia do erro absoluto entre o setpoint e a corrente, em dcimos
+#define REG_CHANGE_SEQUENCE		229	// incrementado a cada mudana indicada em REG_CHANGE_FLAGS
+#define REG_CHANGE_FLAGS		230	// mudanas desde a ltima confirmao do mestre (MUDANCA_*)
+#define REG_CHANGE_CLEAR		231	// escrever os bits lidos em REG_CHANGE_FLAGS os confirma; lido como 0
+#define REG_CHANGE_DEADBAND		232	// variao das medidas filtradas que conta como mudana, em unidades
+#define REG_MODBUS_DIAG			ModBusRegDiagnostico	// contadores de diagnstico da ModBus, na ordem de enum ModBusContador
+
+// Estatsticas da corrente
+// A interrupo do ADC acumula cada amostra de corrente em um de dois conjuntos de somas. No fim da janela os
+// conjuntos so trocados e o lao principal calcula e publica os resultados da janela fechada, enquanto a
+// interrupo acumula a seguinte. Os quadrados so somados divididos por 4 para que a soma caiba em 32 bits.
+#define STATS_WINDOW_MIN		16
+#define STATS_WINDOW_MAX		4096	// 1,2s, 4096*(1296^2/4) < 2^32
+#define STATS_WINDOW_PADRAO		3333	// 1s
+
+// Deteco de mudanas
+// O mestre pode ler s REG_CHANGE_SEQUENCE e REG_CHANGE_FLAGS de cada escravo e buscar os demais registradores
+// quando a sequncia mudar. As medidas so comparadas com o ltimo valor que gerou uma mudana.
+#define MUDANCA_CORRENTE		(1<<0)	// corrente filtrada variou mais que a banda morta
+#define MUDANCA_ENTRADA			(1<<1)	// entrada analgica filtrada variou mais que a banda morta
+#define MUDANCA_SETPOINT		(1<<2)
+#define MUDANCA_FALHA			(1<<3)	// entrada analgica abaixo de 4mA (led vermelho) entrou ou saiu
+#define MUDANCA_MODO			(1<<4)	// endereo, scope, perfil ou auto-sintonia mudou de estado
+#define CHANGE_DEADBAND_PADRAO	4
+
+// Perfil de setpoint
+// A tabela tem o instante de cada ponto, contado desde o incio do perfil, e o setpoint nesse instante.
+// Entre dois pontos o setpoint fica constante (degrau) ou varia linearmente (rampa).
+#define PROFILE_MAX_POINTS		16
+#define PROFILE_TICK_MS			10
+#define PROFILE_TICK_CYCLES		(F_CPU/1000*PROFILE_TICK_MS)
+#define PROFILE_RAMP			(1<<0)	// interpola linearmente entre os pontos
+#define PROFILE_LOOP			(1<<1)	// recomea do primeiro ponto depois do ltimo
+
+// Captura de formas de onda (scope)
+// As amostras ficam compactadas em scope_buffer, e o buffer fica congelado depois da captura para ser lido pelo
+// mestre com a funo 3 nos registradores virtuais REG_SCOPE_DATA em diante (scope_le), trs por amostra.
+// Cada perodo de controle dura CONTROL_PERIOD_US.
+#define SCOPE_SAMPLES			48
+#define SCOPE_TRIGGER_SETPOINT	0	// mudana do setpoint
+#define SCOPE_TRIGGER_RISING	1	// corrente passa a ser maior ou igual ao nvel
+#define SCOPE_TRIGGER_FALLING	2	// corrente passa a ser menor do que o nvel
+#define SCOPE_TRIGGER_NOW		3	// imediato, assim que as amostras de pr-disparo forem coletadas
 
 //-------------------------------------------------------------------------------------------------------
 // Global variables
@@ -60,38 +250,667 @@ volatile uint16_t current = 0;
 	range: 0-1000
 */
 volatile uint16_t setpoint = 0;
+/*	sada do controle, com PWM_FRAC_BITS bits fracionrios
+	range: 0-PWM_LIMIT
+*/
+volatile uint16_t pwm_saida = 0;
+volatile uint8_t pwm_dither = PWM_DITHER_PADRAO;
+
+/*	medidas publicadas pela interrupo do ADC para o lao principal
+	O lao principal copia a estrutura inteira e repete a cpia se a sequncia mudou no meio, em vez de
+	ler variveis de 16 bits que a interrupo pode alterar entre a leitura dos dois bytes.
+*/
+struct Medidas {
+	uint8_t sequencia;
+	uint16_t analog_input;
+	uint16_t current;
+	uint16_t analog_input_sum; // somas dos filtros de mdia mvel
+	uint16_t current_sum;
+};
+volatile struct Medidas medidas;
+
+// Configuraes persistentes
+uint8_t EEMEM eeprom_baud_rate = ModBusTaxaPadrao;
+uint16_t EEMEM eeprom_pi_kp = PI_KP_PADRAO;
+uint16_t EEMEM eeprom_pi_ki = PI_KI_PADRAO;
+uint16_t EEMEM eeprom_pi_kff = PI_KFF_PADRAO;
+
+//-------------------------------------------------------------------------------------------------------
+// Uso da pilha
+
+// A RAM livre entre o fim das variaveis (_end) e o topo da pilha (__stack)  preenchida com STACK_CANARY
+// antes da inicializao do C. Os bytes que continuam intactos nunca foram usados pela pilha, nem mesmo no
+// pior caso de aninhamento das interrupes.
+#define STACK_CANARY			0xC5
+
+#ifdef __AVR__
+extern uint8_t _end;
+extern uint8_t __stack;
+
+void stack_paint(void) __attribute__((naked, used, section(".init1")));
+void stack_paint(void)
+{
+	// Em .init1 o registrador zero e o ponteiro de pilha ainda no foram inicializados, por isso em assembly
+	__asm volatile (
+		"	ldi r30, lo8(_end)		\n"
+		"	ldi r31, hi8(_end)		\n"
+		"	ldi r24, %0				\n"
+		"	ldi r25, hi8(__stack)	\n"
+		"	rjmp 2f					\n"
+		"1:	st Z+, r24				\n"
+		"2:	cpi r30, lo8(__stack)	\n"
+		"	cpc r31, r25			\n"
+		"	brlo 1b					\n"
+		"	breq 1b					\n"
+		:: "i" (STACK_CANARY)
+	);
+}
+
+// Conta os bytes da pilha que nunca foram usados
+uint16_t stack_free(void) {
+	const uint8_t *p = &_end;
+	uint16_t livre = 0;
+	while ((p <= &__stack) && (*p == STACK_CANARY)) {
+		p++;
+		livre++;
+	}
+	return livre;
+}
+#else
+// Na simulao no host (firmware/simulacao) a pilha do AVR no existe, e o registrador 7 vale 0
+static inline uint16_t stack_free(void) {
+	return 0;
+}
+#endif
+
+//-------------------------------------------------------------------------------------------------------
+// Waveform capture
+
+#if REG_SCOPE_DATA + 3*SCOPE_SAMPLES > REG_SETPOINT_STAGED
+#error "o buffer do scope se sobrepe aos registradores seguintes"
+#endif
+#if ModBusVirtualInicio != REG_SCOPE_DATA || ModBusVirtualFim != REG_SCOPE_DATA + 3*SCOPE_SAMPLES
+#error "os registradores virtuais da ModBus devem ser os do buffer do scope"
+#endif
+#if SETPOINT_MAX > 0x3FF || PWM_MAX > 0x3FF
+#error "as amostras do scope no cabem em 4 bytes"
+#endif
+#if 3*SCOPE_SAMPLES > 255
+#error "scope_le divide o ndice do registrador por 3 com uma multiplicao de 8 bits"
+#endif
+
+// Os valores dos estados so os lidos no registrador REG_SCOPE_CTRL
+enum scope_estado {SCOPE_PARADO = 0, SCOPE_ARMADO = 2, SCOPE_DISPARADO = 3, SCOPE_CONCLUIDO = 4};
+#define SCOPE_CMD_PARAR			0
+#define SCOPE_CMD_ARMAR			1
+
+struct Scope {
+	enum scope_estado estado;
+	uint8_t trigger;
+	uint16_t level;
+	uint8_t decimation;
+	uint8_t pretrigger;
+	uint8_t divisor; // contador da dizimao
+	uint8_t index; // posio da prxima amostra no buffer
+	uint8_t amostras; // amostras vlidas antes do disparo ou restantes depois dele
+	uint16_t setpoint_anterior;
+	uint16_t current_anterior;
+};
+
+volatile struct Scope scope;
+
+// Amostra compactada em 4 bytes em vez de 3 registradores: os 8 bits mais baixos de cada valor, e os mais altos
+// juntos em altos, (corrente nos bits 0-2, setpoint nos bits 3-5 e OCR1A nos bits 6-7). Com o ADC
+// de 10 bits a corrente fica abaixo de 1300, e OCR1A vale no mximo SETPOINT_MAX, na malha aberta.
+struct ScopeAmostra {
+	uint8_t current;
+	uint8_t setpoint;
+	uint8_t pwm;
+	uint8_t altos;
+};
+
+struct ScopeAmostra scope_buffer[SCOPE_SAMPLES];
+
+static inline uint8_t scope_disparou(uint16_t i, uint16_t sp) {
+	switch (scope.trigger) {
+		case SCOPE_TRIGGER_SETPOINT:
+			return sp != scope.setpoint_anterior;
+		case SCOPE_TRIGGER_RISING:
+			return (scope.current_anterior < scope.level) && (i >= scope.level);
+		case SCOPE_TRIGGER_FALLING:
+			return (scope.current_anterior >= scope.level) && (i < scope.level);
+		default:
+			return 1;
+	}
+}
+
+static inline void scope_grava(uint16_t i, uint16_t sp, uint16_t pwm) {
+	struct ScopeAmostra *amostra = &scope_buffer[scope.index];
+	amostra->current = (uint8_t)i;
+	amostra->setpoint = (uint8_t)sp;
+	amostra->pwm = (uint8_t)pwm;
+	amostra->altos = ((uint8_t)(i >> 8) & 0x07) | (((uint8_t)(sp >> 8) & 0x07) << 3) | ((uint8_t)(pwm >> 8) << 6);
+	if (++scope.index >= SCOPE_SAMPLES) scope.index = 0;
+}
+
+// L um registrador do buffer, chamada pelo ModBusProcess no lao principal para cada registrador lido
+uint16_t scope_le(uint16_t reg) {
+	const uint8_t n = (uint8_t)(reg - REG_SCOPE_DATA);
+	const uint8_t indice = (uint8_t)(((uint16_t)n * 171) >> 9); // n/3 sem diviso, exato para n at 255
+	const uint8_t canal = n - 3*indice;
+	const uint8_t *amostra = (const uint8_t *)&scope_buffer[indice];
+	// sem desabilitar as interrupes: o buffer s  lido com a captura concluda, e ento no muda mais
+	return amostra[canal] | ((uint16_t)((amostra[3] >> (3*canal)) & 0x07) << 8);
+}
+
+// Chamada na interrupo do ADC a cada perodo de controle
+static inline void scope_amostra(uint16_t i, uint16_t sp, uint16_t pwm) {
+	if (scope.estado == SCOPE_ARMADO) {
+		if ((scope.amostras >= scope.pretrigger) && scope_disparou(i, sp)) {
+			// a amostra do disparo fica sempre logo depois das de pr-disparo
+			scope.estado = SCOPE_DISPARADO;
+			scope.amostras = SCOPE_SAMPLES - scope.pretrigger;
+			scope.divisor = 1;
+		}
+	}
+	scope.setpoint_anterior = sp;
+	scope.current_anterior = i;
+	
+	if ((scope.estado == SCOPE_ARMADO) || (scope.estado == SCOPE_DISPARADO)) {
+		if (--scope.divisor == 0) {
+			scope.divisor = scope.decimation;
+			scope_grava(i, sp, pwm);
+			if (scope.estado == SCOPE_ARMADO) {
+				if (scope.amostras < SCOPE_SAMPLES) scope.amostras++;
+			} else if (--scope.amostras == 0) {
+				scope.estado = SCOPE_CONCLUIDO; // congela o buffer, a amostra mais antiga est em index
+			}
+		}
+	}
+}
+
+// Trata os comandos e a configurao escritos pelo mestre, chamada no lao principal
+void scope_comando(void) {
+	static uint16_t publicado = SCOPE_PARADO;
+	const uint16_t comando = ModBusReg(REG_SCOPE_CTRL);
+	if (comando != publicado) {
+		if (comando == SCOPE_CMD_ARMAR) {
+			const uint16_t decimation = ModBusReg(REG_SCOPE_DECIMATION);
+			const uint16_t pretrigger = ModBusReg(REG_SCOPE_PRETRIGGER);
+			cli();
+			scope.trigger = (uint8_t)ModBusReg(REG_SCOPE_TRIGGER);
+			scope.level = ModBusReg(REG_SCOPE_LEVEL);
+			scope.decimation = (decimation == 0) ? 1 : (decimation > 255) ? 255 : (uint8_t)decimation;
+			scope.pretrigger = (pretrigger >= SCOPE_SAMPLES) ? SCOPE_SAMPLES - 1 : (uint8_t)pretrigger;
+			scope.divisor = 1;
+			scope.index = 0;
+			scope.amostras = 0;
+			scope.setpoint_anterior = setpoint;
+			scope.current_anterior = current;
+			scope.estado = SCOPE_ARMADO;
+			sei();
+		} else if (comando == SCOPE_CMD_PARAR) {
+			scope.estado = SCOPE_PARADO;
+		}
+	}
+	publicado = scope.estado;
+	ModBusReg(REG_SCOPE_CTRL) = publicado;
+	ModBusReg(REG_SCOPE_START) = (publicado == SCOPE_CONCLUIDO) ? scope.index : 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Oversampling filter
+
+#if FILTER_LOG2 > 6
+#error "FILTER_LOG2 deve ser no mximo 6"
+#endif
+
+struct Filter {
+	uint16_t buffer[FILTER_SIZE]; // ltimas amostras brutas do ADC
+	uint16_t sum; // soma das amostras do buffer
+	uint8_t index;
+};
+
+struct Filter analogInputFilter;
+struct Filter currentFilter;
+
+static inline void filterPush(struct Filter *filter, uint16_t sample) {
+	filter->sum += sample - filter->buffer[filter->index];
+	filter->buffer[filter->index] = sample;
+	filter->index = (filter->index + 1) & (FILTER_SIZE - 1);
+}
+
+// Converte a soma das amostras para dcimos da escala normal (0-10000)
+static inline uint16_t analogInputFiltered(uint16_t sum) {
+	return (uint16_t)((ANALOG_INPUT_GAIN * (uint32_t)sum + ANALOG_INPUT_OFFSET*FILTER_SIZE)/(100*FILTER_SIZE));
+}
+
+static inline uint16_t currentFiltered(uint16_t sum) {
+	const int32_t current32 = (CURRENT_GAIN * (int32_t)sum + CURRENT_OFFSET*FILTER_SIZE)/(100*FILTER_SIZE);
+	return current32 > 0 ? (uint16_t)(current32) : 0;
+}
+
+// Publica as medidas, chamada no fim da interrupo do ADC
+static inline void medidas_publica(void) {
+	medidas.sequencia++;
+	medidas.analog_input = analog_input;
+	medidas.current = current;
+	medidas.analog_input_sum = analogInputFilter.sum;
+	medidas.current_sum = currentFilter.sum;
+}
+
+// Copia as medidas no lao principal
+static void medidas_le(struct Medidas *copia) {
+	uint8_t sequencia;
+	do {
+		sequencia = medidas.sequencia;
+		copia->analog_input = medidas.analog_input;
+		copia->current = medidas.current;
+		copia->analog_input_sum = medidas.analog_input_sum;
+		copia->current_sum = medidas.current_sum;
+	} while (sequencia != medidas.sequencia);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Estatsticas da corrente
+
+struct StatsSomas {
+	uint16_t minimo;
+	uint16_t maximo;
+	uint32_t soma;
+	uint32_t soma_quadrados; // quadrados divididos por 4
+	uint32_t soma_erro;
+};
+
+struct Stats {
+	struct StatsSomas somas[2];
+	uint8_t ativo; // conjunto de somas usado pela interrupo
+	uint16_t janela; // em amostras
+	uint16_t amostras; // amostras acumuladas na janela atual
+	uint16_t fechada; // amostras da ltima janela fechada
+};
+
+volatile struct Stats stats;
+
+static inline void stats_zera(volatile struct StatsSomas *somas) {
+	somas->minimo = 0xFFFF;
+	somas->maximo = 0;
+	somas->soma = 0;
+	somas->soma_quadrados = 0;
+	somas->soma_erro = 0;
+}
+
+// Acumula uma amostra, chamada na interrupo do ADC a cada perodo de controle
+static inline void stats_amostra(uint16_t corrente, uint16_t sp) {
+	volatile struct StatsSomas *somas = &stats.somas[stats.ativo];
+	if (corrente < somas->minimo) somas->minimo = corrente;
+	if (corrente > somas->maximo) somas->maximo = corrente;
+	somas->soma += corrente;
+	somas->soma_quadrados += ((uint32_t)corrente*corrente + 2) >> 2;
+	somas->soma_erro += (sp > corrente) ? sp - corrente : corrente - sp;
+	if (++stats.amostras >= stats.janela) {
+		stats.fechada = stats.amostras;
+		stats.amostras = 0;
+		stats.ativo ^= 1;
+		stats_zera(&stats.somas[stats.ativo]);
+		evento_sinaliza(EVENTO_ESTATISTICA);
+	}
+}
+
+// Raiz quadrada inteira, arredondada para baixo
+static uint16_t raiz(uint32_t x) {
+	uint32_t r = 0;
+	uint32_t bit = 1UL << 30;
+	while (bit > x) bit >>= 2;
+	while (bit != 0) {
+		if (x >= r + bit) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint16_t)r;
+}
+
+// Publica a janela fechada, chamada no lao principal. As somas so copiadas com as interrupes desabilitadas:
+// com o lao principal parado por mais de uma janela (gravao da EEPROM), a interrupo pode fechar a janela
+// seguinte e zerar este conjunto no meio das divises.
+void stats_publica(void) {
+	cli();
+	const uint16_t n = stats.fechada;
+	const struct StatsSomas somas = stats.somas[stats.ativo ^ 1];
+	sei();
+	ModBusReg(REG_STATS_MIN) = somas.minimo;
+	ModBusReg(REG_STATS_MAX) = somas.maximo;
+	ModBusReg(REG_STATS_MEAN) = (uint16_t)((somas.soma*10 + n/2) / n);
+	// 10*sqrt(4*soma/n), com o resto da diviso para no perder a resoluo das correntes pequenas
+	ModBusReg(REG_STATS_RMS) = raiz((somas.soma_quadrados / n) * 400 + ((somas.soma_quadrados % n) * 400) / n);
+	ModBusReg(REG_STATS_ERROR) = (uint16_t)((somas.soma_erro*10 + n/2) / n);
+	ModBusReg(REG_STATS_SEQUENCE)++;
+}
+
+// Aplica o tamanho da janela escrito pelo mestre, a partir da prxima janela
+void stats_janela(void) {
+	uint16_t janela = ModBusReg(REG_STATS_WINDOW);
+	if (janela < STATS_WINDOW_MIN) janela = STATS_WINDOW_MIN;
+	else if (janela > STATS_WINDOW_MAX) janela = STATS_WINDOW_MAX;
+	ModBusReg(REG_STATS_WINDOW) = janela;
+	cli();
+	stats.janela = janela;
+	sei();
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Setpoint profile
+
+#if REG_PROFILE_TABLE + 2*PROFILE_MAX_POINTS > num_reg_words_modbus
+#error "num_reg_words_modbus no comporta a tabela do perfil"
+#endif
+
+struct Profile {
+	uint8_t running;
+	uint8_t finished; // terminou e o lao principal ainda no copiou o ltimo setpoint para o registrador
+	uint8_t mode;
+	uint8_t points;
+	uint8_t index; // ponto onde comea o trecho em execuo
+	uint16_t time; // em unidades de PROFILE_TICK_MS
+	uint32_t cycles; // ciclos de clock desde o ltimo PROFILE_TICK_MS
+	int32_t setpoint; // setpoint do perfil em Q16
+	int32_t slope[PROFILE_MAX_POINTS - 1]; // variao do setpoint por perodo de controle em Q16, de cada trecho
+	uint16_t point_time[PROFILE_MAX_POINTS]; // cpia da tabela feita ao iniciar, a interrupo no l os registradores
+	uint16_t point_setpoint[PROFILE_MAX_POINTS];
+};
+
+volatile struct Profile profile;
+
+#define PROFILE_POINT_TIME(i)		(ModBusReg(REG_PROFILE_TABLE + 2*(i)))
+#define PROFILE_POINT_SETPOINT(i)	(ModBusReg(REG_PROFILE_TABLE + 2*(i) + 1))
+
+// Inclinao da rampa por perodo de controle em Q16, calculada fora da interrupo ao iniciar o perfil.
+// O clculo em duas partes evita o estouro dos 32 bits sem usar divises de 64 bits.
+static int32_t profile_slope(int16_t delta, uint16_t ticks) {
+	if (ticks == 0) return 0;
+	const int32_t per_tick = ((int32_t)delta << 16) / ticks;
+	return (per_tick / (int32_t)PROFILE_TICK_CYCLES) * (int32_t)CONTROL_PERIOD_CYCLES
+		+ ((per_tick % (int32_t)PROFILE_TICK_CYCLES) * (int32_t)CONTROL_PERIOD_CYCLES) / (int32_t)PROFILE_TICK_CYCLES;
+}
+
+// Avana o perfil um perodo de controle, chamada na interrupo do ADC
+static inline void profile_step(void) {
+	if (!profile.running) return;
+	profile.cycles += CONTROL_PERIOD_CYCLES;
+	if (profile.cycles >= PROFILE_TICK_CYCLES) {
+		profile.cycles -= PROFILE_TICK_CYCLES;
+		profile.time++;
+	}
+	if (profile.time >= profile.point_time[profile.index + 1]) {
+		// chegou no prximo ponto, o setpoint  o da tabela para no acumular o erro da rampa
+		profile.index++;
+		if (profile.index >= profile.points - 1) {
+			if (profile.mode & PROFILE_LOOP) {
+				profile.index = 0;
+				profile.time = profile.point_time[0];
+			} else {
+				profile.running = 0; // mantm o setpoint do ltimo ponto
+				profile.finished = 1;
+			}
+		}
+		profile.setpoint = (int32_t)profile.point_setpoint[profile.index] << 16;
+	} else if (profile.mode & PROFILE_RAMP) {
+		profile.setpoint += profile.slope[profile.index];
+	}
+	setpoint = (uint16_t)(profile.setpoint >> 16);
+}
+
+// Inicia o perfil com uma cpia da tabela: as escritas do mestre nos registradores 179, 180 e 183 a 214
+// durante a execuo valem s para o prximo incio. Com o perfil parado a interrupo no usa a estrutura,
+// que  preenchida sem desabilitar as interrupes.
+void profile_start(void) {
+	profile.running = 0;
+	uint8_t points = (ModBusReg(REG_PROFILE_POINTS) > PROFILE_MAX_POINTS) ?
+		PROFILE_MAX_POINTS : (uint8_t)ModBusReg(REG_PROFILE_POINTS);
+	if (points < 2) return; // um perfil precisa de pelo menos um trecho
+	for (uint8_t i = 0; i < points; i++) {
+		const uint16_t sp = PROFILE_POINT_SETPOINT(i);
+		profile.point_time[i] = PROFILE_POINT_TIME(i);
+		profile.point_setpoint[i] = sp < SETPOINT_MAX ? sp : SETPOINT_MAX;
+		if (i > 0 && profile.point_time[i] < profile.point_time[i - 1]) return; // os tempos devem ser crescentes
+	}
+	profile.mode = (uint8_t)ModBusReg(REG_PROFILE_MODE);
+	profile.points = points;
+	for (uint8_t i = 0; i < points - 1; i++) {
+		profile.slope[i] = profile_slope((int16_t)(profile.point_setpoint[i + 1] - profile.point_setpoint[i]),
+			profile.point_time[i + 1] - profile.point_time[i]);
+	}
+	cli();
+	profile.index = 0;
+	profile.time = profile.point_time[0];
+	profile.cycles = 0;
+	profile.setpoint = (int32_t)profile.point_setpoint[0] << 16;
+	profile.running = 1;
+	sei();
+}
+
+// Trata os comandos escritos pelo mestre e publica a posio, chamada no lao principal
+void profile_comando(void) {
+	static uint16_t publicado = 0;
+	const uint16_t comando = ModBusReg(REG_PROFILE_CTRL);
+	if (comando != publicado) {
+		if (comando == 1) {
+			profile_start();
+		} else if (comando == 0) {
+			profile.running = 0;
+		}
+	}
+	publicado = profile.running;
+	ModBusReg(REG_PROFILE_CTRL) = publicado;
+	cli();
+	ModBusReg(REG_PROFILE_POSITION) = profile.index;
+	ModBusReg(REG_PROFILE_TIME) = profile.time;
+	sei();
+}
 
 //-------------------------------------------------------------------------------------------------------
 // Run PI control
 
+#define PI_OUTPUT_MAX			((int32_t)PWM_LIMIT<<PI_SCALE_LOG2)
+
 struct PI {
-	int16_t previousError;
-	int32_t controlSignal;
+	int32_t integral; // parcela integral, com PI_SCALE_LOG2 bits fracionrios
+	uint16_t kp;
+	uint16_t ki;
+	uint16_t kff;
 };
 
 void piClear(struct PI *pi) {
-	pi->previousError = 0;
-	pi->controlSignal = 0;
+	pi->integral = 0;
 }
 
 struct PI piCurrent;
 
 uint16_t piControl(struct PI *pi, uint16_t setPoint, uint16_t feedBack)
 {
-	int16_t error = setPoint - feedBack;
-	pi->controlSignal += GAIN_K1 * error - GAIN_K2 * pi->previousError;
-	pi->previousError = error;
+	const int16_t error = setPoint - feedBack;
+	const int32_t proporcional = (int32_t)pi->kp * error + (int32_t)pi->kff * setPoint;
+	int32_t controlSignal = proporcional + pi->integral;
 	
-	if (pi->controlSignal >= (int32_t)PWM_LIMIT*1000) {
-		pi->controlSignal = (int32_t)PWM_LIMIT*1000;
-	} else if (pi->controlSignal < 0) {
-		pi->controlSignal = 0;
+	// Anti-windup por integrao condicional: o integrador fica parado enquanto a sada estiver saturada
+	// e o erro empurrar para o mesmo lado, e volta a integrar assim que o erro mudar de sinal.
+	if (!((controlSignal >= PI_OUTPUT_MAX && error > 0) || (controlSignal <= 0 && error < 0))) {
+		pi->integral += (int32_t)pi->ki * error;
+		if (pi->integral > PI_OUTPUT_MAX) {
+			pi->integral = PI_OUTPUT_MAX;
+		} else if (pi->integral < -PI_OUTPUT_MAX) {
+			pi->integral = -PI_OUTPUT_MAX;
+		}
+		controlSignal = proporcional + pi->integral;
+	}
+	
+	if (controlSignal >= PI_OUTPUT_MAX) {
+		controlSignal = PI_OUTPUT_MAX;
+	} else if (controlSignal < 0) {
+		controlSignal = 0;
+	}
+
+	return (uint16_t)(controlSignal>>(PI_SCALE_LOG2 - PWM_FRAC_BITS)); // mantm PWM_FRAC_BITS bits fracionrios
+}
+
+// Carrega os ganhos dos registradores no controlador
+void piGanhos(struct PI *pi) {
+	cli();
+	pi->kp = ModBusReg(REG_PI_KP);
+	pi->ki = ModBusReg(REG_PI_KI);
+	pi->kff = ModBusReg(REG_PI_KFF);
+	sei();
+}
+
+// Perodos da tarefa de comandos at a gravao dos ganhos na EEPROM, 0 sem gravao pendente. Cada mudana
+// reinicia a contagem: uma sequncia de ajustes do mestre grava a EEPROM uma vez s, e a gravao, que
+// ocupa o lao principal por alguns ms, fica fora do processamento dos pacotes.
+uint8_t ganhos_pendentes;
+
+// Carrega os ganhos novos e agenda a gravao
+static void piGanhosNovos(void) {
+	piGanhos(&piCurrent);
+	ganhos_pendentes = GANHOS_GRAVACAO_MS/TAREFA_COMANDOS_MS;
+}
+
+// Grava na EEPROM os ganhos que mudaram, chamada na tarefa de comandos
+static void ganhos_grava(void) {
+	if (ganhos_pendentes == 0 || --ganhos_pendentes != 0) {
+		return;
 	}
+	eeprom_update_word(&eeprom_pi_kp, piCurrent.kp);
+	eeprom_update_word(&eeprom_pi_ki, piCurrent.ki);
+	eeprom_update_word(&eeprom_pi_kff, piCurrent.kff);
+}
+
+static uint16_t eeprom_ganho(uint16_t *endereco, uint16_t padrao) {
+	const uint16_t valor = eeprom_read_word(endereco);
+	return (valor == 0xFFFF) ? padrao : valor; // EEPROM apagada
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Auto-sintonia do PI por realimentao com rel
 
-	return (uint16_t)(pi->controlSignal/1000);
+struct Autotune {
+	uint8_t estado;
+	uint8_t rele; // sada do rel em bias+d
+	uint8_t ciclos; // subidas do rel desde o incio
+	uint16_t bias; // sada central do rel, em contagens do PWM
+	uint16_t amplitude; // amplitude d do rel, em contagens do PWM
+	uint16_t duracao; // perodos de controle desde o incio
+	uint16_t periodos; // perodos de controle dos ciclos medidos
+	uint16_t maximo;
+	uint16_t minimo;
+};
+
+volatile struct Autotune autotune;
+
+// Encerra o rel e devolve a sada ao PI a partir do bias, sem degrau
+static inline uint16_t autotune_fim(uint8_t estado) {
+	autotune.estado = estado;
+	piCurrent.integral = (int32_t)autotune.bias << PI_SCALE_LOG2;
+	return autotune.bias;
+}
+
+// Sada do rel em um perodo de controle, chamada na interrupo do ADC
+static inline uint16_t autotune_step(uint16_t setPoint, uint16_t feedBack) {
+	const int16_t error = setPoint - feedBack;
+	if (autotune.rele && error < -AUTOTUNE_HYST) {
+		autotune.rele = 0;
+	} else if (!autotune.rele && error > AUTOTUNE_HYST) {
+		autotune.rele = 1;
+		autotune.ciclos++;
+		if (autotune.ciclos == AUTOTUNE_SKIP) {
+			// comea a medir na subida do rel
+			autotune.periodos = 0;
+			autotune.maximo = feedBack;
+			autotune.minimo = feedBack;
+		} else if (autotune.ciclos == AUTOTUNE_SKIP + AUTOTUNE_CYCLES) {
+			return autotune_fim(AUTOTUNE_MEDIDO);
+		}
+	}
+	if (feedBack > autotune.maximo) autotune.maximo = feedBack;
+	if (feedBack < autotune.minimo) autotune.minimo = feedBack;
+	autotune.periodos++;
+	if (++autotune.duracao >= AUTOTUNE_TIMEOUT) {
+		return autotune_fim(AUTOTUNE_FALHA); // no oscilou
+	}
+	return autotune.rele ? autotune.bias + autotune.amplitude : autotune.bias - autotune.amplitude;
+}
+
+void autotune_start(void) {
+	cli();
+	const uint16_t saida = pwm_saida >> PWM_FRAC_BITS;
+	const uint16_t sp = setpoint;
+	sei();
+	const uint16_t amplitude = (saida < PWM_LIMIT - saida) ? saida : PWM_LIMIT - saida;
+	if (!CLOSED_LOOP || profile.running || sp < AUTOTUNE_SETPOINT_MIN || amplitude < AUTOTUNE_RELAY_MIN) {
+		autotune.estado = AUTOTUNE_FALHA;
+		return;
+	}
+	cli();
+	autotune.rele = 1;
+	autotune.ciclos = 0;
+	autotune.bias = saida;
+	autotune.amplitude = amplitude;
+	autotune.duracao = 0;
+	autotune.periodos = 0;
+	autotune.maximo = 0;
+	autotune.minimo = 0xFFFF;
+	autotune.estado = AUTOTUNE_EXECUTANDO;
+	sei();
+}
+
+// Calcula os ganhos de Ziegler-Nichols a partir da oscilao medida
+static void autotune_calcula(void) {
+	const uint16_t pico_a_pico = autotune.maximo - autotune.minimo;
+	const uint16_t periodos = autotune.periodos;
+	ModBusReg(REG_AUTOTUNE_PERIOD) = periodos / AUTOTUNE_CYCLES;
+	ModBusReg(REG_AUTOTUNE_AMPLITUDE) = pico_a_pico;
+	if (pico_a_pico == 0 || periodos == 0) {
+		autotune.estado = AUTOTUNE_FALHA;
+		return;
+	}
+	uint32_t kp = ((uint32_t)autotune.amplitude * AUTOTUNE_KP_Q10) / pico_a_pico;
+	if (kp > PI_GAIN_MAX) kp = PI_GAIN_MAX;
+	// Ki = Kp*T/Ti = 1,2*Kp/Tu, com Tu em perodos de controle
+	uint32_t ki = (kp * 6 * AUTOTUNE_CYCLES) / (5UL * periodos);
+	if (ki > PI_GAIN_MAX) ki = PI_GAIN_MAX;
+	else if (ki == 0) ki = 1;
+	ModBusReg(REG_PI_KP) = (uint16_t)kp;
+	ModBusReg(REG_PI_KI) = (uint16_t)ki;
+	piGanhosNovos();
+	autotune.estado = AUTOTUNE_CONCLUIDO;
+}
+
+// Trata os comandos escritos pelo mestre e publica o estado, chamada no lao principal
+void autotune_comando(void) {
+	static uint16_t publicado = 0;
+	const uint16_t comando = ModBusReg(REG_AUTOTUNE);
+	if (comando != publicado) {
+		if (comando == 1) {
+			autotune_start();
+		} else if (comando == 0) {
+			cli();
+			if (autotune.estado == AUTOTUNE_EXECUTANDO) {
+				autotune_fim(AUTOTUNE_PARADO);
+			}
+			autotune.estado = AUTOTUNE_PARADO;
+			sei();
+		}
+	}
+	if (autotune.estado == AUTOTUNE_MEDIDO) {
+		autotune_calcula();
+	}
+	publicado = autotune.estado;
+	ModBusReg(REG_AUTOTUNE) = publicado;
 }
 
-static inline void controle(void) {
+static inline void controle(uint16_t feedback) {
 	// operando com setpoint enviado pela entrada analgica
 	if (ModBus.end_modbus == 0) {
 		if (analog_input < ANALOG_INPUT_MIN) {
@@ -99,13 +918,22 @@ static inline void controle(void) {
 		} else if (analog_input > ANALOG_INPUT_MAX) {
 			setpoint = SETPOINT_MAX;
 		} else {
-			uint32_t sp32 = ((uint32_t)SETPOINT_MAX)*((uint32_t)(analog_input - ANALOG_INPUT_MIN));
-			setpoint = (uint16_t) (sp32/((uint32_t)(ANALOG_INPUT_MAX - ANALOG_INPUT_MIN)));
+			uint32_t sp32 = SETPOINT_SCALE_Q16*((uint32_t)(analog_input - ANALOG_INPUT_MIN));
+			setpoint = (uint16_t) (sp32>>16);
 		}
+	} else {
+		profile_step(); // executa o perfil de setpoint, se estiver ativo
 	}
 	
 	#if CLOSED_LOOP
-		OCR1A = piControl(&piCurrent, setpoint, current);
+		if (autotune.estado == AUTOTUNE_EXECUTANDO) {
+			pwm_saida = autotune_step(setpoint, feedback) << PWM_FRAC_BITS;
+		} else {
+			pwm_saida = piControl(&piCurrent, setpoint, feedback);
+		}
+		if (!pwm_dither) {
+			OCR1A = pwm_saida >> PWM_FRAC_BITS; // com o dither, OCR1A  atualizado a cada perodo na comparao B
+		}
 	#else // open loop
 		OCR1A = setpoint;
 	#endif
@@ -125,26 +953,235 @@ static inline uint16_t dip_switch(void) {
 // O ADC do Atmega8 no  muito bom. Segundo o datasheet, no deveriamos usar uma frequencia maior do que 200kHz,
 // o que restringe bastante a frequncia de operao. Alm disso, o ADC consome 13 ciclos para fazer a medio,
 // o que implica na frequncia de amostragem mxima de 200/13 = 15,38kHz (medindo apenas um canal).
-// E acima de tudo isso, no existe um meio para medir continuamente varios canais, temos de tratar isso no 
-// codigo da interupo, o que torna a frequencia de amostragem variavel com o codigo gravado no processador.
+// E acima de tudo isso, o Atmega8 no tem disparo automtico do ADC por timer, ento as converses so
+// iniciadas pela interrupo de comparao B do timer 1, para que a frequencia de amostragem no dependa
+// do codigo gravado no processador.
+ISR(TIMER1_COMPB_vect)
+{
+	PerfIsrInicio();
+	static uint8_t divisor = ADC_TRIGGER_DIV;
+	if (--divisor == 0) {
+		divisor = ADC_TRIGGER_DIV;
+		ADCSRA |= (1<<ADSC); // inicia nova converso sempre na mesma fase do PWM
+	}
+	#if CLOSED_LOOP
+	if (pwm_dither) {
+		// Sigma-delta: a frao acumulada soma uma contagem ao pulso sempre que passa de 1. OCR1A tem buffer duplo
+		// e o novo valor s vale a partir do prximo perodo, ento a escrita no meio do perodo no gera glitch.
+		static uint8_t residuo = 0;
+		const uint16_t soma = residuo + (uint8_t)pwm_saida;
+		residuo = (uint8_t)soma;
+		OCR1A = (pwm_saida >> PWM_FRAC_BITS) + (soma >> PWM_FRAC_BITS);
+	}
+	#endif
+	PerfIsrFim(PERF_COMPB);
+}
+
 ISR(ADC_vect)
 {
-	cli();
-	// fs = 4.54kHz, T = 220us (medido experimentalmente com o osciloscpio)
+	PerfIsrInicio();
+	perf_adc();
+	// fs = 6.66kHz, T = 150us, fixos pelo timer 1 (medido no registrador REG_ADC_PERIOD)
 	uint32_t adc = ADCW;
 	
-	// Le prximo canal
+	// Seleciona o canal da prxima converso
 	ADMUX ^= (1<<MUX0);
-	ADCSRA |= (1<<ADSC);
 	
 	if (ADMUX & (1<<MUX0)) {
-		const int32_t current32 = (CURRENT_GAIN * (int32_t)adc + CURRENT_OFFSET)/1000;
+		const int32_t current32 = (CURRENT_GAIN_Q16 * (int32_t)adc + CURRENT_OFFSET_Q16)>>16;
 		current = current32 > 0 ? (uint16_t)(current32) : 0;
-		controle();
+		filterPush(&currentFilter, (uint16_t)adc);
+		#if CONTROL_FILTERED_FEEDBACK
+			const int32_t feedback32 = (CURRENT_GAIN_Q16 * (int32_t)currentFilter.sum + CURRENT_OFFSET_Q16*FILTER_SIZE)>>(16+FILTER_LOG2);
+			controle(feedback32 > 0 ? (uint16_t)(feedback32) : 0);
+		#else
+			controle(current);
+		#endif
+		scope_amostra(current, setpoint, OCR1A);
+		stats_amostra(current, setpoint);
 	} else {
-		analog_input = (uint16_t)((ANALOG_INPUT_GAIN * (uint32_t)adc + ANALOG_INPUT_OFFSET)/1000);
+		analog_input = (uint16_t)((ANALOG_INPUT_GAIN_Q16 * (uint32_t)adc + ANALOG_INPUT_OFFSET_Q16)>>16);
+		filterPush(&analogInputFilter, (uint16_t)adc);
 	}
+	medidas_publica();
+	PerfIsrFim(PERF_ADC);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Deteco de mudanas
+
+struct Mudancas {
+	uint16_t corrente; // medidas filtradas da ltima mudana, em dcimos
+	uint16_t entrada;
+	uint16_t setpoint;
+	uint16_t modo;
+	uint8_t falha;
+	uint8_t pendentes; // bits ainda no confirmados pelo mestre
+};
+
+struct Mudancas mudancas;
+
+// Indica se a medida se afastou mais que a banda morta do valor da ltima mudana, e nesse caso o atualiza
+static uint8_t mudanca_medida(uint16_t *anterior, uint16_t atual, uint16_t banda) {
+	const uint16_t diferenca = (atual > *anterior) ? atual - *anterior : *anterior - atual;
+	if (diferenca <= banda) return 0;
+	*anterior = atual;
+	return 1;
+}
+
+// Compara o estado atual com o da ltima mudana, chamada no lao principal a cada TAREFA_COMANDOS_MS
+static void mudancas_verifica(const struct Medidas *atuais, uint8_t falha) {
+	const uint16_t banda = (ModBusReg(REG_CHANGE_DEADBAND) < 0xFFFF/10) ? ModBusReg(REG_CHANGE_DEADBAND)*10 : 0xFFFF;
+	uint8_t bits = 0;
+	if (mudanca_medida(&mudancas.corrente, currentFiltered(atuais->current_sum), banda)) {
+		bits |= MUDANCA_CORRENTE;
+	}
+	if (mudanca_medida(&mudancas.entrada, analogInputFiltered(atuais->analog_input_sum), banda)) {
+		bits |= MUDANCA_ENTRADA;
+	}
+	cli();
+	const uint16_t sp = setpoint;
+	sei();
+	if (mudanca_medida(&mudancas.setpoint, sp, 0)) {
+		bits |= MUDANCA_SETPOINT;
+	}
+	if (falha != mudancas.falha) {
+		mudancas.falha = falha;
+		bits |= MUDANCA_FALHA;
+	}
+	const uint16_t modo = ModBus.end_modbus | ((uint16_t)scope.estado << 8) | ((uint16_t)autotune.estado << 11)
+		| ((uint16_t)profile.running << 14);
+	if (mudanca_medida(&mudancas.modo, modo, 0)) {
+		bits |= MUDANCA_MODO;
+	}
+	if (bits) {
+		mudancas.pendentes |= bits;
+		ModBusReg(REG_CHANGE_SEQUENCE)++;
+	}
+	ModBusReg(REG_CHANGE_FLAGS) = mudancas.pendentes;
+}
+
+// Confirma as mudanas escritas pelo mestre. Um registrador separado evita que a escrita do mesmo valor lido
+// passe despercebida, e uma mudana que ocorrer entre a leitura e a confirmao continua pendente.
+static void mudancas_confirma(void) {
+	if (ModBusReg(REG_CHANGE_CLEAR) != 0) {
+		mudancas.pendentes &= ~(uint8_t)ModBusReg(REG_CHANGE_CLEAR);
+		ModBusReg(REG_CHANGE_CLEAR) = 0;
+	}
+	ModBusReg(REG_CHANGE_FLAGS) = mudancas.pendentes;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Tarefas do lao principal
+
+static void espelha_medidas(const struct Medidas *atuais) {
+	ModBusReg(REG_ANALOG_INPUT) = atuais->analog_input;
+	ModBusReg(REG_CURRENT) = atuais->current;
+	ModBusReg(REG_ANALOG_INPUT_FILT) = analogInputFiltered(atuais->analog_input_sum);
+	ModBusReg(REG_CURRENT_FILT) = currentFiltered(atuais->current_sum);
+}
+
+// Aplica os registradores escritos pelo mestre e publica o setpoint gerado pelo perfil
+static void aplica_registradores(void) {
+	cli();
+	const uint8_t profile_setpoint = profile.running || profile.finished;
+	if (profile_setpoint) {
+		ModBusReg(REG_SETPOINT) = setpoint; // o setpoint  definido pelo perfil
+		profile.finished = 0;
+	}
+	sei();
+	if (!profile_setpoint) {
+		const uint16_t novo = (ModBusReg(REG_SETPOINT) < SETPOINT_MAX) ? ModBusReg(REG_SETPOINT) : SETPOINT_MAX;
+		cli();
+		setpoint = novo;
+		sei();
+	}
+	if (ModBusReg(REG_TX_DELAY) > TX_DELAY_MAX) {
+		ModBusReg(REG_TX_DELAY) = TX_DELAY_MAX;
+	}
+	ModBus.atraso_resposta = (uint8_t)ModBusReg(REG_TX_DELAY);
+	mudancas_confirma();
+	if (ModBusReg(REG_STATS_WINDOW) != stats.janela) {
+		stats_janela();
+	}
+	for (uint8_t i = REG_PI_KP; i <= REG_PI_KFF; i++) {
+		if (ModBusReg(i) > PI_GAIN_MAX) {
+			ModBusReg(i) = PI_GAIN_MAX;
+		}
+	}
+	if (ModBusReg(REG_PI_KP) != piCurrent.kp || ModBusReg(REG_PI_KI) != piCurrent.ki
+		|| ModBusReg(REG_PI_KFF) != piCurrent.kff) {
+		piGanhosNovos(); // ganhos escritos pelo mestre
+	}
+	if (ModBusReg(REG_BAUD_RATE) != ModBus.nova_taxa) {
+		if (ModBusReg(REG_BAUD_RATE) < ModBusNumTaxas) {
+			// a nova taxa passa a valer depois da resposta  escrita
+			eeprom_update_byte(&eeprom_baud_rate, (uint8_t)ModBusReg(REG_BAUD_RATE));
+			ModBusAlteraTaxa((uint8_t)ModBusReg(REG_BAUD_RATE));
+		} else {
+			ModBusReg(REG_BAUD_RATE) = ModBus.nova_taxa;
+		}
+	}
+}
+
+// S as cpias dos campos de 16 bits ficam com as interrupes desabilitadas: as converses demoram mais
+// que uma contagem do ADC e atrasariam o disparo da converso na interrupo de comparao B
+static void publica_desempenho(void) {
+	for (uint8_t i = 0; i < PERF_NUM_ISR; i++) {
+		ModBusReg(REG_PERF_ISR + 2*i) = perf_us(perf.isr[i].ultimo);
+		ModBusReg(REG_PERF_ISR + 2*i + 1) = perf_us(perf.isr[i].pior);
+	}
+	cli();
+	const uint16_t adc_periodo = perf.adc_periodo, adc_periodo_max = perf.adc_periodo_max;
+	const uint16_t latencia = perf.latencia, latencia_max = perf.latencia_max;
 	sei();
+	ModBusReg(REG_ADC_PERIOD) = perf_us(adc_periodo);
+	ModBusReg(REG_ADC_PERIOD + 1) = perf_us(adc_periodo_max);
+	ModBusReg(REG_MODBUS_LATENCY) = perf_us(latencia);
+	ModBusReg(REG_MODBUS_LATENCY + 1) = perf_us(latencia_max);
+}
+
+// Comandos do mestre, endereo nas dip switches e leds de erro, a cada TAREFA_COMANDOS_MS
+static void tarefa_comandos(void) {
+	if (ModBusReg(REG_PERF_RESET) != 0) {
+		ModBusReg(REG_PERF_RESET) = 0;
+		perf_reset();
+	}
+	scope_comando();
+	profile_comando();
+	autotune_comando();
+	pwm_dither = (ModBusReg(REG_PWM_DITHER) != 0);
+	
+	if (ModBus.status == aguardando || ModBus.end_modbus == 0) {
+		uint8_t novo_endereco = dip_switch();
+		if (ModBus.end_modbus != novo_endereco) {
+			autotune.estado = AUTOTUNE_PARADO;
+			cli();
+			setpoint = 0; // reseta o setpoint para desligar o sistema
+			piClear(&piCurrent);
+			sei();
+			profile.running = 0;
+			ModBusReg(REG_SETPOINT) = 0;
+			ModBus.end_modbus = novo_endereco;
+		}
+	}
+	
+	struct Medidas atuais;
+	medidas_le(&atuais);
+	if (ModBus.end_modbus != 0)	{
+		espelha_medidas(&atuais);
+		aplica_registradores();
+	}
+	
+	const uint8_t falha = (ModBus.end_modbus == 0) && (atuais.analog_input < ANALOG_INPUT_TOO_LOW);
+	if (falha) {
+		// liga led vermelho para indicar que a entrada analgica est recebendo menos de 4mA
+		SET_RED_LED();
+	} else {
+		CLEAR_RED_LED();
+	}
+	mudancas_verifica(&atuais, falha);
+	ganhos_grava();
 }
 
 //-------------------------------------------------------------------------------------------------------
@@ -158,71 +1195,114 @@ int main(void)
 	
 	//-----------------------------------
 	// ADC - Entradas Analgicas
-	// Frequencia de Amostragem = 4.8kHz (medio de dois canais em sequncia)
+	// Frequencia de Amostragem = 3.33kHz por canal (medio de dois canais em sequncia)
 	ADMUX = (1<<REFS0);
-	// Prescaler = /128, conversion cycles = 13, f = 9.6kHz, T = 200us
+	// Prescaler = /128, conversion cycles = 13, T = 104us
+	// As converses so iniciadas pelo timer 1
 	ADCSRA = (1<<ADEN)|(1<<ADIE)|(1<<ADPS2)|(1<<ADPS1)|(1<<ADPS0);
-	// Inicia nova converso
-	ADCSRA |= (1<<ADSC);
 
 	//-----------------------------------
 	// Timer 1 - PWM
 	PORTB |= (1<<PB1);
 	TCNT1 = 0;
 	OCR1A = 0;
-	ICR1 = PWM_MAX; // Freq = 10kHz
+	ICR1 = PWM_MAX; // Freq = 20kHz
+	OCR1B = ADC_TRIGGER_PHASE; // fase do disparo do ADC, o pino OC1B no  usado
 	TCCR1A = (1 << COM1A1)|(1 << COM1A0)|(1 << WGM11); // Set OC1A on Compare Match and clear at BOTTOM
 	TCCR1B = (1 << WGM13)|(1 << WGM12)|(1 << CS10); // Mode 14, Fast PWM, overflow on ICR1, set prescaler to 1
+	TIMSK |= (1 << OCIE1B); // dispara as converses do ADC
 	DDRB |= (1<<DDB1);
 	
-	usart_init(); // inicia a comunicao serial utilizada na ModBus
+	usart_init(eeprom_read_byte(&eeprom_baud_rate)); // inicia a comunicao serial utilizada na ModBus
 	ModBusReset(); // prepara para receber a transmisso
+	ModBusReg(REG_TX_DELAY) = TxDelay;
+	ModBusReg(REG_BAUD_RATE) = ModBus.taxa;
 	
 	// Inicializa variaveis internas do controlador
 	piClear(&piCurrent);
+	ModBusReg(REG_PI_KP) = eeprom_ganho(&eeprom_pi_kp, PI_KP_PADRAO);
+	ModBusReg(REG_PI_KI) = eeprom_ganho(&eeprom_pi_ki, PI_KI_PADRAO);
+	ModBusReg(REG_PI_KFF) = eeprom_ganho(&eeprom_pi_kff, PI_KFF_PADRAO);
+	piGanhos(&piCurrent);
+	ModBusReg(REG_PWM_DITHER) = PWM_DITHER_PADRAO;
+	ModBusReg(REG_STATS_WINDOW) = STATS_WINDOW_PADRAO;
+	stats_janela();
+	stats_zera(&stats.somas[0]);
+	ModBusReg(REG_CHANGE_DEADBAND) = CHANGE_DEADBAND_PADRAO;
+	ModBusReg(REG_SCOPE_DECIMATION) = 1;
+	ModBusReg(REG_SCOPE_PRETRIGGER) = SCOPE_SAMPLES/4;
+	
+	perf_init(); // timer 0 usado nas medies de tempo e nas tarefas peridicas
+	evento_init();
 	
 	// Enable interrupts
 	sei();
 	
-	uint32_t counter = 0;
+	struct Periodica janela = {PERF_OVF_POR_SEGUNDO, 0};
+	struct Periodica comandos = {TICKS_MS(TAREFA_COMANDOS_MS), 0};
+	struct Periodica led = {TICKS_MS(TAREFA_LED_MS), 0};
+	uint32_t iteracoes = 0;
+	uint8_t setpoint_armado = 0; // setpoint preparado escrito desde a ltima aplicao
 	
 	// Main loop
+	// Trata os eventos sinalizados pelas interrupes e dorme enquanto no houver nenhum
 	while (1)
 	{
-		counter++;
-		if (counter >= 50000) {
-			counter = 0;
-			TOOGLE_GREEN_LED();
-		}
+		const uint8_t pendentes = evento_espera();
+		iteracoes++;
 		
-		if (ModBus.status == aguardando || ModBus.end_modbus == 0) {
-			uint8_t novo_endereco = dip_switch();
-			if (ModBus.end_modbus != novo_endereco) {
-				setpoint = 0; // reseta o setpoint para desligar o sistema
-				piClear(&piCurrent);
-				ModBus.data_reg[2] = 0;
-				ModBus.end_modbus = novo_endereco;
+		if ((pendentes & EVENTO_PACOTE) && ModBus.end_modbus != 0 && ModBus.status == processando) {
+			struct Medidas atuais;
+			medidas_le(&atuais);
+			espelha_medidas(&atuais); // a resposta leva as medidas do ltimo perodo de controle
+			perf_latencia();
+			ModBusProcess(); // inicia o processamento do pacote
+			// aplica o setpoint preparado logo depois do pacote, normalmente uma difuso para todos os controladores.
+			// S um setpoint escrito desde a ltima aplicao  aplicado: um n que no recebeu o valor novo
+			// mantm o setpoint em uso, em vez de voltar ao valor preparado de um lote anterior. A aplicao interrompe
+			// o perfil de setpoint, que seno sobrescreveria o valor aplicado no perodo de controle seguinte.
+			if (ModBusEscrito(REG_SETPOINT_STAGED)) {
+				setpoint_armado = 1;
 			}
+			if (ModBusReg(REG_SETPOINT_COMMIT) != 0) {
+				ModBusReg(REG_SETPOINT_COMMIT) = 0;
+				if (setpoint_armado) {
+					setpoint_armado = 0;
+					cli();
+					profile.running = 0;
+					profile.finished = 0; // o ltimo ponto de um perfil que acabou de terminar tambm perde para o valor aplicado
+					sei();
+					ModBusReg(REG_SETPOINT) = ModBusReg(REG_SETPOINT_STAGED);
+				}
+			}
+			aplica_registradores();
+			// os comandos escritos no pacote valem imediatamente, sem esperar a tarefa peridica
+			scope_comando();
+			profile_comando();
+			autotune_comando();
 		}
 		
-		if (ModBus.end_modbus != 0)	{
-			if (ModBus.status == processando) {
-				ModBusProcess(); // inicia o processamento do pacote
-			}
-			ModBus.data_reg[0] = analog_input;
-			ModBus.data_reg[1] = current;
-			if (ModBus.data_reg[2] < SETPOINT_MAX) {
-				setpoint = ModBus.data_reg[2];
-			} else {
-				setpoint = SETPOINT_MAX;
-			}
+		if (pendentes & EVENTO_ESTATISTICA) {
+			stats_publica();
 		}
 		
-		if ((ModBus.end_modbus == 0) && (analog_input < ANALOG_INPUT_TOO_LOW)) {
-			// liga led vermelho para indicar que a entrada analgica est recebendo menos de 4mA
-			SET_RED_LED();
-		} else {
-			CLEAR_RED_LED();
+		if (pendentes & EVENTO_TICK) {
+			cli();
+			const uint16_t agora = perf_overflows;
+			sei();
+			// Publica as medies de tempo a cada segundo
+			if (periodica_vence(&janela, agora)) {
+				ModBusReg(REG_LOOP_RATE) = iteracoes > 0xFFFF ? 0xFFFF : (uint16_t)iteracoes;
+				iteracoes = 0;
+				publica_desempenho();
+			}
+			if (periodica_vence(&comandos, agora)) {
+				tarefa_comandos();
+			}
+			if (periodica_vence(&led, agora)) {
+				TOOGLE_GREEN_LED();
+				ModBusReg(REG_STACK_FREE) = stack_free();
+			}
 		}
 	}
 }
@@ -0,0 +1,32 @@
+/*
+ *		avr/eeprom.h da simulação no host
+ *
+ *		As variáveis EEMEM ficam na seção sim_eeprom, que é a própria EEPROM simulada, iniciada com os
+ *		valores do arquivo .eep. Cada byte gravado ocupa a EEPROM por 8,5ms, e as leituras e gravações
+ *		seguintes esperam o fim da gravação anterior com as interrupções funcionando, como na avr-libc.
+ */
+
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EEMEM __attribute__((section("sim_eeprom")))
+
+uint8_t eeprom_read_byte(const uint8_t *endereco);
+uint16_t eeprom_read_word(const uint16_t *endereco);
+uint32_t eeprom_read_dword(const uint32_t *endereco);
+void eeprom_read_block(void *destino, const void *origem, size_t n);
+void eeprom_write_byte(uint8_t *endereco, uint8_t valor);
+void eeprom_write_word(uint16_t *endereco, uint16_t valor);
+void eeprom_write_dword(uint32_t *endereco, uint32_t valor);
+void eeprom_write_block(const void *origem, void *destino, size_t n);
+void eeprom_update_byte(uint8_t *endereco, uint8_t valor);
+void eeprom_update_word(uint16_t *endereco, uint16_t valor);
+void eeprom_update_dword(uint32_t *endereco, uint32_t valor);
+void eeprom_update_block(const void *origem, void *destino, size_t n);
+int eeprom_is_ready(void);
+void eeprom_busy_wait(void);
+
+#endif
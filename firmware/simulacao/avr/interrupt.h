@@ -0,0 +1,34 @@
+/*
+ *		avr/interrupt.h da simulação no host
+ *
+ *		As rotinas de interrupção viram funções comuns, chamadas pelo simulador na ordem de prioridade
+ *		dos vetores do ATmega8 quando a flag e a habilitação da fonte estão ligadas e o bit I do SREG
+ *		está ligado. O sei só permite novas interrupções a partir do bloco básico seguinte.
+ */
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+void sim_sei(void);
+void sim_cli(void);
+#define sei() sim_sei()
+#define cli() sim_cli()
+
+#define ISR(vetor, ...) void vetor(void); void vetor(void)
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR_NAKED
+#define EMPTY_INTERRUPT(vetor) void vetor(void) {}
+
+#define TIMER2_COMP_vect	sim_isr_timer2_comp
+#define TIMER1_COMPB_vect	sim_isr_timer1_compb
+#define TIMER1_OVF_vect		sim_isr_timer1_ovf
+#define TIMER0_OVF_vect		sim_isr_timer0_ovf
+#define USART_RXC_vect		sim_isr_usart_rxc
+#define USART_UDRE_vect		sim_isr_usart_udre
+#define USART_TXC_vect		sim_isr_usart_txc
+#define ADC_vect			sim_isr_adc
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ *		avr/io.h da simulação no host
+ *
+ *		Registradores de E/S do ATmega8 usados pelo firmware. Ficam todos na estrutura sim_io, que o
+ *		simulador compara com uma cópia a cada bloco básico executado para detectar as escritas do
+ *		firmware e aplicar os seus efeitos (partida de timers, conversões do ADC, transmissão serial).
+ *
+ *		Diferenças em relação ao hardware, que o firmware não usa:
+ *		- TCNT1 e TCNT2 só podem ser escritos, a leitura não retorna a contagem;
+ *		- UDR tem 16 bits e vale 0xFFFF fora da interrupção de recepção, para que a escrita de qualquer
+ *		  byte seja detectada;
+ *		- UCSRC e UBRRH ocupam o mesmo endereço como no ATmega8: a escrita sem o bit URSEL altera o UBRRH;
+ *		- o bit TXC do UCSRA é lido sempre em 0, para que a escrita de 1 que limpa a flag seja detectada
+ *		  mesmo quando a flag está ligada.
+ */
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+struct sim_io
+{
+	uint8_t SREG;
+	uint8_t MCUCR;
+	uint8_t PORTB, DDRB, PORTC, DDRC, PORTD, DDRD;
+	uint8_t ADMUX, ADCSRA;
+	uint16_t ADCW;
+	uint8_t TCCR0, TCNT0;
+	uint8_t TCCR1A, TCCR1B;
+	uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+	uint8_t TCCR2, OCR2;
+	uint16_t TCNT2;
+	uint8_t TIMSK, TIFR;
+	uint8_t UCSRA, UCSRB, UBRRL, UBRRH_UCSRC;
+	uint16_t UDR;
+};
+
+extern volatile struct sim_io sim_io;
+volatile uint8_t *sim_tcnt0(void);
+uint8_t sim_pinb(void);
+uint8_t sim_pinc(void);
+uint8_t sim_pind(void);
+
+// O simulador define SIM_NUCLEO para usar os nomes dos campos da estrutura sem as macros
+#ifndef SIM_NUCLEO
+#define SREG	sim_io.SREG
+#define MCUCR	sim_io.MCUCR
+#define PORTB	sim_io.PORTB
+#define DDRB	sim_io.DDRB
+#define PORTC	sim_io.PORTC
+#define DDRC	sim_io.DDRC
+#define PORTD	sim_io.PORTD
+#define DDRD	sim_io.DDRD
+#define PINB	sim_pinb()
+#define PINC	sim_pinc()
+#define PIND	sim_pind()
+#define ADMUX	sim_io.ADMUX
+#define ADCSRA	sim_io.ADCSRA
+#define ADCW	sim_io.ADCW
+#define ADC		sim_io.ADCW
+#define TCCR0	sim_io.TCCR0
+#define TCNT0	(*sim_tcnt0()) // lê a contagem atual
+#define TCCR1A	sim_io.TCCR1A
+#define TCCR1B	sim_io.TCCR1B
+#define TCNT1	sim_io.TCNT1
+#define OCR1A	sim_io.OCR1A
+#define OCR1B	sim_io.OCR1B
+#define ICR1	sim_io.ICR1
+#define TCCR2	sim_io.TCCR2
+#define TCNT2	sim_io.TCNT2
+#define OCR2	sim_io.OCR2
+#define TIMSK	sim_io.TIMSK
+#define TIFR	sim_io.TIFR
+#define UCSRA	sim_io.UCSRA
+#define UCSRB	sim_io.UCSRB
+#define UCSRC	sim_io.UBRRH_UCSRC
+#define UBRRH	sim_io.UBRRH_UCSRC
+#define UBRRL	sim_io.UBRRL
+#define UDR		sim_io.UDR
+#endif
+
+#define RAMSTART	0x60
+#define RAMEND		0x45F
+#define E2END		0x1FF
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+// PORTB, DDRB e PINB
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+#define DDB6 6
+#define DDB7 7
+
+// PORTC, DDRC e PINC
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define DDC0 0
+#define DDC1 1
+#define DDC2 2
+#define DDC3 3
+#define DDC4 4
+#define DDC5 5
+#define DDC6 6
+
+// PORTD, DDRD e PIND
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define DDD0 0
+#define DDD1 1
+#define DDD2 2
+#define DDD3 3
+#define DDD4 4
+#define DDD5 5
+#define DDD6 6
+#define DDD7 7
+
+// MCUCR
+#define SE 7
+#define SM2 6
+#define SM1 5
+#define SM0 4
+
+// ADMUX
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define MUX3 3
+#define MUX2 2
+#define MUX1 1
+#define MUX0 0
+
+// ADCSRA
+#define ADEN 7
+#define ADSC 6
+#define ADFR 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+// TCCR0
+#define CS02 2
+#define CS01 1
+#define CS00 0
+
+// TCCR1A e TCCR1B
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define FOC1A 3
+#define FOC1B 2
+#define WGM11 1
+#define WGM10 0
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+
+// TCCR2
+#define FOC2 7
+#define WGM20 6
+#define COM21 5
+#define COM20 4
+#define WGM21 3
+#define CS22 2
+#define CS21 1
+#define CS20 0
+
+// TIMSK
+#define OCIE2 7
+#define TOIE2 6
+#define TICIE1 5
+#define OCIE1A 4
+#define OCIE1B 3
+#define TOIE1 2
+#define TOIE0 0
+
+// TIFR
+#define OCF2 7
+#define TOV2 6
+#define ICF1 5
+#define OCF1A 4
+#define OCF1B 3
+#define TOV1 2
+#define TOV0 0
+
+// UCSRA
+#define RXC 7
+#define TXC 6
+#define UDRE 5
+#define FE 4
+#define DOR 3
+#define PE 2
+#define U2X 1
+#define MPCM 0
+
+// UCSRB
+#define RXCIE 7
+#define TXCIE 6
+#define UDRIE 5
+#define RXEN 4
+#define TXEN 3
+#define UCSZ2 2
+#define RXB8 1
+#define TXB8 0
+
+// UCSRC
+#define URSEL 7
+#define UMSEL 6
+#define UPM1 5
+#define UPM0 4
+#define USBS 3
+#define UCSZ1 2
+#define UCSZ0 1
+#define UCPOL 0
+
+#endif
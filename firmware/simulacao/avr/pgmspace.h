@@ -0,0 +1,19 @@
+/*
+ *		avr/pgmspace.h da simulação no host, a memória de programa é a memória comum
+ */
+
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(endereco) (*(const uint8_t *)(endereco))
+#define pgm_read_word(endereco) (*(const uint16_t *)(endereco))
+#define pgm_read_dword(endereco) (*(const uint32_t *)(endereco))
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#endif
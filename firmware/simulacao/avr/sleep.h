@@ -0,0 +1,26 @@
+/*
+ *		avr/sleep.h da simulação no host
+ *
+ *		O sleep_cpu avança o tempo até a próxima interrupção, se o bit SE do MCUCR estiver ligado.
+ */
+
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE			0
+#define SLEEP_MODE_ADC			(1<<SM0)
+#define SLEEP_MODE_PWR_DOWN		(1<<SM1)
+#define SLEEP_MODE_PWR_SAVE		((1<<SM0)|(1<<SM1))
+#define SLEEP_MODE_STANDBY		((1<<SM1)|(1<<SM2))
+
+void sim_dorme(void);
+
+#define set_sleep_mode(modo) (MCUCR = (MCUCR & ~((1<<SM0)|(1<<SM1)|(1<<SM2))) | (modo))
+#define sleep_enable() (MCUCR |= (1<<SE))
+#define sleep_disable() (MCUCR &= ~(1<<SE))
+#define sleep_cpu() sim_dorme()
+#define sleep_mode() do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ *		barramento.c
+ *
+ *		Mestre ModBus RTU do lado do barramento simulado, usado pelos roteiros.
+ */
+
+#include <string.h>
+
+#include "simulador.h"
+
+double sim_latencia_us = -1;
+double sim_resposta_us = -1;
+double sim_timeout_ms = 150;
+
+static uint64_t fim_pacote; // fim do último pacote no barramento, do mestre ou do escravo
+
+// O mestre respeita o intervalo entre pacotes do RTU depois do último pacote: 3,5 caracteres, fixo em
+// 1750us acima de 19200bps. Sem ele o primeiro byte do pedido pode chegar com o driver do escravo
+// ainda ligado pela resposta anterior.
+static void espera_intervalo(void)
+{
+	const uint64_t intervalo = sim_linha.taxa > 19200 ? SIM_US(1750) : sim_tempo_caractere()*7/2;
+	if (sim_ciclo < fim_pacote + intervalo) sim_espera(fim_pacote + intervalo - sim_ciclo);
+}
+
+uint16_t sim_crc16(const uint8_t *dados, uint16_t n)
+{
+	uint16_t crc = 0xFFFF;
+	for (uint16_t i = 0; i < n; i++) {
+		crc ^= dados[i];
+		for (uint8_t b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+	return crc;
+}
+
+uint16_t sim_pacote(uint8_t *pacote, uint16_t n)
+{
+	const uint16_t crc = sim_crc16(pacote, n);
+	pacote[n] = (uint8_t)crc;
+	pacote[n + 1] = (uint8_t)(crc >> 8);
+	return n + 2;
+}
+
+static int completa(uint16_t esperado, uint64_t silencio)
+{
+	if (!sim_num_recebidos) return 0;
+	if (esperado && sim_num_recebidos >= esperado) return 1;
+	if (sim_num_recebidos >= 5 && (sim_recebidos[1].valor & 0x80)) return 1; // exceção
+	return sim_ciclo - sim_recebidos[sim_num_recebidos - 1].fim >= silencio;
+}
+
+uint16_t sim_transacao(const uint8_t *pedido, uint16_t n, uint8_t *resposta, uint16_t esperado, double timeout_ms)
+{
+	uint8_t pacote[260];
+	memcpy(pacote, pedido, n);
+	n = sim_pacote(pacote, n);
+	espera_intervalo();
+	sim_num_recebidos = 0;
+	sim_envia(pacote, n);
+	const uint64_t fim_pedido = sim_fim_envio();
+	const uint64_t limite = fim_pedido + SIM_MS(timeout_ms);
+	const uint64_t silencio = sim_tempo_caractere()*7/2;
+
+	sim_espera(fim_pedido - sim_ciclo);
+	while (!completa(esperado, silencio) && sim_ciclo < limite) {
+		uint64_t ate = limite;
+		if (sim_num_recebidos && sim_recebidos[sim_num_recebidos - 1].fim + silencio < ate) {
+			ate = sim_recebidos[sim_num_recebidos - 1].fim + silencio;
+		}
+		sim_espera_byte(ate - sim_ciclo);
+	}
+
+	const uint16_t recebidos = sim_num_recebidos;
+	fim_pacote = recebidos ? sim_recebidos[recebidos - 1].fim : fim_pedido;
+	for (uint16_t i = 0; i < recebidos; i++) resposta[i] = sim_recebidos[i].valor;
+	if (recebidos) {
+		sim_latencia_us = SIM_CICLOS_US(sim_recebidos[0].fim - sim_tempo_caractere() - fim_pedido);
+		sim_resposta_us = SIM_CICLOS_US(sim_recebidos[recebidos - 1].fim - fim_pedido);
+	} else {
+		sim_latencia_us = sim_resposta_us = -1;
+	}
+	return recebidos;
+}
+
+// 0 se a resposta tiver o tamanho e o crc certos, o código da exceção, ou -1
+static int confere(const uint8_t *resposta, uint16_t n, uint16_t esperado, uint8_t endereco, uint8_t funcao)
+{
+	for (uint16_t i = 0; i < n; i++) {
+		if (sim_recebidos[i].erro) return -1;
+	}
+	if (n < 5 || sim_crc16(resposta, n - 2) != (resposta[n - 2] | resposta[n - 1] << 8) || resposta[0] != endereco) return -1;
+	if (n == 5 && resposta[1] == (funcao | 0x80)) return resposta[2];
+	return (n == esperado && resposta[1] == funcao) ? 0 : -1;
+}
+
+// Difusão: sem resposta, espera o fim do pedido e o silêncio que marca o fim do pacote
+static int difusao(const uint8_t *pedido, uint16_t n)
+{
+	uint8_t pacote[260];
+	memcpy(pacote, pedido, n);
+	n = sim_pacote(pacote, n);
+	espera_intervalo();
+	sim_envia(pacote, n);
+	fim_pacote = sim_fim_envio();
+	sim_espera(sim_fim_envio() - sim_ciclo + sim_tempo_caractere()*4);
+	return 0;
+}
+
+int sim_le(uint8_t endereco, uint16_t registrador, uint16_t quantidade, uint16_t *valores)
+{
+	const uint8_t pedido[6] = {endereco, 3, registrador >> 8, (uint8_t)registrador, quantidade >> 8, (uint8_t)quantidade};
+	uint8_t resposta[SIM_MAX_RECEBIDOS];
+	const uint16_t esperado = 5 + 2*quantidade;
+	const uint16_t n = sim_transacao(pedido, sizeof pedido, resposta, esperado, sim_timeout_ms);
+	const int r = confere(resposta, n, esperado, endereco, 3);
+	if (r) return r;
+	if (resposta[2] != 2*quantidade) return -1;
+	for (uint16_t i = 0; i < quantidade; i++) valores[i] = (uint16_t)(resposta[3 + 2*i] << 8 | resposta[4 + 2*i]);
+	return 0;
+}
+
+int sim_escreve(uint8_t endereco, uint16_t registrador, uint16_t valor)
+{
+	const uint8_t pedido[6] = {endereco, 6, registrador >> 8, (uint8_t)registrador, valor >> 8, (uint8_t)valor};
+	if (!endereco) return difusao(pedido, sizeof pedido);
+	uint8_t resposta[SIM_MAX_RECEBIDOS];
+	const uint16_t n = sim_transacao(pedido, sizeof pedido, resposta, 8, sim_timeout_ms);
+	const int r = confere(resposta, n, 8, endereco, 6);
+	if (r) return r;
+	return memcmp(resposta, pedido, sizeof pedido) ? -1 : 0;
+}
+
+int sim_escreve_varios(uint8_t endereco, uint16_t registrador, uint16_t quantidade, const uint16_t *valores)
+{
+	uint8_t pedido[260] = {endereco, 16, registrador >> 8, (uint8_t)registrador, quantidade >> 8, (uint8_t)quantidade,
+		(uint8_t)(2*quantidade)};
+	for (uint16_t i = 0; i < quantidade; i++) {
+		pedido[7 + 2*i] = valores[i] >> 8;
+		pedido[8 + 2*i] = (uint8_t)valores[i];
+	}
+	const uint16_t n = 7 + 2*quantidade;
+	if (!endereco) return difusao(pedido, n);
+	uint8_t resposta[SIM_MAX_RECEBIDOS];
+	const uint16_t recebidos = sim_transacao(pedido, n, resposta, 8, sim_timeout_ms);
+	const int r = confere(resposta, recebidos, 8, endereco, 16);
+	if (r) return r;
+	return memcmp(resposta, pedido, 6) ? -1 : 0;
+}
+
+void sim_espera_silencio(uint64_t intervalo)
+{
+	sim_espera(sim_fim_envio() + intervalo - sim_ciclo);
+}
+
+static uint8_t sorteia(uint32_t *semente, uint16_t n) // 0 a n-1, n até 256
+{
+	*semente = *semente*1103515245u + 12345u;
+	return (uint8_t)((*semente >> 16) % n);
+}
+
+void sim_outro_escravo(uint8_t endereco, uint32_t *semente, uint8_t *pedido, uint16_t *n_pedido,
+	uint8_t *resposta, uint16_t *n_resposta)
+{
+	static const uint8_t funcoes[] = {1, 2, 3, 4, 5, 6, 16, 23};
+	const uint8_t funcao = funcoes[sorteia(semente, sizeof funcoes)];
+	const uint8_t quantidade = 1 + sorteia(semente, 16);
+	uint16_t p = 0, r = 0;
+	pedido[p++] = resposta[r++] = endereco;
+	pedido[p++] = resposta[r++] = funcao;
+	for (uint8_t i = 0; i < 4; i++) pedido[p++] = sorteia(semente, 256); // endereço e quantidade ou valor
+	if (funcao <= 4) {
+		pedido[4] = 0;
+		pedido[5] = quantidade;
+		const uint8_t bytes = funcao <= 2 ? (quantidade + 7)/8 : 2*quantidade;
+		resposta[r++] = bytes;
+		for (uint8_t i = 0; i < bytes; i++) resposta[r++] = sorteia(semente, 256);
+	} else {
+		if (funcao == 16) {
+			pedido[4] = 0;
+			pedido[5] = quantidade;
+			pedido[p++] = 2*quantidade;
+			for (uint8_t i = 0; i < 2*quantidade; i++) pedido[p++] = sorteia(semente, 256);
+		} else if (funcao == 23) {
+			const uint8_t escritos = 1 + sorteia(semente, 16);
+			pedido[4] = 0;
+			pedido[5] = quantidade;
+			for (uint8_t i = 0; i < 2; i++) pedido[p++] = sorteia(semente, 256);
+			pedido[p++] = 0;
+			pedido[p++] = escritos;
+			pedido[p++] = 2*escritos;
+			for (uint8_t i = 0; i < 2*escritos; i++) pedido[p++] = sorteia(semente, 256);
+			resposta[r++] = 2*quantidade;
+			for (uint8_t i = 0; i < 2*quantidade; i++) resposta[r++] = sorteia(semente, 256);
+		}
+		if (funcao != 23) {
+			for (uint8_t i = 2; i < 6; i++) resposta[r++] = pedido[i]; // eco do endereço e do valor ou quantidade
+		}
+	}
+	if (sorteia(semente, 8) == 0) { // exceção
+		r = 1;
+		resposta[r++] = funcao | 0x80;
+		resposta[r++] = 1 + sorteia(semente, 4);
+	}
+	*n_pedido = sim_pacote(pedido, p);
+	*n_resposta = sim_pacote(resposta, r);
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Executa uma medição com o firmware de cada revisão do git indicada:
+#
+#   ./compara.sh <medição> <revisão>...
+#
+# As fontes de cada revisão são extraídas em compilacao/<revisão>/fontes. A revisão "atual" usa as
+# fontes do diretório de trabalho, com as alterações ainda não gravadas.
+
+set -e
+cd "$(dirname "$0")"
+medicao=$1
+shift
+raiz=$(git rev-parse --show-toplevel)
+for revisao in "$@"; do
+	dir=compilacao/$(echo "$revisao" | tr '/^~:' '____')
+	if [ "$revisao" = atual ]; then
+		fontes=../ControleCargaMotor
+		titulo="diretório de trabalho"
+	else
+		fontes=$dir/fontes
+		rm -rf "$fontes"
+		mkdir -p "$fontes"
+		git -C "$raiz" archive "$revisao" firmware/ControleCargaMotor | tar -x -C "$fontes" --strip-components=2
+		# a primeira versão inclui o cabeçalho como ModBusSlave.h
+		[ -e "$fontes/ModBusSlave.h" ] || ln -s ModbusSlave.h "$fontes/ModBusSlave.h"
+		titulo=$(git log -1 --format=%s "$revisao")
+	fi
+	make -s FONTES="$fontes" COMPILACAO="$dir" "$dir/$medicao" >&2
+	echo "== $revisao ($titulo)"
+	"$dir/$medicao"
+done
@@ -0,0 +1,47 @@
+/*
+ *		Período e fase da amostragem da corrente e período do laço de controle, com o controle em degraus
+ *		de setpoint, primeiro sem tráfego no barramento e depois com leituras contínuas a 19200bps. As leituras
+ *		são dos registradores 0 a 2, que existem em todas as versões do firmware.
+ */
+
+#include "simulador.h"
+
+static void imprime(const char *titulo)
+{
+	const struct SimEstatistica *a = &sim_controle.amostragem, *p = &sim_controle.periodo;
+	printf("%s:\n", titulo);
+	printf("  retenção da amostra: período %.2f a %.2fus (jitter %.2fus), Timer1 em %llu a %llu de 800\n",
+		SIM_CICLOS_US(a->min), SIM_CICLOS_US(a->max), SIM_CICLOS_US(a->max - a->min),
+		(unsigned long long)sim_controle.fase.min, (unsigned long long)sim_controle.fase.max);
+	printf("  interrupção do controle: período %.2f a %.2fus, média %.2fus (jitter %.2fus)\n",
+		SIM_CICLOS_US(p->min), SIM_CICLOS_US(p->max), SIM_CICLOS_US(sim_estatistica_media(p)),
+		SIM_CICLOS_US(p->max - p->min));
+}
+
+static void roteiro(void)
+{
+	uint16_t v[3];
+	sim_espera_ms(50);
+
+	sim_perfil_zera();
+	for (int i = 0; i < 10; i++) {
+		sim_escreve(1, 2, (i & 1) ? 200 : 1000);
+		sim_espera_ms(200);
+	}
+	imprime("sem tráfego");
+
+	sim_perfil_zera();
+	const uint64_t inicio = sim_ciclo;
+	unsigned leituras = 0;
+	while (sim_ciclo - inicio < SIM_MS(2000)) {
+		if (sim_le(1, 0, 3, v) == 0) leituras++;
+	}
+	char titulo[64];
+	snprintf(titulo, sizeof titulo, "com %u leituras de 3 registradores em 2s", leituras);
+	imprime(titulo);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,56 @@
+/*
+ *		Ciclo limite em regime, com o dither do PWM (registrador 221) desligado e ligado: depois de 600ms de
+ *		acomodação, a corrente na bobina é amostrada a cada 5us por 200ms, e a média de cada período do PWM
+ *		(50us, 10 amostras) tira a ondulação do próprio PWM. São mostradas a amplitude pico a pico e a média
+ *		dessas médias. Versões sem o registrador 221 não têm dither e só têm a primeira coluna.
+ */
+
+#include "simulador.h"
+
+static const uint16_t setpoints[] = {20, 50, 101, 333, 777};
+#define NUM_SETPOINTS (sizeof(setpoints)/sizeof(setpoints[0]))
+
+static void mede(double *pico_a_pico, double *media)
+{
+	double minimo = 1e9, maximo = -1e9, soma = 0;
+	unsigned n = 0;
+	for (uint64_t inicio = sim_ciclo; sim_ciclo - inicio < SIM_MS(200); n++) {
+		double periodo = 0;
+		for (unsigned j = 0; j < 10; j++) {
+			sim_espera_us(5);
+			periodo += sim_corrente()/10;
+		}
+		if (periodo < minimo) minimo = periodo;
+		if (periodo > maximo) maximo = periodo;
+		soma += periodo;
+	}
+	*pico_a_pico = maximo - minimo;
+	*media = soma/n;
+}
+
+static void roteiro(void)
+{
+	sim_espera_ms(50);
+	printf("%8s | %25s | %25s\n", "", "sem dither", "com dither");
+	printf("%8s | %12s %12s | %12s %12s\n", "setpoint", "pico a pico", "média", "pico a pico", "média");
+	for (unsigned i = 0; i < NUM_SETPOINTS; i++) {
+		printf("%8u |", setpoints[i]);
+		for (uint16_t dither = 0; dither <= 1; dither++) {
+			if (sim_escreve(1, 221, dither) == 2 && dither) { // sem o registrador 221
+				printf(" %25s |", "-");
+				continue;
+			}
+			sim_escreve(1, 2, setpoints[i]);
+			sim_espera_ms(600);
+			double pico_a_pico, media;
+			mede(&pico_a_pico, &media);
+			printf(" %12.2f %12.2f |", pico_a_pico, media);
+		}
+		printf("\n");
+	}
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
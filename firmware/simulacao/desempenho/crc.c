@@ -0,0 +1,34 @@
+/*
+ *		Custo do CRC: ciclos da interrupção de recepção por byte, ciclos do ModBusProcess e tempo do fim do
+ *		pedido ao início da resposta, em leituras de 3 registradores a 19200bps.
+ */
+
+#include "simulador.h"
+
+#define LEITURAS 50
+
+static void roteiro(void)
+{
+	uint16_t v[3];
+	struct SimEstatistica latencia = {0};
+	unsigned falhas = 0;
+	sim_espera_ms(50);
+	sim_perfil_zera();
+	for (int i = 0; i < LEITURAS; i++) {
+		if (sim_le(1, 0, 3, v) == 0) sim_estatistica_soma(&latencia, SIM_US(sim_latencia_us));
+		else falhas++;
+	}
+
+	const struct SimEstatistica *rx = &sim_perfil[SIM_USART_RXC].exclusivos;
+	printf("interrupção de recepção: %.1f ciclos por byte (máximo %llu) em %u bytes\n",
+		sim_estatistica_media(rx), (unsigned long long)rx->max, rx->n);
+	printf("ModBusProcess: %.0f ciclos por pedido (máximo %llu)\n",
+		sim_estatistica_media(&sim_processamento), (unsigned long long)sim_processamento.max);
+	printf("fim do pedido ao início da resposta: %.1fus (mínimo %.1fus, máximo %.1fus), %u leituras sem resposta\n",
+		SIM_CICLOS_US(sim_estatistica_media(&latencia)), SIM_CICLOS_US(latencia.min), SIM_CICLOS_US(latencia.max), falhas);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
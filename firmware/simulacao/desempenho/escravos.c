@@ -0,0 +1,44 @@
+/*
+ *		Pedidos perdidos num barramento com outros 14 escravos, com 3,5 a 0 caracteres entre os pacotes a
+ *		19200bps. As transações dos endereços 2 a 15 são aleatórias (sim_outro_escravo), com um pedido de
+ *		leitura para este escravo a cada quatro transações.
+ */
+
+#include "simulador.h"
+
+#define TRANSACOES 2000
+
+static void roteiro(void)
+{
+	static const double intervalos[] = {3.5, 2, 1.5, 1, 0.5, 0};
+	uint32_t semente = 1;
+	uint8_t pedido[260], resposta[260];
+	uint16_t n_pedido, n_resposta, v[3];
+	sim_timeout_ms = 20;
+	sim_espera_ms(50);
+
+	printf("%10s | %7s | %13s\n", "intervalo", "pedidos", "sem resposta");
+	for (unsigned i = 0; i < sizeof intervalos/sizeof intervalos[0]; i++) {
+		const uint64_t intervalo = (uint64_t)(intervalos[i]*sim_tempo_caractere());
+		unsigned perdidos = 0;
+		for (unsigned t = 0; t < TRANSACOES; t++) {
+			if (t%4 == 3) {
+				sim_espera_silencio(intervalo);
+				if (sim_le(1, 0, 3, v) != 0) perdidos++;
+				continue;
+			}
+			sim_outro_escravo(2 + t%14, &semente, pedido, &n_pedido, resposta, &n_resposta);
+			sim_espera_silencio(intervalo);
+			sim_envia(pedido, n_pedido);
+			sim_espera_silencio(intervalo);
+			sim_envia(resposta, n_resposta);
+		}
+		printf("%10.1f | %7u | %13u\n", intervalos[i], TRANSACOES/4, perdidos);
+		sim_espera_ms(10);
+	}
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,61 @@
+/*
+ *		Estatísticas de corrente publicadas pelo firmware (registradores 222 a 228), com ruído de +/-4 contagens
+ *		no ADC: as janelas de 1s (padrão) em torno do degrau de 0 a 500, as de 1000 amostras depois de um degrau
+ *		para 200, e os limites do tamanho da janela. Cada janela é lida uma vez, pela mudança da sequência.
+ *		Versões sem os registradores só mostram a exceção.
+ */
+
+#include "simulador.h"
+
+#define JANELA		222
+#define SEQUENCIA	223
+
+// Espera a próxima janela e imprime os registradores 223 a 228
+static int janela(const char *titulo)
+{
+	uint16_t v[6], sequencia;
+	const int r = sim_le(1, SEQUENCIA, 1, &sequencia);
+	if (r != 0) return r;
+	do {
+		sim_espera_ms(10);
+		sim_le(1, SEQUENCIA, 6, v);
+	} while (v[0] == sequencia);
+	printf("%-22s | %9u | %6u %6u | %7.1f %7.1f | %10.1f\n", titulo, v[0], v[1], v[2], v[3]/10.0, v[4]/10.0,
+		v[5]/10.0);
+	return 0;
+}
+
+static void roteiro(void)
+{
+	uint16_t v[1];
+	sim_ruido_lsb = 4;
+	sim_espera_ms(50);
+
+	printf("%-22s | %9s | %6s %6s | %7s %7s | %10s\n", "", "sequência", "mínimo", "máximo", "média", "RMS", "erro médio");
+	if (janela("setpoint 0, 1s") != 0) {
+		printf("registradores das estatísticas não existem nesta versão\n");
+		return;
+	}
+	sim_escreve(1, 2, 500);
+	janela("degrau para 500, 1s");
+	for (int i = 0; i < 3; i++) janela("setpoint 500, 1s");
+
+	sim_escreve(1, JANELA, 1000);
+	sim_escreve(1, 2, 200);
+	janela("degrau para 200");
+	for (int i = 0; i < 3; i++) janela("setpoint 200, 300ms");
+
+	sim_escreve(1, JANELA, 5);
+	sim_espera_ms(20);
+	sim_le(1, JANELA, 1, v);
+	printf("janela escrita como 5: %u\n", v[0]);
+	sim_escreve(1, JANELA, 10000);
+	sim_espera_ms(20);
+	sim_le(1, JANELA, 1, v);
+	printf("janela escrita como 10000: %u\n", v[0]);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,24 @@
+/*
+ *		Ciclos de cada interrupção em 2s de controle com degraus de setpoint e leituras de 3 registradores a
+ *		19200bps, com as divisões de 32 bits contadas pelo custo da libgcc do AVR.
+ */
+
+#include "simulador.h"
+
+static void roteiro(void)
+{
+	uint16_t v[3];
+	sim_espera_ms(50);
+	sim_perfil_zera();
+	for (int i = 0; i < 10; i++) {
+		sim_escreve(1, 2, (i & 1) ? 200 : 1000);
+		const uint64_t inicio = sim_ciclo;
+		while (sim_ciclo - inicio < SIM_MS(200)) sim_le(1, 0, 3, v);
+	}
+	sim_perfil_imprime(stdout);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,47 @@
+/*
+ *		Atraso do controle com o barramento ocupado: em cada taxa, 1s de transações seguidas alternando a
+ *		leitura de 32 registradores (função 3) e a escrita de 32 registradores da tabela do perfil (função 16).
+ *		O atraso é o tempo do fim da conversão do ADC até a entrada da interrupção do ADC, que chama o
+ *		controle(); sem interrupções em andamento ele é zero. As taxas que o firmware não aceita são indicadas.
+ */
+
+#include "simulador.h"
+
+static const uint32_t taxas[] = {19200, 115200, 250000};
+static const uint8_t indices[] = {1, 4, 5}; // registrador 4
+#define NUM_TAXAS (sizeof(taxas)/sizeof(taxas[0]))
+
+static void roteiro(void)
+{
+	uint16_t v[32] = {0};
+	sim_espera_ms(50);
+	printf("%8s | %10s | %14s %14s | %12s\n", "bps", "transações", "atraso máx", "atraso médio", "sem resposta");
+	for (unsigned i = 0; i < NUM_TAXAS; i++) {
+		const uint32_t anterior = sim_linha.taxa;
+		sim_escreve(1, 4, indices[i]);
+		sim_linha.taxa = taxas[i];
+		sim_espera_ms(5);
+		if (sim_le(1, 4, 1, v) != 0 || v[0] != indices[i]) {
+			sim_linha.taxa = anterior;
+			sim_espera_ms(5);
+			printf("%8lu | não aceita pelo firmware\n", (unsigned long)taxas[i]);
+			continue;
+		}
+		sim_perfil_zera();
+		unsigned transacoes = 0, falhas = 0;
+		const uint64_t inicio = sim_ciclo;
+		while (sim_ciclo - inicio < SIM_MS(1000)) {
+			const int r = (transacoes & 1) ? sim_escreve_varios(1, 183, 32, v) : sim_le(1, 0, 32, v);
+			transacoes++;
+			if (r != 0) falhas++;
+		}
+		const struct SimEstatistica *atraso = &sim_controle.latencia;
+		printf("%8lu | %10u | %10.2f us %10.2f us | %12u\n", (unsigned long)taxas[i], transacoes,
+			SIM_CICLOS_US(atraso->max), SIM_CICLOS_US(sim_estatistica_media(atraso)), falhas);
+	}
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
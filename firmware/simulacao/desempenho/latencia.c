@@ -0,0 +1,29 @@
+/*
+ *		Latência do fim do pedido ao início da resposta em leituras de 3 registradores a 19200bps, com o
+ *		atraso adicional do registrador 3 em 0.
+ */
+
+#include "simulador.h"
+
+#define LEITURAS 100
+
+static void roteiro(void)
+{
+	uint16_t v[3];
+	struct SimEstatistica latencia = {0};
+	unsigned falhas = 0;
+	sim_espera_ms(50);
+	for (int i = 0; i < LEITURAS; i++) {
+		if (sim_le(1, 0, 3, v) == 0) sim_estatistica_soma(&latencia, SIM_US(sim_latencia_us));
+		else falhas++;
+		sim_espera_us(137*i % 1000); // varia a fase do pedido em relação aos timers
+	}
+	printf("intervalo entre pacotes (3,5 caracteres): %.1fus\n", SIM_CICLOS_US(sim_tempo_caractere()*7/2));
+	printf("fim do pedido ao início da resposta: média %.1fus, mínimo %.1fus, máximo %.1fus, %u leituras sem resposta\n",
+		SIM_CICLOS_US(sim_estatistica_media(&latencia)), SIM_CICLOS_US(latencia.min), SIM_CICLOS_US(latencia.max), falhas);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,64 @@
+/*
+ *		Sequência de mudanças (registrador 229) com ruído de +/-4 contagens no ADC: para cada banda morta
+ *		(registrador 232), quantas vezes a sequência andou em 2s com o setpoint parado em 0 e em 500, e com a
+ *		entrada analógica subindo devagar de 8mA a 9mA no mesmo tempo. As mudanças pendentes (registrador 230)
+ *		de cada medição são mostradas em hexadecimal e confirmadas no 231 antes da próxima.
+ *		Versões sem os registradores só mostram a exceção.
+ */
+
+#include "simulador.h"
+
+#define SEQUENCIA	229
+#define CONFIRMA	231
+#define BANDA		232
+
+static const uint16_t bandas[] = {0, 1, 2, 4, 8};
+#define NUM_BANDAS (sizeof(bandas)/sizeof(bandas[0]))
+
+// Mudanças em 2s, com a entrada analógica indo de entrada_ma a entrada_ma + rampa_ma
+static void mede(double entrada_ma, double rampa_ma)
+{
+	uint16_t antes[2], depois[2];
+	sim_entrada_ma = entrada_ma;
+	sim_espera_ms(300);
+	sim_le(1, SEQUENCIA, 2, antes);
+	sim_escreve(1, CONFIRMA, antes[1]);
+	sim_le(1, SEQUENCIA, 1, antes);
+	for (unsigned ms = 0; ms < 2000; ms += 10) {
+		sim_entrada_ma = entrada_ma + rampa_ma*ms/2000;
+		sim_espera_ms(10);
+	}
+	sim_le(1, SEQUENCIA, 2, depois);
+	printf(" %10.1f  0x%02X", (uint16_t)(depois[0] - antes[0])/2.0, depois[1]);
+}
+
+static void roteiro(void)
+{
+	uint16_t v[1];
+	sim_ruido_lsb = 4;
+	sim_espera_ms(50);
+
+	printf("%6s | %17s | %17s | %17s\n", "", "setpoint 0", "setpoint 500", "entrada 8 a 9mA");
+	printf("%6s | %17s | %17s | %17s\n", "banda", "mudanças/s  230", "mudanças/s  230", "mudanças/s  230");
+	if (sim_le(1, SEQUENCIA, 1, v) != 0) {
+		printf("registradores das mudanças não existem nesta versão\n");
+		return;
+	}
+	for (unsigned i = 0; i < NUM_BANDAS; i++) {
+		sim_escreve(1, BANDA, bandas[i]);
+		printf("%6u |", bandas[i]);
+		sim_escreve(1, 2, 0);
+		mede(12, 0);
+		printf(" |");
+		sim_escreve(1, 2, 500);
+		mede(12, 0);
+		printf(" |");
+		mede(8, 1);
+		printf("\n");
+	}
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,78 @@
+/*
+ *		Perfil das interrupções e do ModBusProcess: ciclos mínimos, médios e máximos, latência de cada vetor,
+ *		período do laço de controle e aninhamento, em três cenários de 2s:
+ *		- controle sozinho, com degraus de setpoint, ruído no ADC e a entrada 4-20mA em rampa;
+ *		- o mesmo com uma mistura de pedidos (funções 3, 6, 16 e 23 e difusão) a 19200bps;
+ *		- a mesma mistura a 250000bps, a maior taxa aceita.
+ *
+ *		A pilha do AVR não é simulada: a folga mínima da pilha é medida no controlador (registrador 7).
+ */
+
+#include "simulador.h"
+
+#define CENARIO_MS 2000
+
+// Degraus de setpoint a cada 100ms e a entrada 4-20mA em rampa, sem pedidos no barramento
+static void controle(void)
+{
+	const uint64_t inicio = sim_ciclo;
+	for (int i = 0; sim_ciclo - inicio < SIM_MS(CENARIO_MS); i++) {
+		sim_entrada_ma = 4.0 + (i % 17);
+		if (i % 10 == 0) sim_escreve(1, 2, (i/10 & 1) ? 200 : 1000);
+		else sim_espera_ms(10);
+	}
+}
+
+// Mistura de pedidos um depois do outro, com um degrau de setpoint a cada 10 pedidos
+static unsigned trafego(void)
+{
+	uint16_t v[48];
+	uint8_t resposta[64];
+	const uint8_t funcao23[] = {1, 23, 0, 0, 0, 3, 0, 2, 0, 1, 2, 0x01, 0x2C};
+	unsigned falhas = 0;
+	const uint64_t inicio = sim_ciclo;
+	for (int i = 0; sim_ciclo - inicio < SIM_MS(CENARIO_MS); i++) {
+		sim_entrada_ma = 4.0 + (i % 17);
+		switch (i % 10) {
+			case 0: falhas += sim_escreve(1, 2, (i/10 & 1) ? 200 : 1000) != 0; break;
+			case 1: falhas += sim_le(1, 0, 26, v) != 0; break; // medidas e tempos
+			case 2: falhas += sim_le(1, 32, 48, v) != 0; break; // um terço do buffer do scope
+			case 3: falhas += sim_escreve_varios(1, 183, 32, v) != 0; break; // tabela do perfil, sem iniciar
+			case 4: falhas += sim_transacao(funcao23, sizeof funcao23, resposta, 11, sim_timeout_ms) != 11; break;
+			case 5: sim_escreve(0, 2, 600); break; // difusão
+			case 6: falhas += sim_le(1, 223, 17, v) != 0; break; // estatísticas, mudanças e diagnóstico
+			default: falhas += sim_le(1, 0, 3, v) != 0; break;
+		}
+	}
+	return falhas;
+}
+
+static void roteiro(void)
+{
+	sim_ruido_lsb = 2;
+	sim_espera_ms(50);
+
+	sim_perfil_zera();
+	controle();
+	printf("== controle sem pedidos\n");
+	sim_perfil_imprime(stdout);
+
+	sim_perfil_zera();
+	unsigned falhas = trafego();
+	printf("\n== pedidos a 19200bps, %u falhas\n", falhas);
+	sim_perfil_imprime(stdout);
+
+	sim_escreve(1, 4, 5);
+	sim_linha.taxa = 250000;
+	sim_espera_ms(5);
+	sim_perfil_zera();
+	falhas = trafego();
+	printf("\n== pedidos a 250000bps, %u falhas\n", falhas);
+	sim_perfil_imprime(stdout);
+	printf("\npilha: não simulada, a folga mínima é medida no controlador (registrador 7)\n");
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
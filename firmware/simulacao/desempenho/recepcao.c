@@ -0,0 +1,59 @@
+/*
+ *		Custo da interrupção de recepção da serial (USART_RXC) por tipo de tráfego a 19200bps, em ciclos
+ *		exclusivos (sem as interrupções aninhadas): leituras de 3 registradores e escritas de 32 registradores
+ *		para este escravo, pacotes com o CRC errado para este escravo e transações aleatórias de outros
+ *		escravos (sim_outro_escravo). Cada linha tem 500 pacotes; as respostas deste escravo não passam pela
+ *		recepção.
+ */
+
+#include "simulador.h"
+
+#define PACOTES 500
+
+static void imprime(const char *titulo)
+{
+	const struct SimEstatistica *e = &sim_perfil[SIM_USART_RXC].exclusivos;
+	printf("%-27s | %6u | %5llu %7.1f %5llu | %9llu\n", titulo, e->n, (unsigned long long)e->min,
+		sim_estatistica_media(e), (unsigned long long)e->max, (unsigned long long)e->soma);
+	sim_perfil_zera();
+}
+
+static void roteiro(void)
+{
+	uint16_t v[32] = {0};
+	uint8_t pedido[260], resposta[260];
+	uint16_t n_pedido, n_resposta;
+	uint32_t semente = 1;
+	sim_espera_ms(50);
+	printf("%-27s | %6s | %5s %7s %5s | %9s\n", "", "bytes", "min", "média", "max", "total");
+
+	sim_perfil_zera();
+	for (unsigned i = 0; i < PACOTES; i++) sim_le(1, 0, 3, v);
+	imprime("leitura de 3 registradores");
+
+	for (unsigned i = 0; i < PACOTES; i++) sim_escreve_varios(1, 183, 32, v);
+	imprime("escrita de 32 registradores");
+
+	for (unsigned i = 0; i < PACOTES; i++) {
+		pedido[0] = 1; pedido[1] = 3; pedido[2] = 0; pedido[3] = 0; pedido[4] = 0; pedido[5] = 3;
+		n_pedido = sim_pacote(pedido, 6);
+		pedido[n_pedido - 1] ^= 0x55;
+		sim_envia(pedido, n_pedido);
+		sim_espera_silencio(4*sim_tempo_caractere());
+	}
+	imprime("CRC errado");
+
+	for (unsigned i = 0; i < PACOTES/2; i++) {
+		sim_outro_escravo(2 + i%14, &semente, pedido, &n_pedido, resposta, &n_resposta);
+		sim_envia(pedido, n_pedido);
+		sim_espera_silencio(4*sim_tempo_caractere());
+		sim_envia(resposta, n_resposta);
+		sim_espera_silencio(4*sim_tempo_caractere());
+	}
+	imprime("outros escravos");
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
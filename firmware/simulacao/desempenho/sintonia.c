@@ -0,0 +1,90 @@
+/*
+ *		Resposta ao degrau do PI com os ganhos padrão e com os da auto-sintonia (registrador 218): o setpoint
+ *		vai de 0 a 200, 500 e 900, e a corrente na bobina é amostrada a cada 10us por 300ms a partir da
+ *		mudança do setpoint no firmware. São mostrados o sobressinal, o tempo de subida (10% a 90%) e o de
+ *		acomodação na faixa de 2% do setpoint. A auto-sintonia é feita com o setpoint em 500, sem ruído e com
+ *		3 contagens de ruído no ADC. Versões sem os registradores 215 a 218 só têm os ganhos padrão.
+ */
+
+#include "simulador.h"
+
+extern volatile uint16_t setpoint;
+
+static const uint16_t degraus[] = {200, 500, 900};
+#define NUM_DEGRAUS (sizeof(degraus)/sizeof(degraus[0]))
+
+// Degrau de 0 ao setpoint, a partir da corrente zerada
+static void degrau(uint16_t alvo)
+{
+	sim_escreve(1, 2, 0);
+	sim_espera_ms(300);
+	// o pedido é enviado sem esperar a resposta, que chega depois da mudança do setpoint no firmware
+	uint8_t pedido[8] = {1, 6, 0, 2, alvo >> 8, alvo & 0xFF};
+	sim_envia(pedido, sim_pacote(pedido, 6));
+	while (setpoint != alvo) sim_espera_us(1);
+	const uint64_t inicio = sim_ciclo;
+	const double faixa = alvo*0.02;
+	double pico = 0, t10 = -1, t90 = -1, acomodacao = 0;
+	while (sim_ciclo - inicio < SIM_MS(300)) {
+		sim_espera_us(10);
+		const double t = SIM_CICLOS_US(sim_ciclo - inicio)/1000, i = sim_corrente();
+		if (i > pico) pico = i;
+		if (t10 < 0 && i >= alvo*0.1) t10 = t;
+		if (t90 < 0 && i >= alvo*0.9) t90 = t;
+		if (i < alvo - faixa || i > alvo + faixa) acomodacao = t;
+	}
+	printf(" %6u | %10.1f%% %8.2fms %8.2fms |\n", alvo, 100*(pico - alvo)/alvo, t90 - t10, acomodacao);
+}
+
+static void degraus_imprime(const char *ganhos, const uint16_t *v)
+{
+	printf("%-28s (kp %u, ki %u)\n", ganhos, v[0], v[1]);
+	for (unsigned i = 0; i < NUM_DEGRAUS; i++) {
+		degrau(degraus[i]);
+	}
+}
+
+// Auto-sintonia com o setpoint em 500 e a corrente estabilizada, retorna o estado final (registrador 218)
+static uint16_t sintoniza(uint16_t *v)
+{
+	sim_escreve(1, 2, 500);
+	sim_espera_ms(300);
+	if (sim_escreve(1, 218, 1) != 0) return 0;
+	uint16_t estado = 1;
+	for (uint64_t inicio = sim_ciclo; estado == 1 && sim_ciclo - inicio < SIM_MS(3000); ) {
+		sim_espera_ms(20);
+		sim_le(1, 218, 1, &estado);
+	}
+	sim_le(1, 215, 6, v); // ganhos, estado, período e amplitude da oscilação
+	printf("\nauto-sintonia com %.0f contagens de ruído: estado %u, período %u períodos de controle, %u pico a pico\n",
+		sim_ruido_lsb, estado, v[4], v[5]);
+	return estado;
+}
+
+static void roteiro(void)
+{
+	uint16_t padrao[6], v[6];
+	sim_espera_ms(50);
+	printf("  degrau | sobressinal    subida acomodação |\n");
+	const int com_ganhos = sim_le(1, 215, 3, padrao) == 0;
+	if (!com_ganhos) { // sem os registradores dos ganhos
+		printf("ganhos padrão\n");
+		for (unsigned i = 0; i < NUM_DEGRAUS; i++) {
+			degrau(degraus[i]);
+		}
+		return;
+	}
+	degraus_imprime("ganhos padrão", padrao);
+
+	for (double ruido = 0; ruido <= 3; ruido += 3) {
+		sim_escreve_varios(1, 215, 3, padrao);
+		sim_ruido_lsb = ruido;
+		if (sintoniza(v) != 2) continue;
+		degraus_imprime("ganhos da auto-sintonia", v);
+	}
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
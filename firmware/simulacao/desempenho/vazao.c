@@ -0,0 +1,56 @@
+/*
+ *		Leituras de 3 registradores por segundo em cada taxa de transmissão, com o mestre enviando o pedido
+ *		seguinte logo depois de cada resposta. A taxa é trocada pelo registrador 4, e as taxas que o
+ *		firmware não aceita são indicadas.
+ */
+
+#include "simulador.h"
+
+static const uint32_t taxas[] = {9600, 19200, 38400, 57600, 115200, 250000, 500000, 1000000};
+#define NUM_TAXAS (sizeof(taxas)/sizeof(taxas[0]))
+#define DIAGNOSTICO 233 // contadores da função 8, o 238 conta as sobrecargas da recepção
+
+static void roteiro(void)
+{
+	uint16_t v[7];
+	sim_espera_ms(50);
+	printf("%8s | %10s | %6s | %13s | %10s\n", "bps", "leituras/s", "falhas", "resposta (us)", "sobrecargas");
+	for (uint8_t i = 0; i < NUM_TAXAS; i++) {
+		const uint32_t anterior = sim_linha.taxa;
+		sim_escreve(1, 4, i);
+		sim_linha.taxa = taxas[i];
+		sim_espera_ms(5);
+		if (sim_le(1, 4, 1, v) != 0 || v[0] != i) {
+			sim_linha.taxa = anterior;
+			sim_espera_ms(5);
+			printf("%8lu | não aceita pelo firmware\n", (unsigned long)taxas[i]);
+			continue;
+		}
+		sim_le(1, DIAGNOSTICO, 7, v);
+		const uint16_t sobrecargas = v[5];
+		struct SimEstatistica resposta = {0};
+		unsigned leituras = 0, falhas = 0;
+		const uint64_t inicio = sim_ciclo;
+		while (sim_ciclo - inicio < SIM_MS(2000)) {
+			if (sim_le(1, 0, 3, v) == 0) {
+				leituras++;
+				sim_estatistica_soma(&resposta, SIM_US(sim_resposta_us));
+			} else {
+				falhas++;
+			}
+		}
+		const double segundos = SIM_CICLOS_US(sim_ciclo - inicio)*1e-6;
+		int r = sim_le(1, DIAGNOSTICO, 7, v);
+		printf("%8lu | %10.1f | %6u | %13.1f | %10d\n", (unsigned long)taxas[i], leituras/segundos, falhas,
+			SIM_CICLOS_US(sim_estatistica_media(&resposta)), r == 0 ? (int)(uint16_t)(v[5] - sobrecargas) : -1);
+		if (r != 0) { // o escravo não responde mais
+			printf("%8s | escravo sem comunicação, medição interrompida\n", "");
+			return;
+		}
+	}
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,48 @@
+/*
+ *		Velocidade da simulação em relação ao tempo real, com o controle em degraus de setpoint e leituras
+ *		contínuas dos registradores 0 a 6.
+ */
+
+#include <time.h>
+
+#include "simulador.h"
+
+static double agora(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+static void roteiro(void)
+{
+	uint16_t v[7];
+	sim_espera_ms(50);
+
+	// controle sozinho, o processador dorme entre as interrupções
+	double inicio = agora();
+	uint64_t ciclo = sim_ciclo;
+	for (int i = 0; i < 10; i++) {
+		sim_escreve(1, 2, (i & 1) ? 200 : 1000);
+		sim_espera_ms(1000);
+	}
+	double segundos = SIM_CICLOS_US(sim_ciclo - ciclo)*1e-6;
+	printf("degraus de setpoint a cada 1s: %.0fs simulados em %.3fs, %.0f vezes o tempo real\n",
+		segundos, agora() - inicio, segundos/(agora() - inicio));
+
+	// leituras uma depois da outra
+	inicio = agora();
+	ciclo = sim_ciclo;
+	unsigned leituras = 0;
+	while (sim_ciclo - ciclo < SIM_MS(10000)) {
+		if (sim_le(1, 0, 7, v) == 0) leituras++;
+	}
+	segundos = SIM_CICLOS_US(sim_ciclo - ciclo)*1e-6;
+	printf("leituras contínuas a 19200bps: %.0fs simulados (%u leituras) em %.3fs, %.0f vezes o tempo real\n",
+		segundos, leituras, agora() - inicio, segundos/(agora() - inicio));
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,14 @@
+/*
+ *		firmware.c
+ *
+ *		O firmware sem alterações, com main renomeada para firmware_main. Os cabeçalhos do sistema são
+ *		incluídos antes para que o #define não alcance as declarações deles.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define main firmware_main
+#include "main.c"
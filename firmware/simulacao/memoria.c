@@ -0,0 +1,18 @@
+/*
+ *		memoria.c
+ *
+ *		O firmware compilado só para medir a memória estática com o memoria.sh, sem o avr-gcc. Com o int
+ *		de 16 bits, as estruturas empacotadas (-fpack-struct) e os enums de 8 bits (-fshort-enums), cada
+ *		variável tem o tamanho que teria no AVR. Os cabeçalhos do sistema são incluídos antes, fora do
+ *		alcance do #define int.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define int short
+#define main firmware_main
+#include "main.c"
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Memória estática do firmware de cada revisão do git indicada, sem o avr-gcc:
+#
+#   ./memoria.sh <revisão>...
+#
+# Compila o memoria.c com as fontes de cada revisão e soma as variáveis das seções .data e .bss, que
+# ocupam a SRAM do AVR. O que sobra dos 1024 bytes do ATmega8 fica para a pilha. As variáveis EEMEM
+# ficam na EEPROM e as tabelas PROGMEM (.rodata no host) na flash, e são listadas sem entrar na soma.
+# Com as fontes da primeira versão, a soma confere com o Debug/ControleCargaMotor.map do avr-gcc
+# (.data 2 bytes, .bss 541 bytes). A revisão "atual" usa as fontes do diretório de trabalho.
+
+set -e
+cd "$(dirname "$0")"
+raiz=$(git rev-parse --show-toplevel)
+for revisao in "$@"; do
+	dir=compilacao/$(echo "$revisao" | tr '/^~:' '____')
+	if [ "$revisao" = atual ]; then
+		fontes=../ControleCargaMotor
+		titulo="diretório de trabalho"
+	else
+		fontes=$dir/fontes
+		rm -rf "$fontes"
+		mkdir -p "$fontes"
+		git -C "$raiz" archive "$revisao" firmware/ControleCargaMotor | tar -x -C "$fontes" --strip-components=2
+		[ -e "$fontes/ModBusSlave.h" ] || ln -s ModbusSlave.h "$fontes/ModBusSlave.h"
+		titulo=$(git log -1 --format=%s "$revisao")
+	fi
+	mkdir -p "$dir"
+	${CC:-gcc} -std=gnu99 -Os -I. -I"$fontes" -funsigned-char -fshort-enums -fpack-struct -w -c -o "$dir/memoria.o" memoria.c
+	echo "== $revisao ($titulo)"
+	nm -f sysv -t d "$dir/memoria.o" | awk -F'|' '
+		$4 ~ /OBJECT/ {
+			nome = $1; sub(/ +$/, "", nome); secao = $7; tamanho = $5 + 0
+			if (secao == ".data" || secao == ".bss") { sram[secao] += tamanho; printf "  %-6s %5d %s\n", secao, tamanho, nome }
+			else if (secao == "sim_eeprom") eeprom += tamanho
+			else if (secao ~ /^\.rodata/) flash += tamanho
+		}
+		END {
+			total = sram[".data"] + sram[".bss"]
+			printf "SRAM: .data %d + .bss %d = %d bytes, %d livres para a pilha\n", sram[".data"], sram[".bss"], total, 1024 - total
+			printf "fora da SRAM: EEPROM %d bytes, tabelas na flash %d bytes\n", eeprom, flash
+		}'
+done
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Mede o mestre Linux (../../mestre) com 1 a 15 controladores no segmento simulado (compilacao/segmento):
+#
+#   ./mestre.sh [taxa]...
+#
+# Para cada taxa (padrão 19200 e 115200), número de controladores e modo (leitura dos registradores 0 a 6 a
+# cada ciclo, ou -m), o mestre roda SEGUNDOS segundos, e a tabela tem a média dos resumos por segundo sem o
+# primeiro: ciclos e transações por segundo, latência média e a máxima das máximas, e o total de falhas.
+# Os controladores são simulados em tempo real, um processo cada, e disputam a CPU com o mestre: os atrasos
+# do sistema aparecem na latência máxima, e os maiores que o timeout do mestre como falhas.
+
+set -e
+cd "$(dirname "$0")"
+SEGUNDOS=${SEGUNDOS:-5}
+[ $# -gt 0 ] || set -- 19200 115200
+make -s compilacao/segmento >&2
+g++ -std=c++17 -O2 -Wall -o compilacao/mestre ../../mestre/mestre.cpp
+link=compilacao/segmento.pty
+for taxa in "$@"; do
+	echo "== $taxa bps"
+	echo ' nós modo     | ciclos/s transações/s |  lat. ms   máx ms |  falhas'
+	for n in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15; do
+		for modo in "" -m; do
+			compilacao/segmento -b "$taxa" -n "$n" -l "$link" > /dev/null &
+			segmento=$!
+			sleep 1
+			timeout -s INT "$SEGUNDOS" compilacao/mestre -p "$link" -b "$taxa" -n "1-$n" $modo 2>&1 |
+				awk -v n="$n" -v modo="${modo:-0-6}" '
+					/ciclos\/s/ && ++linha > 1 {
+						k = split($0, campos, ", ")
+						ciclos += campos[1] + 0
+						transacoes += campos[2] + 0
+						split(campos[3], l, " ")
+						latencia += l[3] + 0
+						if (l[5] + 0 > maxima) maxima = l[5] + 0
+						for (i = 4; i <= k && campos[i] !~ /^sem comunicação/; i++) {
+							m = split(campos[i], f, " ")
+							falhas += f[m]
+						}
+						resumos++
+					}
+					END {
+						if (!resumos) { printf "%4d %-8s | sem resumos\n", n, modo; exit }
+						printf "%4d %-8s | %8.0f %12.0f | %8.2f %8.2f | %7d\n", n, modo, ciclos/resumos,
+							transacoes/resumos, latencia/resumos, maxima, falhas
+					}'
+			kill "$segmento"
+			wait "$segmento" 2> /dev/null || true
+		done
+	done
+done
+rm -f "$link"
@@ -0,0 +1,184 @@
+/*
+ *		Segmento RS-485 simulado num pseudo-terminal, para testar mestres Modbus sem os controladores:
+ *
+ *			compilacao/segmento [-b taxa] [-n controladores] [-l link]
+ *
+ *		Cada controlador, com os endereços 1 a n nas dip switches, é um processo com o firmware simulado em
+ *		tempo real (sim_tempo_real) e a sua própria bobina. Este processo repassa os bytes que chegam do mestre
+ *		pelo pseudo-terminal a todos os controladores, e os que um controlador transmite ao mestre e aos demais,
+ *		como no barramento. Os demais recebem cada pacote inteiro, por uma conexão separada, quando o crc fecha,
+ *		e a simulação o entrega em sequência rápida (sim_tempo_real): assim um controlador atrasado pelo sistema
+ *		no meio da transmissão não abre um silêncio no pacote que os outros veem. O nome do pseudo-terminal é
+ *		escrito na saída padrão, e com -l também fica num link simbólico. A taxa (padrão 19200) é gravada na EEPROM de cada controlador antes do reset; o
+ *		pseudo-terminal não tem taxa, o tempo dos caracteres é o da simulação.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "simulador.h"
+
+#define MAX_CONTROLADORES 15
+#define SILENCIO_MS 50 // sem o crc fechar, os bytes de um controlador vão para os demais depois desse silêncio
+
+extern uint8_t eeprom_baud_rate;
+
+static const uint32_t taxas[] = {9600, 19200, 38400, 57600, 115200, 250000}; // ModBusTaxas do firmware
+#define NUM_TAXAS (sizeof(taxas)/sizeof(taxas[0]))
+
+static uint8_t indice_taxa;
+static int conexao, outros; // do controlador com este processo: mestre e transmissão, e outros escravos
+
+static void controlador(void)
+{
+	sim_eeprom_escreve(&eeprom_baud_rate, &indice_taxa, 1);
+	sim_linha.taxa = taxas[indice_taxa];
+	sim_tempo_real(conexao, conexao, outros);
+	for (;;) sim_espera_ms(1000);
+}
+
+// Bytes transmitidos por um controlador desde o último pacote repassado aos demais
+static struct Pacote
+{
+	uint8_t dados[256];
+	uint16_t n;
+} pacotes[1 + MAX_CONTROLADORES];
+
+static void escreve(int fd, const uint8_t *dados, size_t n)
+{
+	for (size_t enviados = 0; enviados < n; ) {
+		const ssize_t r = write(fd, dados + enviados, n - enviados);
+		if (r < 0 && errno != EINTR && errno != EAGAIN) exit(0); // um controlador terminou
+		if (r > 0) enviados += (size_t)r;
+	}
+}
+
+static void repassa_pacote(int origem, const int *saidas_outros, int controladores)
+{
+	for (int c = 1; c <= controladores; c++) {
+		if (c != origem) escreve(saidas_outros[c], pacotes[origem].dados, pacotes[origem].n);
+	}
+	pacotes[origem].n = 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t taxa = 19200;
+	int controladores = 1, opcao;
+	const char *link = NULL;
+	while ((opcao = getopt(argc, argv, "b:n:l:")) != -1) {
+		switch (opcao) {
+			case 'b': taxa = (uint32_t)strtoul(optarg, NULL, 10); break;
+			case 'n': controladores = atoi(optarg); break;
+			case 'l': link = optarg; break;
+			default:
+				fprintf(stderr, "uso: %s [-b taxa] [-n controladores] [-l link]\n", argv[0]);
+				return 2;
+		}
+	}
+	while (indice_taxa < NUM_TAXAS && taxas[indice_taxa] != taxa) indice_taxa++;
+	if (indice_taxa == NUM_TAXAS || controladores < 1 || controladores > MAX_CONTROLADORES) {
+		fprintf(stderr, "taxa ou número de controladores inválido\n");
+		return 2;
+	}
+
+	// o lado do mestre fica em modo bruto e aberto aqui, para não ecoar as respostas nem fechar entre mestres
+	const int pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if (pty < 0 || grantpt(pty) < 0 || unlockpt(pty) < 0) {
+		perror("pseudo-terminal");
+		return 1;
+	}
+	const char *nome = ptsname(pty);
+	const int lado_mestre = open(nome, O_RDWR | O_NOCTTY);
+	struct termios tio;
+	if (lado_mestre < 0 || tcgetattr(lado_mestre, &tio) < 0) {
+		perror(nome);
+		return 1;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(lado_mestre, TCSANOW, &tio);
+	if (link) {
+		unlink(link);
+		if (symlink(nome, link) < 0) {
+			perror(link);
+			return 1;
+		}
+	}
+
+	// conexoes[0] é o mestre, as demais as dos controladores, que recebem os bytes dos outros em outros[c]
+	int conexoes[1 + MAX_CONTROLADORES], saidas_outros[1 + MAX_CONTROLADORES];
+	struct pollfd p[1 + MAX_CONTROLADORES];
+	conexoes[0] = pty;
+	for (int c = 1; c <= controladores; c++) {
+		int par[2], par_outros[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, par) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, par_outros) < 0) {
+			perror("socketpair");
+			return 1;
+		}
+		if (fork() == 0) {
+			for (int i = 1; i < c; i++) {
+				close(conexoes[i]);
+				close(saidas_outros[i]);
+			}
+			close(par[0]);
+			close(par_outros[0]);
+			close(pty);
+			close(lado_mestre);
+			conexao = par[1];
+			outros = par_outros[1];
+			sim_dip = (uint8_t)c;
+			return sim_executa(controlador);
+		}
+		close(par[1]);
+		close(par_outros[1]);
+		conexoes[c] = par[0];
+		saidas_outros[c] = par_outros[0];
+	}
+	signal(SIGPIPE, SIG_IGN);
+	printf("%s\n", nome);
+	fflush(stdout);
+
+	for (int i = 0; i <= controladores; i++) p[i] = (struct pollfd){conexoes[i], POLLIN, 0};
+	for (;;) {
+		int espera = -1;
+		for (int i = 1; i <= controladores; i++) {
+			if (pacotes[i].n) espera = SILENCIO_MS;
+		}
+		const int r = poll(p, (nfds_t)(controladores + 1), espera);
+		if (r < 0 && errno != EINTR) return 1;
+		for (int i = 0; i <= controladores && r > 0; i++) {
+			if (!(p[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+			uint8_t dados[256];
+			const ssize_t n = read(conexoes[i], dados, sizeof dados);
+			if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+			if (n <= 0) return i == 0 ? 0 : 1;
+			for (int c = 0; c <= controladores; c++) {
+				if (c == i) continue;
+				if (i == 0) escreve(conexoes[c], dados, (size_t)n); // pedido do mestre
+				else if (c == 0) escreve(pty, dados, (size_t)n); // transmissão de um controlador
+			}
+			if (i == 0) continue;
+			for (ssize_t k = 0; k < n; k++) {
+				struct Pacote *pacote = &pacotes[i];
+				pacote->dados[pacote->n++] = dados[k];
+				if ((pacote->n >= 4 && sim_crc16(pacote->dados, pacote->n) == 0) || pacote->n == sizeof pacote->dados) {
+					repassa_pacote(i, saidas_outros, controladores);
+				}
+			}
+		}
+		if (r == 0) { // silêncio: repassa os bytes que não fecharam um pacote
+			for (int i = 1; i <= controladores; i++) {
+				if (pacotes[i].n) repassa_pacote(i, saidas_outros, controladores);
+			}
+		}
+	}
+}
@@ -0,0 +1,1144 @@
+/*
+ *		simulador.c
+ *
+ *		Núcleo da simulação: registradores, eventos dos periféricos, atendimento das interrupções, planta,
+ *		EEPROM e corrotina do roteiro. Compilado sem -fsanitize-coverage, só o firmware conta ciclos.
+ */
+
+#define _GNU_SOURCE
+#define SIM_NUCLEO
+#include <math.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "avr/io.h"
+#include "avr/eeprom.h"
+#include "simulador.h"
+
+#define NUNCA UINT64_MAX
+
+volatile struct sim_io sim_io;
+static struct sim_io sombra; // valores vistos na última sincronização
+uint64_t sim_ciclo;
+static uint64_t proximo = NUNCA; // próximo evento
+static uint8_t pendente; // alguma interrupção com flag e habilitação ligadas
+
+struct SimBobina sim_bobina = {110.0, 4.5, 0.09, 0.7, 0.0};
+double sim_entrada_ma = 12.0;
+double sim_ruido_lsb = 0.0;
+uint8_t sim_dip = 1;
+uint32_t sim_eeprom_gravacoes;
+struct SimLinha sim_linha = {19200, 11};
+struct SimRecebido sim_recebidos[SIM_MAX_RECEBIDOS];
+uint16_t sim_num_recebidos;
+uint32_t sim_bytes_sem_driver;
+struct SimPerfil sim_perfil[SIM_NUM_VETORES];
+struct SimControle sim_controle;
+struct SimEstatistica sim_processamento;
+uint8_t sim_aninhamento_max;
+unsigned sim_falhas;
+
+const char *const sim_nome_vetor[SIM_NUM_VETORES] =
+{
+	"TIMER2_COMP", "TIMER1_COMPB", "TIMER1_OVF", "TIMER0_OVF", "USART_RXC", "USART_UDRE", "USART_TXC", "ADC"
+};
+
+// Rotinas de interrupção do firmware, vazias se ele não usar o vetor
+#define VETOR_FRACO(nome) void nome(void) __attribute__((weak)); void nome(void) {}
+VETOR_FRACO(sim_isr_timer2_comp)
+VETOR_FRACO(sim_isr_timer1_compb)
+VETOR_FRACO(sim_isr_timer1_ovf)
+VETOR_FRACO(sim_isr_timer0_ovf)
+VETOR_FRACO(sim_isr_usart_rxc)
+VETOR_FRACO(sim_isr_usart_udre)
+VETOR_FRACO(sim_isr_usart_txc)
+VETOR_FRACO(sim_isr_adc)
+
+static void (*const rotina[SIM_NUM_VETORES])(void) =
+{
+	sim_isr_timer2_comp, sim_isr_timer1_compb, sim_isr_timer1_ovf, sim_isr_timer0_ovf,
+	sim_isr_usart_rxc, sim_isr_usart_udre, sim_isr_usart_txc, sim_isr_adc
+};
+
+int firmware_main(void);
+void ModBusProcess();
+
+//-------------------------------------------------------------------------------------------------------
+// Eventos
+
+enum Evento {EV_T2, EV_T1B, EV_T1OVF, EV_T0, EV_ADC_AMOSTRA, EV_ADC_FIM, EV_RX, EV_TX, EV_ROTEIRO, EV_NUM};
+static uint64_t evento[EV_NUM];
+
+static void recalcula_proximo(void)
+{
+	proximo = NUNCA;
+	for (int e = 0; e < EV_NUM; e++) {
+		if (evento[e] < proximo) proximo = evento[e];
+	}
+}
+
+#define SETA(reg, bits) (sim_io.reg |= (bits), sombra.reg |= (bits))
+#define LIMPA(reg, bits) (sim_io.reg &= ~(bits), sombra.reg &= ~(bits))
+
+static uint64_t flag_desde[SIM_NUM_VETORES]; // ciclo em que a flag foi ligada
+static uint8_t flag_txc; // fora do UCSRA, que mostra o bit TXC sempre em 0
+static uint64_t habilitada_desde[SIM_NUM_VETORES]; // ciclo em que a fonte foi habilitada
+
+static int flag(int v)
+{
+	switch (v) {
+		case SIM_TIMER2_COMP: return sombra.TIFR & (1<<OCF2);
+		case SIM_TIMER1_COMPB: return sombra.TIFR & (1<<OCF1B);
+		case SIM_TIMER1_OVF: return sombra.TIFR & (1<<TOV1);
+		case SIM_TIMER0_OVF: return sombra.TIFR & (1<<TOV0);
+		case SIM_USART_RXC: return sombra.UCSRA & (1<<RXC);
+		case SIM_USART_UDRE: return sombra.UCSRA & (1<<UDRE);
+		case SIM_USART_TXC: return flag_txc;
+		default: return sombra.ADCSRA & (1<<ADIF);
+	}
+}
+
+static int habilitada(const struct sim_io *io, int v)
+{
+	switch (v) {
+		case SIM_TIMER2_COMP: return io->TIMSK & (1<<OCIE2);
+		case SIM_TIMER1_COMPB: return io->TIMSK & (1<<OCIE1B);
+		case SIM_TIMER1_OVF: return io->TIMSK & (1<<TOIE1);
+		case SIM_TIMER0_OVF: return io->TIMSK & (1<<TOIE0);
+		case SIM_USART_RXC: return io->UCSRB & (1<<RXCIE);
+		case SIM_USART_UDRE: return io->UCSRB & (1<<UDRIE);
+		case SIM_USART_TXC: return io->UCSRB & (1<<TXCIE);
+		default: return io->ADCSRA & (1<<ADIE);
+	}
+}
+
+static void atualiza_pendente(void)
+{
+	pendente = 0;
+	for (int v = 0; v < SIM_NUM_VETORES; v++) {
+		if (flag(v) && habilitada(&sombra, v)) pendente = 1;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Timers
+
+struct Contador
+{
+	uint16_t prescaler; // 0 parado
+	int64_t base; // ciclo em que a contagem total era 0
+	uint32_t parado; // contagem enquanto parado
+};
+
+static struct Contador timer0, timer1, timer2;
+static const uint16_t prescaler01[8] = {0, 1, 8, 64, 256, 1024, 0, 0}; // clock externo não é simulado
+static const uint16_t prescaler2[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+// contagens totais desde a base, sem dar a volta
+static uint64_t contagens(const struct Contador *c, uint64_t ciclo)
+{
+	return (uint64_t)((int64_t)ciclo - c->base) / c->prescaler;
+}
+
+static void contador_reinicia(struct Contador *c, uint16_t prescaler, uint32_t valor)
+{
+	c->prescaler = prescaler;
+	if (prescaler) c->base = (int64_t)sim_ciclo - (int64_t)valor*prescaler;
+	else c->parado = valor;
+}
+
+// ciclo da próxima contagem depois do ciclo agora em que a contagem módulo periodo vale fase
+static uint64_t contador_proximo(const struct Contador *c, uint32_t periodo, uint32_t fase, uint64_t agora)
+{
+	if (!c->prescaler || fase >= periodo) return NUNCA;
+	const uint64_t atual = contagens(c, agora);
+	uint64_t k = atual - atual%periodo + fase;
+	if (k <= atual) k += periodo;
+	return (uint64_t)(c->base + (int64_t)(k*c->prescaler));
+}
+
+static uint8_t timer0_valor(void)
+{
+	return timer0.prescaler ? (uint8_t)contagens(&timer0, sim_ciclo) : (uint8_t)timer0.parado;
+}
+
+static void timer0_agenda(void)
+{
+	evento[EV_T0] = contador_proximo(&timer0, 256, 0, sim_ciclo);
+}
+
+static uint32_t timer1_topo(const struct sim_io *io)
+{
+	const uint8_t modo = ((io->TCCR1B>>WGM12)&3)<<2 | (io->TCCR1A&3);
+	if (modo == 12 || modo == 14) return io->ICR1;
+	if (modo == 4 || modo == 15) return io->OCR1A;
+	return 0xFFFF;
+}
+
+static uint32_t timer1_periodo(void)
+{
+	return timer1_topo(&sombra) + 1;
+}
+
+static uint16_t timer1_valor(void)
+{
+	return timer1.prescaler ? (uint16_t)(contagens(&timer1, sim_ciclo) % timer1_periodo()) : (uint16_t)timer1.parado;
+}
+
+static void timer1_agenda(void)
+{
+	evento[EV_T1B] = contador_proximo(&timer1, timer1_periodo(), sombra.OCR1B, sim_ciclo);
+	evento[EV_T1OVF] = (sombra.TIMSK & (1<<TOIE1)) ? contador_proximo(&timer1, timer1_periodo(), 0, sim_ciclo) : NUNCA;
+}
+
+static uint32_t timer2_periodo(void)
+{
+	return (sombra.TCCR2 & (1<<WGM21)) ? (uint32_t)sombra.OCR2 + 1 : 256;
+}
+
+static uint8_t timer2_valor(void)
+{
+	return timer2.prescaler ? (uint8_t)(contagens(&timer2, sim_ciclo) % timer2_periodo()) : (uint8_t)timer2.parado;
+}
+
+static void timer2_agenda(void)
+{
+	evento[EV_T2] = contador_proximo(&timer2, timer2_periodo(), sombra.OCR2, sim_ciclo);
+}
+
+volatile uint8_t *sim_tcnt0(void);
+
+//-------------------------------------------------------------------------------------------------------
+// Bobina
+
+static uint64_t bobina_ciclo; // instante do estado da bobina
+static uint16_t ocr1a_ativo; // OCR1A em uso no período atual do PWM, atualizado no início de cada período
+static uint64_t ocr1a_periodo = NUNCA; // período do PWM em que ocr1a_ativo foi carregado
+
+static void bobina_integra(uint64_t ciclos, int ligada)
+{
+	const double tensao = ligada ? sim_bobina.tensao : -sim_bobina.diodo;
+	const double final = tensao/sim_bobina.resistencia;
+	const double t = (double)ciclos/SIM_F_CPU;
+	double i = final + (sim_bobina.corrente - final)*exp(-t*sim_bobina.resistencia/sim_bobina.indutancia);
+	if (i < 0) i = 0; // o diodo não conduz corrente reversa
+	sim_bobina.corrente = i;
+}
+
+// Avança a bobina até o ciclo ate. A saída fica ligada do início de cada período do PWM até OCR1A
+// (o driver inverte a saída OC1A, que o firmware configura para desligar no início do período).
+static void bobina_avanca(uint64_t ate)
+{
+	while (bobina_ciclo < ate) {
+		uint64_t fim = ate;
+		int ligada = 0;
+		if (timer1.prescaler) {
+			const uint32_t periodo = timer1_periodo();
+			const uint64_t n = contagens(&timer1, bobina_ciclo);
+			const uint64_t inicio = n - n%periodo;
+			if (inicio != ocr1a_periodo) {
+				ocr1a_ativo = sombra.OCR1A;
+				ocr1a_periodo = inicio;
+			}
+			const uint64_t troca = (n%periodo < ocr1a_ativo) ? inicio + ocr1a_ativo : inicio + periodo;
+			ligada = n%periodo < ocr1a_ativo;
+			const uint64_t ciclo_troca = (uint64_t)(timer1.base + (int64_t)(troca*timer1.prescaler));
+			if (ciclo_troca < fim) fim = ciclo_troca;
+		}
+		bobina_integra(fim - bobina_ciclo, ligada);
+		bobina_ciclo = fim;
+	}
+}
+
+double sim_corrente(void)
+{
+	bobina_avanca(sim_ciclo);
+	return sim_bobina.corrente*200.0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// ADC
+
+static uint8_t adc_primeira = 1;
+static uint8_t adc_canal;
+static uint16_t adc_amostra;
+static uint64_t adc_fim;
+static uint32_t aleatorio = 1;
+
+static double ruido(void)
+{
+	aleatorio ^= aleatorio << 13;
+	aleatorio ^= aleatorio >> 17;
+	aleatorio ^= aleatorio << 5;
+	return sim_ruido_lsb*((double)aleatorio/UINT32_MAX*2.0 - 1.0);
+}
+
+static void adc_inicia(void)
+{
+	const uint16_t prescaler = (sombra.ADCSRA & 7) ? 1 << (sombra.ADCSRA & 7) : 2;
+	const uint64_t inicio = (sim_ciclo/prescaler + 1)*prescaler; // a conversão começa na próxima borda do clock do ADC
+	adc_canal = sombra.ADMUX & 0x0F;
+	evento[EV_ADC_AMOSTRA] = inicio + (adc_primeira ? 27 : 3)*prescaler/2; // retenção 1,5 ciclo do ADC depois do início
+	evento[EV_ADC_FIM] = inicio + (adc_primeira ? 25 : 13)*prescaler;
+	adc_primeira = 0;
+	SETA(ADCSRA, 1<<ADSC);
+}
+
+static void adc_amostra_canal(uint64_t t)
+{
+	double valor = 0;
+	if (adc_canal == 0) { // corrente da bobina, calibração inversa do firmware
+		if (sim_controle.ultima_amostra) sim_estatistica_soma(&sim_controle.amostragem, t - sim_controle.ultima_amostra);
+		sim_controle.ultima_amostra = t;
+		if (timer1.prescaler) sim_estatistica_soma(&sim_controle.fase, contagens(&timer1, t) % timer1_periodo());
+		bobina_avanca(t);
+		valor = (sim_bobina.corrente*200.0 + 45.462)/1.311;
+	} else if (adc_canal == 1) { // entrada 4-20mA
+		valor = (sim_entrada_ma*50.0 - 3.769)/1.074;
+	}
+	valor = round(valor + ruido());
+	adc_amostra = valor < 0 ? 0 : (valor > 1023 ? 1023 : (uint16_t)valor);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// USART
+
+struct Caractere
+{
+	uint64_t fim;
+	uint8_t valor;
+	uint32_t bit; // duração de um bit em ciclos na taxa do mestre
+};
+
+#define TAM_FILA 65536
+static struct Caractere fila[TAM_FILA]; // bytes do mestre ainda não recebidos
+static uint32_t fila_inicio, fila_fim;
+static uint64_t fila_livre; // fim do último byte enviado pelo mestre
+
+// Acrescenta à fila n bytes transmitidos na taxa da linha, cada um terminando duracao ciclos depois do
+// anterior, a partir do fim do último byte da fila ou do ciclo atual
+static void fila_acrescenta(const uint8_t *dados, uint16_t n, uint64_t duracao)
+{
+	uint64_t t = fila_livre > sim_ciclo ? fila_livre : sim_ciclo;
+	for (uint16_t i = 0; i < n; i++) {
+		t += duracao;
+		struct Caractere *c = &fila[fila_fim % TAM_FILA];
+		c->fim = t;
+		c->valor = dados[i];
+		c->bit = SIM_F_CPU/sim_linha.taxa;
+		if (fila_fim == fila_inicio) evento[EV_RX] = t;
+		fila_fim++;
+	}
+	fila_livre = t;
+	recalcula_proximo();
+}
+
+struct Recepcao
+{
+	uint8_t valor, erro_quadro, sobrecarga;
+	uint64_t chegada;
+};
+static struct Recepcao fifo[2];
+static uint8_t fifo_n;
+static uint8_t ubrrh, ucsrc = 0x06; // valores de reset do UCSRC: 8 bits, 1 stop bit
+static uint8_t udr_carregado; // UDR contém um byte recebido, durante a interrupção de recepção
+
+static uint8_t tx_ocupado, tx_cheio, tx_byte, tx_buffer;
+static int rt_entrada = -1, rt_saida = -1, rt_outros = -1;
+static uint8_t acorda_ao_receber; // roteiro esperando a resposta do escravo
+
+static uint32_t usart_bit(void)
+{
+	const uint32_t ubrr = ((uint32_t)(ubrrh & 0x0F) << 8) | sombra.UBRRL;
+	return ((sombra.UCSRA & (1<<U2X)) ? 8 : 16)*(ubrr + 1);
+}
+
+static uint32_t usart_bits_caractere(void)
+{
+	const uint32_t dados = (sombra.UCSRB & (1<<UCSZ2)) ? 9 : 5 + ((ucsrc >> UCSZ0) & 3);
+	return 1 + dados + ((ucsrc & (1<<UPM1)) ? 1 : 0) + ((ucsrc & (1<<USBS)) ? 2 : 1);
+}
+
+static int taxas_compativeis(uint32_t bit_escravo, uint32_t bit_mestre)
+{
+	return fabs((double)bit_escravo - bit_mestre) <= 0.045*bit_mestre;
+}
+
+static int driver_transmitindo(void)
+{
+	return (sombra.DDRD & (1<<PD2)) && (sombra.PORTD & (1<<PD2));
+}
+
+static void usart_flags_recepcao(void)
+{
+	LIMPA(UCSRA, (1<<RXC)|(1<<FE)|(1<<DOR));
+	if (fifo_n) {
+		SETA(UCSRA, (1<<RXC) | (fifo[0].erro_quadro ? 1<<FE : 0) | (fifo[0].sobrecarga ? 1<<DOR : 0));
+		flag_desde[SIM_USART_RXC] = fifo[0].chegada;
+	}
+}
+
+static void usart_recebe(const struct Caractere *c, uint64_t t)
+{
+	if (!(sombra.UCSRB & (1<<RXEN)) || driver_transmitindo()) return; // o transceptor só recebe com o driver desligado
+	struct Recepcao r = {c->valor, 0, 0, t};
+	if (!taxas_compativeis(usart_bit(), c->bit)) {
+		r.valor = (uint8_t)(c->valor*37 + 11); // amostrado na taxa errada
+		r.erro_quadro = 1;
+	}
+	if (fifo_n == 2) { // o byte é perdido e o último da fila indica a sobrecarga
+		fifo[1].sobrecarga = 1;
+	} else {
+		fifo[fifo_n++] = r;
+	}
+	usart_flags_recepcao();
+}
+
+static void usart_transmite(uint8_t valor)
+{
+	if (!(sombra.UCSRB & (1<<TXEN))) return;
+	if (!tx_ocupado) {
+		tx_ocupado = 1;
+		tx_byte = valor;
+		evento[EV_TX] = sim_ciclo + usart_bits_caractere()*usart_bit();
+	} else if (!tx_cheio) {
+		tx_cheio = 1;
+		tx_buffer = valor;
+		LIMPA(UCSRA, 1<<UDRE);
+	}
+}
+
+static void usart_entrega(uint8_t valor, uint64_t t)
+{
+	if (!driver_transmitindo()) {
+		sim_bytes_sem_driver++;
+		return;
+	}
+	if (rt_saida >= 0) {
+		if (write(rt_saida, &valor, 1) < 0) exit(0);
+		return;
+	}
+	if (sim_num_recebidos < SIM_MAX_RECEBIDOS) {
+		struct SimRecebido *r = &sim_recebidos[sim_num_recebidos++];
+		r->fim = t;
+		r->erro = !taxas_compativeis(usart_bit(), SIM_F_CPU/sim_linha.taxa);
+		r->valor = r->erro ? (uint8_t)(valor*37 + 11) : valor;
+		if (acorda_ao_receber) evento[EV_ROTEIRO] = t;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Sincronização das escritas do firmware
+
+static void sincroniza(void)
+{
+	struct sim_io novo;
+	memcpy(&novo, (const void *)&sim_io, sizeof novo);
+
+	for (int v = 0; v < SIM_NUM_VETORES; v++) {
+		if (habilitada(&novo, v) && !habilitada(&sombra, v)) habilitada_desde[v] = sim_ciclo;
+	}
+
+	if (novo.TCCR0 != sombra.TCCR0 || novo.TCNT0 != sombra.TCNT0) {
+		const uint8_t valor = (novo.TCNT0 != sombra.TCNT0) ? novo.TCNT0 : timer0_valor();
+		contador_reinicia(&timer0, prescaler01[novo.TCCR0 & 7], valor);
+		sombra.TCCR0 = novo.TCCR0;
+		sim_io.TCNT0 = sombra.TCNT0 = valor;
+		timer0_agenda();
+	}
+
+	if (novo.OCR1A != sombra.OCR1A || novo.TCCR1A != sombra.TCCR1A || novo.TCCR1B != sombra.TCCR1B ||
+		novo.ICR1 != sombra.ICR1 || novo.OCR1B != sombra.OCR1B || novo.TCNT1 != sombra.TCNT1 || novo.TIMSK != sombra.TIMSK) {
+		bobina_avanca(sim_ciclo); // até aqui valeu a configuração anterior
+		const uint32_t valor = (novo.TCNT1 != sombra.TCNT1) ? novo.TCNT1 : timer1_valor();
+		sombra.OCR1A = novo.OCR1A;
+		sombra.TCCR1A = novo.TCCR1A;
+		sombra.TCCR1B = novo.TCCR1B;
+		sombra.ICR1 = novo.ICR1;
+		sombra.OCR1B = novo.OCR1B;
+		sombra.TCNT1 = novo.TCNT1;
+		sombra.TIMSK = novo.TIMSK;
+		contador_reinicia(&timer1, prescaler01[novo.TCCR1B & 7], valor);
+		if (!timer1.prescaler) ocr1a_ativo = novo.OCR1A;
+		timer1_agenda();
+	}
+
+	if (novo.TCCR2 != sombra.TCCR2 || novo.OCR2 != sombra.OCR2 || novo.TCNT2 != 0xFFFF) {
+		const uint8_t valor = (novo.TCNT2 != 0xFFFF) ? (uint8_t)novo.TCNT2 : timer2_valor();
+		sombra.TCCR2 = novo.TCCR2;
+		sombra.OCR2 = novo.OCR2;
+		contador_reinicia(&timer2, prescaler2[novo.TCCR2 & 7], valor);
+		sim_io.TCNT2 = sombra.TCNT2 = 0xFFFF;
+		timer2_agenda();
+	}
+
+	if (novo.TIFR != sombra.TIFR) { // escrever 1 limpa a flag
+		sim_io.TIFR = sombra.TIFR = sombra.TIFR & ~novo.TIFR;
+	}
+
+	if (novo.ADCSRA != sombra.ADCSRA) {
+		uint8_t adcsra = novo.ADCSRA & ~((1<<ADIF)|(1<<ADSC));
+		if (!(novo.ADCSRA & (1<<ADIF))) adcsra |= sombra.ADCSRA & (1<<ADIF); // escrever 1 limpa a flag
+		if (evento[EV_ADC_FIM] != NUNCA) adcsra |= 1<<ADSC;
+		sim_io.ADCSRA = sombra.ADCSRA = adcsra;
+		if (!(adcsra & (1<<ADEN))) {
+			evento[EV_ADC_AMOSTRA] = evento[EV_ADC_FIM] = NUNCA;
+			LIMPA(ADCSRA, 1<<ADSC);
+		} else if ((novo.ADCSRA & (1<<ADSC)) && evento[EV_ADC_FIM] == NUNCA) {
+			adc_inicia();
+		}
+	}
+
+	if (novo.UBRRH_UCSRC != sombra.UBRRH_UCSRC) {
+		if (novo.UBRRH_UCSRC & (1<<URSEL)) ucsrc = novo.UBRRH_UCSRC;
+		else ubrrh = novo.UBRRH_UCSRC;
+	}
+
+	if (novo.UCSRA != sombra.UCSRA) {
+		const uint8_t flags = sombra.UCSRA & ((1<<RXC)|(1<<UDRE)|(1<<FE)|(1<<DOR)|(1<<PE));
+		if (novo.UCSRA & (1<<TXC)) flag_txc = 0; // escrever 1 limpa a flag
+		sim_io.UCSRA = sombra.UCSRA = (novo.UCSRA & ((1<<U2X)|(1<<MPCM))) | flags;
+	}
+
+	if ((novo.UCSRB ^ sombra.UCSRB) & novo.UCSRB & (1<<RXEN)) fifo_n = 0; // receptor religado
+	if (!(novo.UCSRB & (1<<RXEN)) && fifo_n) {
+		fifo_n = 0;
+		sombra.UCSRB = novo.UCSRB;
+		usart_flags_recepcao();
+	}
+
+	// copia os demais registradores antes de transmitir, que depende do UCSRB e do UBRR
+	const uint16_t udr = novo.UDR;
+	memcpy(&novo, (const void *)&sim_io, sizeof novo);
+	novo.UDR = sombra.UDR;
+	sombra = novo;
+	if (udr != sombra.UDR && udr <= 0xFF) {
+		usart_transmite((uint8_t)udr);
+		sim_io.UDR = sombra.UDR = 0xFFFF;
+		udr_carregado = 0;
+	}
+
+	atualiza_pendente();
+	recalcula_proximo();
+}
+
+static inline void sincroniza_se_mudou(void)
+{
+	if (memcmp((const void *)&sim_io, &sombra, sizeof sombra)) sincroniza();
+}
+
+volatile uint8_t *sim_tcnt0(void)
+{
+	sincroniza_se_mudou();
+	sim_io.TCNT0 = sombra.TCNT0 = timer0_valor();
+	return &sim_io.TCNT0;
+}
+
+uint8_t sim_pinb(void)
+{
+	const uint8_t entradas = (sim_dip & 8) ? ~(1<<PB0) : 0xFF; // chave ligada puxa o pino para 0
+	return (sim_io.DDRB & sim_io.PORTB) | (~sim_io.DDRB & entradas);
+}
+
+uint8_t sim_pinc(void)
+{
+	return (sim_io.DDRC & sim_io.PORTC) | (uint8_t)~sim_io.DDRC;
+}
+
+uint8_t sim_pind(void)
+{
+	uint8_t entradas = 0xFF;
+	if (sim_dip & 1) entradas &= ~(1<<PD5);
+	if (sim_dip & 2) entradas &= ~(1<<PD6);
+	if (sim_dip & 4) entradas &= ~(1<<PD7);
+	return (sim_io.DDRD & sim_io.PORTD) | (~sim_io.DDRD & entradas);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Roteiro
+
+static ucontext_t ctx_firmware, ctx_roteiro, ctx_fim;
+static void (*roteiro_atual)(void);
+static int roteiro_terminou;
+
+static void roteiro_retoma(void)
+{
+	evento[EV_ROTEIRO] = NUNCA;
+	swapcontext(&ctx_firmware, &ctx_roteiro);
+	recalcula_proximo();
+	atualiza_pendente();
+}
+
+void sim_espera(uint64_t ciclos)
+{
+	evento[EV_ROTEIRO] = sim_ciclo + ciclos;
+	recalcula_proximo();
+	swapcontext(&ctx_roteiro, &ctx_firmware);
+}
+
+void sim_espera_byte(uint64_t ciclos)
+{
+	acorda_ao_receber = 1;
+	sim_espera(ciclos);
+	acorda_ao_receber = 0;
+}
+
+static void roteiro_entrada(void)
+{
+	roteiro_atual();
+	roteiro_terminou = 1;
+	setcontext(&ctx_fim);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Tempo real
+
+// A simulação pode se adiantar até RT_ADIANTAMENTO do relógio sem esperar, para não dormir a cada interrupção
+// do Timer1; os bytes recebidos nesse meio tempo entram no barramento no ciclo em que a simulação está.
+#define RT_ADIANTAMENTO SIM_US(200)
+
+// Os pacotes dos outros escravos chegam inteiros, quando já terminaram no barramento, e são entregues com um
+// byte a cada RT_REPASSE: na taxa da linha, ocupariam o barramento deste escravo por mais um pacote inteiro e
+// atrasariam o pedido seguinte do mestre. O firmware só descarta bytes separados por mais de t1,5.
+#define RT_REPASSE SIM_US(40)
+
+static struct timespec rt_inicio;
+static uint64_t rt_ciclo_inicio;
+
+static uint64_t rt_agora(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	const double s = (double)(t.tv_sec - rt_inicio.tv_sec) + (t.tv_nsec - rt_inicio.tv_nsec)*1e-9;
+	return rt_ciclo_inicio + (uint64_t)(s*SIM_F_CPU);
+}
+
+static void rt_le(int fd, uint64_t agora)
+{
+	uint8_t dados[256];
+	const ssize_t n = read(fd, dados, sizeof dados);
+	if (n <= 0) exit(0); // o outro lado fechou
+	if (agora < sim_ciclo) agora = sim_ciclo;
+	if (fila_livre < agora) fila_livre = agora;
+	if (fd == rt_outros) {
+		const uint64_t caractere = sim_tempo_caractere();
+		fila_acrescenta(dados, (uint16_t)n, caractere < RT_REPASSE ? caractere : RT_REPASSE);
+	} else {
+		sim_envia(dados, (uint16_t)n);
+	}
+}
+
+// Espera o relógio chegar perto do ciclo alvo, recebendo os bytes que chegarem. Retorna antes se algum byte chegou.
+static void rt_espera(uint64_t alvo)
+{
+	for (;;) {
+		const uint64_t agora = rt_agora();
+		if (alvo != NUNCA && agora + RT_ADIANTAMENTO >= alvo) return; // os bytes recebidos esperam a próxima espera
+		struct pollfd p[2] = {{rt_entrada, POLLIN, 0}, {rt_outros, POLLIN, 0}}; // o poll ignora o fd -1
+		struct timespec espera, *prazo = NULL;
+		if (alvo != NUNCA) {
+			const uint64_t ns = (alvo - agora)*1000/(SIM_F_CPU/1000000);
+			espera.tv_sec = (time_t)(ns/1000000000);
+			espera.tv_nsec = (long)(ns%1000000000);
+			prazo = &espera;
+		}
+		if (ppoll(p, 2, prazo, NULL) > 0) {
+			for (int i = 0; i < 2; i++) {
+				if (p[i].revents) rt_le(p[i].fd, rt_agora());
+			}
+			return;
+		}
+	}
+}
+
+void sim_tempo_real(int entrada, int saida, int outros)
+{
+	rt_entrada = entrada;
+	rt_saida = saida;
+	rt_outros = outros;
+	clock_gettime(CLOCK_MONOTONIC, &rt_inicio);
+	rt_ciclo_inicio = sim_ciclo;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Avanço do tempo e interrupções
+
+static void processa(void)
+{
+	while (sim_ciclo >= proximo) {
+		const uint64_t t = proximo;
+		int e = 0;
+		while (evento[e] != t) e++;
+		switch (e) {
+			case EV_T2:
+				SETA(TIFR, 1<<OCF2);
+				flag_desde[SIM_TIMER2_COMP] = t;
+				evento[EV_T2] = t + (uint64_t)timer2_periodo()*timer2.prescaler;
+				break;
+			case EV_T1B:
+				SETA(TIFR, 1<<OCF1B);
+				flag_desde[SIM_TIMER1_COMPB] = t;
+				evento[EV_T1B] = t + (uint64_t)timer1_periodo()*timer1.prescaler;
+				break;
+			case EV_T1OVF:
+				SETA(TIFR, 1<<TOV1);
+				flag_desde[SIM_TIMER1_OVF] = t;
+				evento[EV_T1OVF] = t + (uint64_t)timer1_periodo()*timer1.prescaler;
+				break;
+			case EV_T0:
+				SETA(TIFR, 1<<TOV0);
+				flag_desde[SIM_TIMER0_OVF] = t;
+				evento[EV_T0] = t + 256ULL*timer0.prescaler;
+				break;
+			case EV_ADC_AMOSTRA:
+				adc_amostra_canal(t);
+				evento[EV_ADC_AMOSTRA] = NUNCA;
+				break;
+			case EV_ADC_FIM:
+				evento[EV_ADC_FIM] = NUNCA;
+				sim_io.ADCW = sombra.ADCW = adc_amostra;
+				LIMPA(ADCSRA, 1<<ADSC);
+				SETA(ADCSRA, 1<<ADIF);
+				flag_desde[SIM_ADC] = t;
+				adc_fim = t;
+				if (sombra.ADCSRA & (1<<ADFR)) adc_inicia();
+				break;
+			case EV_RX:
+				usart_recebe(&fila[fila_inicio % TAM_FILA], t);
+				fila_inicio++;
+				evento[EV_RX] = (fila_inicio != fila_fim) ? fila[fila_inicio % TAM_FILA].fim : NUNCA;
+				break;
+			case EV_TX:
+				usart_entrega(tx_byte, t);
+				if (tx_cheio) {
+					tx_cheio = 0;
+					tx_byte = tx_buffer;
+					SETA(UCSRA, 1<<UDRE);
+					flag_desde[SIM_USART_UDRE] = t;
+					evento[EV_TX] = t + usart_bits_caractere()*usart_bit();
+				} else {
+					tx_ocupado = 0;
+					flag_txc = 1;
+					flag_desde[SIM_USART_TXC] = t;
+					evento[EV_TX] = NUNCA;
+				}
+				break;
+			case EV_ROTEIRO:
+				roteiro_retoma();
+				break;
+		}
+		recalcula_proximo();
+	}
+	atualiza_pendente();
+}
+
+struct Quadro
+{
+	uint64_t entrada;
+	uint64_t aninhados; // ciclos das interrupções aninhadas nesta
+};
+static struct Quadro pilha[SIM_NUM_VETORES + 1];
+static uint8_t profundidade;
+
+static void executa_isr(int v)
+{
+	const uint64_t inicio = sim_ciclo;
+	const uint64_t pronta = flag_desde[v] > habilitada_desde[v] ? flag_desde[v] : habilitada_desde[v];
+	sim_estatistica_soma(&sim_perfil[v].latencia, inicio - pronta);
+
+	// o hardware limpa as flags das fontes sem buffer ao entrar na rotina
+	switch (v) {
+		case SIM_TIMER2_COMP: LIMPA(TIFR, 1<<OCF2); break;
+		case SIM_TIMER1_COMPB: LIMPA(TIFR, 1<<OCF1B); break;
+		case SIM_TIMER1_OVF: LIMPA(TIFR, 1<<TOV1); break;
+		case SIM_TIMER0_OVF: LIMPA(TIFR, 1<<TOV0); break;
+		case SIM_USART_TXC: flag_txc = 0; break;
+		case SIM_ADC:
+			LIMPA(ADCSRA, 1<<ADIF);
+			if (adc_canal == 0) {
+				sim_estatistica_soma(&sim_controle.latencia, inicio - adc_fim);
+				if (sim_controle.ultima) sim_estatistica_soma(&sim_controle.periodo, inicio - sim_controle.ultima);
+				sim_controle.ultima = inicio;
+			}
+			break;
+		case SIM_USART_RXC: // o UDR traz o primeiro byte da fila, considerado lido na entrada da rotina
+			sim_io.UDR = sombra.UDR = fifo[0].valor;
+			udr_carregado = 1;
+			fifo[0] = fifo[1];
+			fifo_n--;
+			usart_flags_recepcao();
+			break;
+	}
+	LIMPA(SREG, 0x80);
+	atualiza_pendente();
+
+	pilha[profundidade].entrada = inicio;
+	pilha[profundidade].aninhados = 0;
+	profundidade++;
+	if (profundidade > sim_aninhamento_max) sim_aninhamento_max = profundidade;
+	sim_ciclo += SIM_CUSTO_ENTRADA;
+
+	rotina[v]();
+
+	sincroniza_se_mudou();
+	sim_ciclo += SIM_CUSTO_SAIDA;
+	profundidade--;
+	const uint64_t ciclos = sim_ciclo - inicio;
+	sim_estatistica_soma(&sim_perfil[v].ciclos, ciclos);
+	sim_estatistica_soma(&sim_perfil[v].exclusivos, ciclos - pilha[profundidade].aninhados);
+	if (profundidade) pilha[profundidade - 1].aninhados += ciclos;
+
+	if (v == SIM_USART_RXC) {
+		if (udr_carregado) sim_io.UDR = sombra.UDR = 0xFFFF;
+		udr_carregado = 0;
+	}
+	SETA(SREG, 0x80); // reti
+	if (sim_ciclo >= proximo) processa();
+	atualiza_pendente();
+}
+
+static void despacha(void)
+{
+	while ((sim_io.SREG & 0x80) && pendente) {
+		int v = 0;
+		while (v < SIM_NUM_VETORES && !(flag(v) && habilitada(&sombra, v))) v++;
+		if (v == SIM_NUM_VETORES) {
+			pendente = 0;
+			break;
+		}
+		executa_isr(v);
+	}
+}
+
+// Chamada no início de cada bloco básico do firmware
+void __sanitizer_cov_trace_pc(void)
+{
+	sim_ciclo += SIM_CUSTO_BLOCO;
+	sincroniza_se_mudou();
+	if (sim_ciclo >= proximo) processa();
+	if ((sim_io.SREG & 0x80) && pendente) despacha();
+}
+
+// Avança o tempo até o ciclo alvo sem executar o código que chamou, atendendo as interrupções
+static void avanca_ate(uint64_t alvo)
+{
+	while (sim_ciclo < alvo) {
+		sincroniza_se_mudou();
+		const uint64_t t = proximo < alvo ? proximo : alvo;
+		if (rt_entrada >= 0) rt_espera(t);
+		if (t > sim_ciclo && proximo >= t) sim_ciclo = t;
+		processa();
+		despacha();
+	}
+}
+
+// As divisões de 32 bits do AVR são um laço da libgcc de centenas de ciclos, interrompido normalmente
+// pelas interrupções. O Makefile insere uma chamada a sim_divisao antes de cada instrução de divisão do
+// firmware, com o custo em %edi, e a rotina avança o tempo atendendo as interrupções como nos blocos.
+__attribute__((used)) static void divisao_avanca(uint32_t ciclos)
+{
+	avanca_ate(sim_ciclo + ciclos);
+}
+
+// Preserva os registradores e as flags do código do firmware, que não espera uma chamada nesse ponto. O
+// chamador já guardou o %rdi e pulou a red zone.
+__asm__(
+	"	.text\n"
+	"	.globl sim_divisao\n"
+	"sim_divisao:\n"
+	"	pushfq\n"
+	"	pushq %rax\n"
+	"	pushq %rcx\n"
+	"	pushq %rdx\n"
+	"	pushq %rsi\n"
+	"	pushq %r8\n"
+	"	pushq %r9\n"
+	"	pushq %r10\n"
+	"	pushq %r11\n"
+	"	pushq %rbp\n"
+	"	movq %rsp, %rbp\n"
+	"	andq $-16, %rsp\n"
+	"	subq $512, %rsp\n"
+	"	fxsave (%rsp)\n"
+	"	call divisao_avanca\n"
+	"	fxrstor (%rsp)\n"
+	"	movq %rbp, %rsp\n"
+	"	popq %rbp\n"
+	"	popq %r11\n"
+	"	popq %r10\n"
+	"	popq %r9\n"
+	"	popq %r8\n"
+	"	popq %rsi\n"
+	"	popq %rdx\n"
+	"	popq %rcx\n"
+	"	popq %rax\n"
+	"	popfq\n"
+	"	ret\n"
+);
+
+void sim_dorme(void)
+{
+	sincroniza_se_mudou();
+	if (!(sombra.MCUCR & (1<<SE))) return;
+	if (!(sombra.SREG & 0x80)) {
+		fprintf(stderr, "simulador: sleep com as interrupções desabilitadas em %.3fms\n", sim_ciclo/(SIM_F_CPU/1000.0));
+		exit(2);
+	}
+	while (!pendente) {
+		if (proximo == NUNCA && rt_entrada < 0) {
+			fprintf(stderr, "simulador: dormindo sem nenhum evento pendente em %.3fms\n", sim_ciclo/(SIM_F_CPU/1000.0));
+			exit(2);
+		}
+		const uint64_t t = proximo;
+		if (rt_entrada >= 0) rt_espera(t);
+		if (proximo == t && t > sim_ciclo) sim_ciclo = t;
+		processa();
+	}
+	despacha();
+}
+
+void sim_atraso(uint64_t ciclos)
+{
+	while (ciclos) {
+		sincroniza_se_mudou();
+		uint64_t passo = proximo > sim_ciclo ? proximo - sim_ciclo : 1;
+		if (passo > ciclos) passo = ciclos;
+		sim_ciclo += passo;
+		ciclos -= passo;
+		processa();
+		despacha();
+	}
+}
+
+void sim_sei(void)
+{
+	SETA(SREG, 0x80); // as interrupções pendentes são atendidas no próximo bloco
+}
+
+void sim_cli(void)
+{
+	LIMPA(SREG, 0x80);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// EEPROM
+
+extern uint8_t __start_sim_eeprom[] __attribute__((weak));
+extern uint8_t __stop_sim_eeprom[] __attribute__((weak));
+static uint8_t eeprom[E2END + 1];
+static uint64_t eeprom_livre;
+
+static uint16_t eeprom_endereco(const void *p)
+{
+	const uint8_t *b = p;
+	if (__start_sim_eeprom && b >= __start_sim_eeprom && b < __stop_sim_eeprom) return (uint16_t)(b - __start_sim_eeprom);
+	return (uint16_t)((uintptr_t)p & E2END); // endereço numérico
+}
+
+void sim_eeprom_apaga(void)
+{
+	memset(eeprom, 0xFF, sizeof eeprom);
+}
+
+void sim_eeprom_escreve(const void *variavel, const void *dados, uint16_t n)
+{
+	for (uint16_t i = 0; i < n; i++) eeprom[eeprom_endereco((const uint8_t *)variavel + i)] = ((const uint8_t *)dados)[i];
+}
+
+void eeprom_busy_wait(void)
+{
+	avanca_ate(eeprom_livre);
+}
+
+int eeprom_is_ready(void)
+{
+	return sim_ciclo >= eeprom_livre;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *endereco)
+{
+	eeprom_busy_wait();
+	return eeprom[eeprom_endereco(endereco)];
+}
+
+void eeprom_read_block(void *destino, const void *origem, size_t n)
+{
+	for (size_t i = 0; i < n; i++) ((uint8_t *)destino)[i] = eeprom_read_byte((const uint8_t *)origem + i);
+}
+
+uint16_t eeprom_read_word(const uint16_t *endereco)
+{
+	uint16_t valor;
+	eeprom_read_block(&valor, endereco, sizeof valor);
+	return valor;
+}
+
+uint32_t eeprom_read_dword(const uint32_t *endereco)
+{
+	uint32_t valor;
+	eeprom_read_block(&valor, endereco, sizeof valor);
+	return valor;
+}
+
+static void eeprom_grava(uint8_t *endereco, uint8_t valor, int sempre)
+{
+	eeprom_busy_wait();
+	const uint16_t e = eeprom_endereco(endereco);
+	if (!sempre && eeprom[e] == valor) return;
+	eeprom[e] = valor;
+	eeprom_livre = sim_ciclo + SIM_EEPROM_ESCRITA;
+	sim_eeprom_gravacoes++;
+}
+
+void eeprom_write_byte(uint8_t *endereco, uint8_t valor) { eeprom_grava(endereco, valor, 1); }
+void eeprom_update_byte(uint8_t *endereco, uint8_t valor) { eeprom_grava(endereco, valor, 0); }
+
+void eeprom_write_block(const void *origem, void *destino, size_t n)
+{
+	for (size_t i = 0; i < n; i++) eeprom_grava((uint8_t *)destino + i, ((const uint8_t *)origem)[i], 1);
+}
+
+void eeprom_update_block(const void *origem, void *destino, size_t n)
+{
+	for (size_t i = 0; i < n; i++) eeprom_grava((uint8_t *)destino + i, ((const uint8_t *)origem)[i], 0);
+}
+
+void eeprom_write_word(uint16_t *endereco, uint16_t valor) { eeprom_write_block(&valor, endereco, sizeof valor); }
+void eeprom_update_word(uint16_t *endereco, uint16_t valor) { eeprom_update_block(&valor, endereco, sizeof valor); }
+void eeprom_write_dword(uint32_t *endereco, uint32_t valor) { eeprom_write_block(&valor, endereco, sizeof valor); }
+void eeprom_update_dword(uint32_t *endereco, uint32_t valor) { eeprom_update_block(&valor, endereco, sizeof valor); }
+
+//-------------------------------------------------------------------------------------------------------
+// Barramento
+
+uint64_t sim_tempo_caractere(void)
+{
+	return (uint64_t)sim_linha.bits*SIM_F_CPU/sim_linha.taxa;
+}
+
+uint64_t sim_fim_envio(void)
+{
+	return fila_livre > sim_ciclo ? fila_livre : sim_ciclo;
+}
+
+void sim_envia(const uint8_t *dados, uint16_t n)
+{
+	fila_acrescenta(dados, n, sim_tempo_caractere());
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Medições
+
+void sim_estatistica_soma(struct SimEstatistica *e, uint64_t valor)
+{
+	if (!e->n || valor < e->min) e->min = valor;
+	if (!e->n || valor > e->max) e->max = valor;
+	e->soma += valor;
+	e->n++;
+}
+
+double sim_estatistica_media(const struct SimEstatistica *e)
+{
+	return e->n ? (double)e->soma/e->n : 0.0;
+}
+
+void sim_perfil_zera(void)
+{
+	memset(sim_perfil, 0, sizeof sim_perfil);
+	memset(&sim_controle, 0, sizeof sim_controle);
+	memset(&sim_processamento, 0, sizeof sim_processamento);
+	sim_aninhamento_max = 0;
+}
+
+static void imprime_estatistica(FILE *saida, const struct SimEstatistica *e)
+{
+	if (e->n) fprintf(saida, " %6llu %7.1f %6llu", (unsigned long long)e->min, sim_estatistica_media(e), (unsigned long long)e->max);
+	else fprintf(saida, " %6s %7s %6s", "-", "-", "-");
+}
+
+void sim_perfil_imprime(FILE *saida)
+{
+	fprintf(saida, "%-13s %8s | %-21s | %-21s | %-21s\n", "", "", "ciclos", "ciclos exclusivos", "latência (ciclos)");
+	fprintf(saida, "%-13s %8s | %6s %7s %6s | %6s %7s %6s | %6s %7s %6s\n", "vetor", "n",
+		"min", "média", "max", "min", "média", "max", "min", "média", "max");
+	for (int v = 0; v < SIM_NUM_VETORES; v++) {
+		if (!sim_perfil[v].ciclos.n) continue;
+		fprintf(saida, "%-13s %8u |", sim_nome_vetor[v], sim_perfil[v].ciclos.n);
+		imprime_estatistica(saida, &sim_perfil[v].ciclos);
+		fprintf(saida, " |");
+		imprime_estatistica(saida, &sim_perfil[v].exclusivos);
+		fprintf(saida, " |");
+		imprime_estatistica(saida, &sim_perfil[v].latencia);
+		fprintf(saida, "\n");
+	}
+	if (sim_processamento.n) {
+		fprintf(saida, "%-13s %8u |", "ModBusProcess", sim_processamento.n);
+		imprime_estatistica(saida, &sim_processamento);
+		fprintf(saida, " |\n");
+	}
+	if (sim_controle.periodo.n) {
+		fprintf(saida, "controle: período %.2f a %.2fus, média %.2fus (jitter %.2fus), latência do fim da conversão %.2f a %.2fus\n",
+			SIM_CICLOS_US(sim_controle.periodo.min), SIM_CICLOS_US(sim_controle.periodo.max),
+			SIM_CICLOS_US(sim_estatistica_media(&sim_controle.periodo)),
+			SIM_CICLOS_US(sim_controle.periodo.max - sim_controle.periodo.min),
+			SIM_CICLOS_US(sim_controle.latencia.min), SIM_CICLOS_US(sim_controle.latencia.max));
+	}
+	if (sim_controle.amostragem.n) {
+		fprintf(saida, "amostragem: período %.2f a %.2fus (jitter %.2fus), Timer1 na retenção %llu a %llu\n",
+			SIM_CICLOS_US(sim_controle.amostragem.min), SIM_CICLOS_US(sim_controle.amostragem.max),
+			SIM_CICLOS_US(sim_controle.amostragem.max - sim_controle.amostragem.min),
+			(unsigned long long)sim_controle.fase.min, (unsigned long long)sim_controle.fase.max);
+	}
+	fprintf(saida, "aninhamento máximo: %u\n", sim_aninhamento_max);
+}
+
+// O ModBusProcess é medido pelos ganchos de -finstrument-functions
+static uint64_t processamento_inicio;
+
+void __cyg_profile_func_enter(void *funcao, void *chamada)
+{
+	(void)chamada;
+	if (funcao == (void *)ModBusProcess) processamento_inicio = sim_ciclo;
+}
+
+void __cyg_profile_func_exit(void *funcao, void *chamada)
+{
+	(void)chamada;
+	if (funcao == (void *)ModBusProcess) sim_estatistica_soma(&sim_processamento, sim_ciclo - processamento_inicio);
+}
+
+//-------------------------------------------------------------------------------------------------------
+
+int sim_executa(void (*roteiro)(void))
+{
+	static char pilha_roteiro[1 << 20];
+	for (int e = 0; e < EV_NUM; e++) evento[e] = NUNCA;
+	sim_io.UCSRA = sombra.UCSRA = 1<<UDRE;
+	sim_io.UDR = sombra.UDR = 0xFFFF;
+	sim_io.TCNT2 = sombra.TCNT2 = 0xFFFF;
+	if (__start_sim_eeprom) memcpy(eeprom, __start_sim_eeprom, (size_t)(__stop_sim_eeprom - __start_sim_eeprom));
+	else sim_eeprom_apaga();
+
+	if (roteiro) {
+		roteiro_atual = roteiro;
+		getcontext(&ctx_roteiro);
+		ctx_roteiro.uc_stack.ss_sp = pilha_roteiro;
+		ctx_roteiro.uc_stack.ss_size = sizeof pilha_roteiro;
+		ctx_roteiro.uc_link = NULL;
+		makecontext(&ctx_roteiro, roteiro_entrada, 0);
+		getcontext(&ctx_fim);
+		if (roteiro_terminou) {
+			if (sim_falhas) printf("%u verificações falharam\n", sim_falhas);
+			fflush(stdout);
+			return sim_falhas ? 1 : 0;
+		}
+		swapcontext(&ctx_firmware, &ctx_roteiro); // configuração antes do reset
+	}
+	if (rt_entrada >= 0) sim_tempo_real(rt_entrada, rt_saida, rt_outros);
+	firmware_main();
+	return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ *		simulador.h
+ *
+ *		Simulação do controlador no host: o firmware compilado sem alterações sobre os registradores
+ *		do ATmega8 em avr/io.h, os timers, o ADC, a USART e a EEPROM, a bobina do freio alimentada pelo
+ *		PWM do OCR1A e um mestre ModBus no barramento.
+ *
+ *		O tempo é contado em ciclos de clock de 16MHz. O firmware é compilado com
+ *		-fsanitize-coverage=trace-pc, e cada bloco básico executado custa SIM_CUSTO_BLOCO ciclos. Os
+ *		eventos dos periféricos acontecem entre os blocos, e as interrupções são atendidas no início do
+ *		bloco seguinte, aninhando quando a rotina de interrupção liga o bit I. O processador dormindo
+ *		salta direto para o próximo evento, o que deixa a simulação muito mais rápida que o tempo real.
+ *
+ *		Os ciclos são uma estimativa do modelo e não do código gerado pelo avr-gcc: um bloco com uma
+ *		multiplicação de 32 bits custa o mesmo que um bloco com uma soma. Servem para comparar versões
+ *		do firmware e encontrar regressões no caminho das interrupções, enquanto os tempos reais são
+ *		medidos no próprio controlador (registradores 9 a 25).
+ *
+ *		Os testes são roteiros executados como corrotinas: o roteiro configura a planta e o barramento,
+ *		espera o tempo simulado passar com sim_espera e confere os resultados com SIM_VERIFICA.
+ */
+
+#ifndef SIMULADOR_H
+#define SIMULADOR_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SIM_F_CPU 16000000UL
+#define SIM_US(us) ((uint64_t)((us)*(SIM_F_CPU/1000000.0)))
+#define SIM_MS(ms) ((uint64_t)((ms)*(SIM_F_CPU/1000.0)))
+#define SIM_CICLOS_US(ciclos) ((double)(ciclos)/(SIM_F_CPU/1000000.0))
+
+// custos do modelo de tempo, em ciclos
+#define SIM_CUSTO_BLOCO		9	// bloco básico do firmware
+#define SIM_CUSTO_ENTRADA	27	// resposta à interrupção, rjmp do vetor e prólogo
+#define SIM_CUSTO_SAIDA		22	// epílogo e reti
+#define SIM_EEPROM_ESCRITA	SIM_US(8500) // gravação de um byte na EEPROM
+
+extern uint64_t sim_ciclo; // tempo desde o reset
+
+//-------------------------------------------------------------------------------------------------------
+// Planta
+
+// Bobina do freio: fonte de tensao chaveada pelo PWM, com diodo de roda livre. O valor padrão dá 5,5A com
+// o PWM em PWM_LIMIT (180 de 801) e constante de tempo de 20ms.
+struct SimBobina
+{
+	double tensao;		// V
+	double resistencia;	// ohm
+	double indutancia;	// H
+	double diodo;		// queda no diodo de roda livre, V
+	double corrente;	// A, estado atual
+};
+extern struct SimBobina sim_bobina;
+extern double sim_entrada_ma;	// corrente na entrada analógica 4-20mA
+extern double sim_ruido_lsb;	// amplitude do ruído uniforme somado às conversões do ADC
+extern uint8_t sim_dip;			// posição das dip switches (endereço ModBus)
+
+double sim_corrente(void);		// corrente na bobina agora, na escala do registrador 1 (1000 = 5A)
+
+//-------------------------------------------------------------------------------------------------------
+// EEPROM
+
+extern uint32_t sim_eeprom_gravacoes; // bytes gravados desde o reset
+void sim_eeprom_apaga(void); // EEPROM nova (0xFF), em vez dos valores do arquivo .eep
+void sim_eeprom_escreve(const void *variavel, const void *dados, uint16_t n); // altera uma variável EEMEM, sem esperar a gravação
+
+//-------------------------------------------------------------------------------------------------------
+// Barramento RS-485 e mestre
+
+struct SimLinha
+{
+	uint32_t taxa;	// bps do mestre
+	uint8_t bits;	// bits por caractere do mestre, com start, paridade e stop
+};
+extern struct SimLinha sim_linha;
+
+struct SimRecebido
+{
+	uint64_t fim; // ciclo do fim do stop bit
+	uint8_t valor;
+	uint8_t erro; // taxa do escravo diferente da do mestre
+};
+#define SIM_MAX_RECEBIDOS 4096
+extern struct SimRecebido sim_recebidos[SIM_MAX_RECEBIDOS]; // bytes transmitidos pelo escravo
+extern uint16_t sim_num_recebidos;
+extern uint32_t sim_bytes_sem_driver; // bytes transmitidos com o driver RS-485 desabilitado
+
+uint64_t sim_tempo_caractere(void); // duração de um caractere do mestre em ciclos
+void sim_envia(const uint8_t *dados, uint16_t n); // bytes no barramento, depois dos já enviados
+uint64_t sim_fim_envio(void); // ciclo em que o último byte enviado termina
+void sim_espera_silencio(uint64_t intervalo); // espera intervalo ciclos depois do último byte enviado
+uint16_t sim_crc16(const uint8_t *dados, uint16_t n);
+uint16_t sim_pacote(uint8_t *pacote, uint16_t n); // acrescenta o crc, retorna o novo tamanho
+
+// Envia um pedido (sem crc) e espera a resposta completa: esperado bytes, uma exceção, ou o silêncio
+// de 3,5 caracteres se esperado for 0. Retorna o número de bytes recebidos, com crc.
+uint16_t sim_transacao(const uint8_t *pedido, uint16_t n, uint8_t *resposta, uint16_t esperado, double timeout_ms);
+extern double sim_latencia_us; // do fim do pedido ao início da resposta na última transação, -1 sem resposta
+extern double sim_resposta_us; // do fim do pedido ao fim da resposta
+
+// Transação aleatória de outro escravo, para encher o barramento: o pedido e a resposta, com crc, de uma
+// das funções 1 a 6, 16 e 23, com 1 a 16 registradores e dados sorteados. Uma resposta em cada 8 é uma
+// exceção. semente é o estado do gerador, a mesma semente repete a mesma sequência.
+void sim_outro_escravo(uint8_t endereco, uint32_t *semente, uint8_t *pedido, uint16_t *n_pedido,
+	uint8_t *resposta, uint16_t *n_resposta);
+
+extern double sim_timeout_ms; // espera máxima pela resposta nas transações abaixo, padrão 150ms
+
+// Transações comuns, retornam 0 se a resposta for válida, o código da exceção ou -1 sem resposta válida
+int sim_le(uint8_t endereco, uint16_t registrador, uint16_t quantidade, uint16_t *valores);
+int sim_escreve(uint8_t endereco, uint16_t registrador, uint16_t valor); // endereço 0 é difusão
+int sim_escreve_varios(uint8_t endereco, uint16_t registrador, uint16_t quantidade, const uint16_t *valores);
+
+//-------------------------------------------------------------------------------------------------------
+// Medições do modelo
+
+enum SimVetor // na ordem de prioridade do ATmega8
+{
+	SIM_TIMER2_COMP,
+	SIM_TIMER1_COMPB,
+	SIM_TIMER1_OVF,
+	SIM_TIMER0_OVF,
+	SIM_USART_RXC,
+	SIM_USART_UDRE,
+	SIM_USART_TXC,
+	SIM_ADC,
+	SIM_NUM_VETORES
+};
+
+struct SimEstatistica
+{
+	uint32_t n;
+	uint64_t soma;
+	uint64_t min, max;
+};
+
+struct SimPerfil
+{
+	struct SimEstatistica ciclos;		// da entrada à saída, incluindo as interrupções aninhadas
+	struct SimEstatistica exclusivos;	// sem as interrupções aninhadas
+	struct SimEstatistica latencia;		// da flag até a entrada
+};
+extern struct SimPerfil sim_perfil[SIM_NUM_VETORES];
+extern const char *const sim_nome_vetor[SIM_NUM_VETORES];
+
+// Laço de controle, as conversões do canal 0 (corrente)
+struct SimControle
+{
+	struct SimEstatistica latencia;	// do fim da conversão até a entrada da interrupção do ADC
+	struct SimEstatistica periodo;	// entre as entradas da interrupção do ADC
+	struct SimEstatistica amostragem; // entre as retenções da amostra
+	struct SimEstatistica fase;		// contagem do Timer1 na retenção da amostra
+	uint64_t ultima, ultima_amostra;
+};
+extern struct SimControle sim_controle;
+
+extern struct SimEstatistica sim_processamento; // ciclos de cada ModBusProcess, incluindo interrupções
+extern uint8_t sim_aninhamento_max; // maior profundidade de interrupções aninhadas
+
+void sim_estatistica_soma(struct SimEstatistica *e, uint64_t valor);
+double sim_estatistica_media(const struct SimEstatistica *e);
+void sim_perfil_zera(void);
+void sim_perfil_imprime(FILE *saida);
+
+//-------------------------------------------------------------------------------------------------------
+// Roteiros
+
+// Executa o firmware com o roteiro como corrotina. O roteiro começa antes do reset, para configurar a
+// planta, as dip switches e a EEPROM. Retorna quando o roteiro termina, com 1 se alguma verificação falhou.
+int sim_executa(void (*roteiro)(void));
+void sim_espera(uint64_t ciclos);
+void sim_espera_byte(uint64_t ciclos); // espera no máximo ciclos, ou até chegar um byte do escravo
+#define sim_espera_us(us) sim_espera(SIM_US(us))
+#define sim_espera_ms(ms) sim_espera(SIM_MS(ms))
+
+extern unsigned sim_falhas;
+#define SIM_VERIFICA(condicao, ...) do { \
+	if (!(condicao)) { \
+		sim_falhas++; \
+		printf("FALHA %s:%d: %s: ", __FILE__, __LINE__, #condicao); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+	} \
+} while (0)
+
+// Tempo real: os bytes lidos de entrada entram no barramento quando chegam, e os transmitidos pelo
+// escravo são escritos em saida no fim de cada caractere, com o tempo simulado acompanhando o relógio.
+// Os lidos de outros (-1 sem) são pacotes inteiros de outros escravos, já terminados no barramento, que
+// entram em sequência rápida para não atrasar o pedido seguinte do mestre.
+void sim_tempo_real(int entrada, int saida, int outros);
+
+#endif
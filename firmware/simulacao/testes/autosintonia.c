@@ -0,0 +1,81 @@
+/*
+ *		Auto-sintonia do PI (registrador 218): com o setpoint em 500 termina concluída em algumas dezenas de
+ *		ms, com ganhos plausíveis nos registradores 215 e 216, sem tranco na corrente, e os ganhos gravados
+ *		na EEPROM. Com o setpoint abaixo de 100 ou o perfil em execução termina com falha.
+ */
+
+#include "simulador.h"
+
+extern uint16_t eeprom_pi_kp, eeprom_pi_ki;
+uint16_t eeprom_read_word(const uint16_t *endereco);
+
+// Inicia a auto-sintonia e espera o fim, retorna o estado final e a duração em ms
+static uint16_t sintoniza(double *duracao_ms)
+{
+	uint16_t estado = 1;
+	SIM_VERIFICA(sim_escreve(1, 218, 1) == 0, "início da auto-sintonia");
+	const uint64_t inicio = sim_ciclo;
+	while (estado == 1 && sim_ciclo - inicio < SIM_MS(3000)) {
+		sim_espera_ms(5);
+		SIM_VERIFICA(sim_le(1, 218, 1, &estado) == 0, "leitura do estado");
+	}
+	*duracao_ms = SIM_CICLOS_US(sim_ciclo - inicio)/1000;
+	return estado;
+}
+
+static void roteiro(void)
+{
+	uint16_t v[6], padrao[2];
+	double duracao;
+	sim_ruido_lsb = 2;
+	sim_espera_ms(50);
+	SIM_VERIFICA(sim_le(1, 215, 2, padrao) == 0, "ganhos padrão");
+
+	// setpoint baixo demais para oscilar em torno dele
+	SIM_VERIFICA(sim_escreve(1, 2, 50) == 0, "setpoint 50");
+	sim_espera_ms(300);
+	SIM_VERIFICA(sintoniza(&duracao) == 3, "auto-sintonia com o setpoint 50 não falhou");
+
+	SIM_VERIFICA(sim_escreve(1, 2, 500) == 0, "setpoint 500");
+	sim_espera_ms(300);
+	const uint16_t estado = sintoniza(&duracao);
+	SIM_VERIFICA(estado == 2, "auto-sintonia terminou com o estado %u", estado);
+	SIM_VERIFICA(duracao < 200, "auto-sintonia durou %.0fms", duracao);
+	SIM_VERIFICA(sim_le(1, 215, 6, v) == 0, "leitura dos ganhos e da oscilação");
+	// a planta dá Tu de 8 ou 9 períodos de controle e kp perto de 3000 (resultados/sintonia.txt)
+	SIM_VERIFICA(v[4] >= 4 && v[4] <= 20 && v[5] > 20 && v[5] < 100, "oscilação de %u períodos de controle e %u pico a pico",
+		v[4], v[5]);
+	SIM_VERIFICA(v[0] > padrao[0] && v[0] < 10000, "kp %u, o padrão é %u", v[0], padrao[0]);
+	SIM_VERIFICA(v[1] > padrao[1] && v[1] < v[0]/2, "ki %u com kp %u, o padrão é %u", v[1], v[0], padrao[1]);
+	const uint16_t kp = v[0], ki = v[1];
+
+	// o PI volta do valor do relé sem tranco, e os ganhos novos seguem o setpoint
+	double minimo = 1e9, maximo = 0;
+	for (int i = 0; i < 100; i++) {
+		sim_espera_ms(1);
+		if (sim_corrente() < minimo) minimo = sim_corrente();
+		if (sim_corrente() > maximo) maximo = sim_corrente();
+	}
+	SIM_VERIFICA(minimo > 480 && maximo < 520, "corrente entre %.1f e %.1f depois da auto-sintonia", minimo, maximo);
+	SIM_VERIFICA(sim_escreve(1, 2, 900) == 0, "setpoint 900");
+	sim_espera_ms(100);
+	SIM_VERIFICA(sim_corrente() > 882 && sim_corrente() < 918, "corrente na bobina %.1f", sim_corrente());
+
+	sim_espera_ms(2200);
+	SIM_VERIFICA(eeprom_read_word(&eeprom_pi_kp) == kp && eeprom_read_word(&eeprom_pi_ki) == ki, "EEPROM %u %u",
+		eeprom_read_word(&eeprom_pi_kp), eeprom_read_word(&eeprom_pi_ki));
+
+	// o perfil de setpoint impede a auto-sintonia
+	const uint16_t perfil[6] = {0, 2, 0, 500, 1000, 500}; // degraus, 2 pontos em 10s, tabela nos registradores 183 a 186
+	SIM_VERIFICA(sim_escreve_varios(1, 179, 2, perfil) == 0 && sim_escreve_varios(1, 183, 4, perfil + 2) == 0,
+		"tabela do perfil");
+	SIM_VERIFICA(sim_escreve(1, 178, 1) == 0, "início do perfil");
+	sim_espera_ms(300);
+	SIM_VERIFICA(sintoniza(&duracao) == 3, "auto-sintonia com o perfil em execução não falhou");
+	SIM_VERIFICA(sim_le(1, 215, 2, v) == 0 && v[0] == kp && v[1] == ki, "ganhos %u %u mudados pela falha", v[0], v[1]);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,41 @@
+/*
+ *		Leitura e escrita dos registradores pelas funções 3, 6, 16 e 23, e resposta ao degrau do setpoint.
+ */
+
+#include "simulador.h"
+
+static void roteiro(void)
+{
+	uint16_t v[8];
+	sim_espera_ms(50);
+
+	SIM_VERIFICA(sim_le(1, 0, 7, v) == 0, "leitura inicial");
+	SIM_VERIFICA(v[2] == 0 && v[1] < 20, "setpoint %u corrente %u", v[2], v[1]);
+	SIM_VERIFICA(sim_le(2, 0, 1, v) == -1, "outro endereço não responde");
+	SIM_VERIFICA(sim_le(1, 239, 2, v) == 2, "leitura além do último registrador: exceção 2");
+
+	// degrau de 0 a 4A
+	SIM_VERIFICA(sim_escreve(1, 2, 800) == 0, "setpoint");
+	sim_espera_ms(300);
+	SIM_VERIFICA(sim_le(1, 0, 7, v) == 0, "leitura depois do degrau");
+	SIM_VERIFICA(v[2] == 800, "setpoint lido %u", v[2]);
+	SIM_VERIFICA(v[1] > 784 && v[1] < 816, "corrente medida %u", v[1]);
+	SIM_VERIFICA(sim_corrente() > 784 && sim_corrente() < 816, "corrente na bobina %.1f", sim_corrente());
+
+	const uint16_t setpoints[1] = {400};
+	SIM_VERIFICA(sim_escreve_varios(1, 2, 1, setpoints) == 0, "função 16");
+	sim_espera_ms(300);
+	SIM_VERIFICA(sim_corrente() > 392 && sim_corrente() < 408, "corrente na bobina %.1f", sim_corrente());
+
+	// função 23: escreve o setpoint e lê os registradores 0 a 2 na mesma transação
+	const uint8_t pedido[] = {1, 23, 0, 0, 0, 3, 0, 2, 0, 1, 2, 0x01, 0x2C};
+	uint8_t resposta[16];
+	SIM_VERIFICA(sim_transacao(pedido, sizeof pedido, resposta, 11, 100) == 11, "resposta da função 23");
+	SIM_VERIFICA(resposta[1] == 23 && resposta[2] == 6 && (resposta[7] << 8 | resposta[8]) == 300, "setpoint lido %u",
+		resposta[7] << 8 | resposta[8]);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
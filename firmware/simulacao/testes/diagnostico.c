@@ -0,0 +1,49 @@
+/*
+ *		Função 8 (diagnóstico) e contadores dos registradores 233 a 239: eco, zeragem, e o contador de
+ *		exceções, que não conta os pedidos de difusão com erro porque eles não têm resposta.
+ */
+
+#include "simulador.h"
+
+#define EXCECOES	235
+#define SEM_RESPOSTA 237
+
+// Subfunção da função 8 com o dado indicado; retorna o dado da resposta, ou -1 sem resposta válida
+static int diagnostico(uint16_t subfuncao, uint16_t dado)
+{
+	uint8_t pedido[8] = {1, 8, subfuncao >> 8, subfuncao & 0xFF, dado >> 8, dado & 0xFF}, resposta[8];
+	const uint16_t n = sim_pacote(pedido, 6);
+	if (sim_transacao(pedido, n, resposta, 8, 100) != 8 || resposta[1] != 8) return -1;
+	return resposta[4] << 8 | resposta[5];
+}
+
+static void roteiro(void)
+{
+	uint16_t v[3];
+	sim_espera_ms(50);
+
+	SIM_VERIFICA(diagnostico(0, 0xA55A) == 0xA55A, "eco da subfunção 0");
+	SIM_VERIFICA(diagnostico(10, 0) == 0, "zeragem dos contadores");
+	SIM_VERIFICA(sim_le(1, EXCECOES, 3, v) == 0 && v[0] == 0 && v[2] == 0, "contadores %u e %u depois da zeragem",
+		v[0], v[2]);
+
+	SIM_VERIFICA(sim_escreve(1, 1000, 1) == 2, "escrita fora da tabela");
+	SIM_VERIFICA(sim_le(1, EXCECOES, 1, v) == 0 && v[0] == 1, "exceções %u depois da escrita fora da tabela", v[0]);
+
+	// difusão com erro: processada sem resposta, e a exceção não é enviada nem contada
+	SIM_VERIFICA(sim_escreve(0, 1000, 1) == 0, "difusão fora da tabela");
+	const uint16_t fora[2] = {1, 2};
+	SIM_VERIFICA(sim_escreve_varios(0, 1000, 2, fora) == 0, "difusão da função 16 fora da tabela");
+	sim_espera_ms(5);
+	SIM_VERIFICA(sim_le(1, EXCECOES, 3, v) == 0 && v[0] == 1 && v[2] == 2, "exceções %u e sem resposta %u depois "
+		"das difusões", v[0], v[2]);
+	SIM_VERIFICA(diagnostico(13, 0) == 1, "subfunção 13");
+	SIM_VERIFICA(diagnostico(15, 0) == 2, "subfunção 15");
+	SIM_VERIFICA(diagnostico(13, 1) == -1, "subfunção 13 com dado diferente de zero");
+	SIM_VERIFICA(diagnostico(13, 0) == 2, "subfunção 13 depois da exceção 3");
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,28 @@
+/*
+ *		Endereço das dip switches diferente do padrão da biblioteca: o escravo responde só no endereço das
+ *		chaves e mantém o setpoint entre as transações.
+ */
+
+#include "simulador.h"
+
+static void roteiro(void)
+{
+	uint16_t v[3];
+	sim_dip = 5;
+	sim_espera_ms(50);
+
+	SIM_VERIFICA(sim_escreve(5, 2, 600) == 0, "setpoint no endereço 5");
+	for (int i = 0; i < 20; i++) {
+		sim_espera_ms(10);
+		SIM_VERIFICA(sim_le(5, 0, 3, v) == 0, "leitura %d", i);
+		SIM_VERIFICA(v[2] == 600, "setpoint lido %u na leitura %d", v[2], i);
+	}
+	SIM_VERIFICA(sim_le(1, 0, 1, v) == -1, "o endereço padrão da biblioteca não responde");
+	sim_espera_ms(100);
+	SIM_VERIFICA(sim_corrente() > 588 && sim_corrente() < 612, "corrente na bobina %.1f", sim_corrente());
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,48 @@
+/*
+ *		Faixas de endereço e quantidade das funções 3, 16 e 23: quantidade 0, quantidade diferente do número
+ *		de bytes e intervalos que passam do último registrador ou do fim do espaço de 16 bits.
+ */
+
+#include "simulador.h"
+
+// Envia um pedido sem crc e retorna o código da exceção, 0 para uma resposta normal ou -1 sem resposta
+static int pedido(const uint8_t *dados, uint16_t n)
+{
+	uint8_t resposta[256];
+	const uint16_t recebidos = sim_transacao(dados, n, resposta, 0, sim_timeout_ms);
+	if (recebidos < 5 || sim_crc16(resposta, recebidos) != 0) return -1;
+	return (resposta[1] & 0x80) ? resposta[2] : 0;
+}
+
+static void roteiro(void)
+{
+	uint16_t v[2];
+	sim_espera_ms(50);
+
+	SIM_VERIFICA(sim_le(1, 0, 0, v) == 3, "função 3 com quantidade 0: exceção 3");
+	SIM_VERIFICA(sim_le(1, 239, 1, v) == 0, "função 3 no último registrador");
+	SIM_VERIFICA(sim_le(1, 239, 2, v) == 2, "função 3 além do último registrador: exceção 2");
+	SIM_VERIFICA(sim_le(1, 0xFFFF, 2, v) == 2, "função 3 passando de 0xFFFF: exceção 2");
+
+	const uint8_t f16_zero[] = {1, 16, 0, 2, 0, 0, 0};
+	SIM_VERIFICA(pedido(f16_zero, sizeof f16_zero) == 3, "função 16 com quantidade 0: exceção 3");
+	const uint8_t f16_bytes[] = {1, 16, 0, 2, 0, 2, 2, 0, 100};
+	SIM_VERIFICA(pedido(f16_bytes, sizeof f16_bytes) == 3, "função 16 com 2 registradores e 2 bytes: exceção 3");
+	const uint8_t f16_fim[] = {1, 16, 0xFF, 0xFF, 0, 2, 4, 0, 1, 0, 2};
+	SIM_VERIFICA(pedido(f16_fim, sizeof f16_fim) == 2, "função 16 passando de 0xFFFF: exceção 2");
+	SIM_VERIFICA(sim_escreve_varios(1, 239, 1, v) == 0, "função 16 no último registrador");
+
+	const uint8_t f23_leitura[] = {1, 23, 0, 0, 0, 0, 0, 2, 0, 1, 2, 0, 100};
+	SIM_VERIFICA(pedido(f23_leitura, sizeof f23_leitura) == 3, "função 23 lendo 0 registradores: exceção 3");
+	const uint8_t f23_escrita[] = {1, 23, 0, 0, 0, 1, 0, 2, 0, 0, 0};
+	SIM_VERIFICA(pedido(f23_escrita, sizeof f23_escrita) == 3, "função 23 gravando 0 registradores: exceção 3");
+	const uint8_t f23_fim[] = {1, 23, 0, 0, 0, 1, 0xFF, 0xFF, 0, 2, 4, 0, 1, 0, 2};
+	SIM_VERIFICA(pedido(f23_fim, sizeof f23_fim) == 2, "função 23 gravando além de 0xFFFF: exceção 2");
+
+	SIM_VERIFICA(sim_le(1, 2, 1, v) == 0 && v[0] == 0, "nenhum pedido inválido alterou o setpoint: %u", v[0]);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,42 @@
+/*
+ *		Ganhos do PI escritos pelo mestre: valem na hora e são gravados na EEPROM uma vez só, 2s depois da
+ *		última mudança, fora do processamento dos pacotes. 65535 é o valor da EEPROM apagada e é limitado.
+ */
+
+#include "simulador.h"
+
+extern uint16_t eeprom_pi_kp, eeprom_pi_ki, eeprom_pi_kff;
+uint16_t eeprom_read_word(const uint16_t *endereco);
+
+static void roteiro(void)
+{
+	uint16_t v[3];
+	sim_espera_ms(50);
+	const uint32_t gravacoes = sim_eeprom_gravacoes;
+
+	// uma sequência de ajustes, como numa sintonia manual: nenhum pacote espera a EEPROM
+	for (uint16_t kp = 200; kp < 220; kp++) {
+		SIM_VERIFICA(sim_escreve(1, 215, kp) == 0, "escrita do kp %u", kp);
+		SIM_VERIFICA(sim_resposta_us < 10000, "resposta em %.0fus com o kp %u", sim_resposta_us, kp);
+		sim_espera_ms(100);
+	}
+	const uint16_t ganhos[3] = {300, 20, 65535};
+	SIM_VERIFICA(sim_escreve_varios(1, 215, 3, ganhos) == 0, "escrita dos três ganhos");
+	SIM_VERIFICA(sim_le(1, 215, 3, v) == 0 && v[0] == 300 && v[1] == 20 && v[2] == 65534,
+		"ganhos %u %u %u, o kff limitado a 65534", v[0], v[1], v[2]);
+	sim_espera_ms(1900);
+	SIM_VERIFICA(sim_eeprom_gravacoes == gravacoes, "%u bytes gravados antes de 2s sem mudanças",
+		sim_eeprom_gravacoes - gravacoes);
+
+	sim_espera_ms(200);
+	SIM_VERIFICA(eeprom_read_word(&eeprom_pi_kp) == 300 && eeprom_read_word(&eeprom_pi_ki) == 20
+		&& eeprom_read_word(&eeprom_pi_kff) == 65534, "EEPROM %u %u %u", eeprom_read_word(&eeprom_pi_kp),
+		eeprom_read_word(&eeprom_pi_ki), eeprom_read_word(&eeprom_pi_kff));
+	SIM_VERIFICA(sim_eeprom_gravacoes - gravacoes <= 6, "%u bytes gravados para três ganhos",
+		sim_eeprom_gravacoes - gravacoes);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,65 @@
+/*
+ *		Orçamento de ciclos das interrupções a 250000bps, com leituras e escritas longas: falha se uma
+ *		alteração do firmware passar dos limites abaixo, que têm cerca de 25% de folga sobre a versão atual.
+ *		O perfil completo está em desempenho/perfil.c.
+ */
+
+#include "simulador.h"
+
+// ciclos exclusivos máximos de cada rotina, sem as interrupções aninhadas
+#define MAX_ADC			520
+#define MAX_RXC			380
+#define MAX_UDRE		200
+#define MAX_TXC			160
+#define MAX_TIMER2		220
+#define MAX_PROCESSA	7200	// ModBusProcess, incluindo as interrupções
+// a latência do disparo do ADC deve ficar abaixo de um ciclo do ADC (/128) para a fase da amostra não variar
+#define MAX_LATENCIA_COMPB	128
+// a recepção precisa ser atendida antes do fim do caractere seguinte (640 ciclos a 250000bps)
+#define MAX_LATENCIA_RXC	600
+
+static void verifica(enum SimVetor v, uint64_t maximo)
+{
+	SIM_VERIFICA(sim_perfil[v].exclusivos.max <= maximo, "%s: %llu ciclos, limite %llu", sim_nome_vetor[v],
+		(unsigned long long)sim_perfil[v].exclusivos.max, (unsigned long long)maximo);
+}
+
+static void roteiro(void)
+{
+	uint16_t v[48] = {0};
+	sim_espera_ms(50);
+	sim_escreve(1, 4, 5);
+	sim_linha.taxa = 250000;
+	sim_espera_ms(5);
+
+	sim_perfil_zera();
+	unsigned falhas = 0;
+	for (int i = 0; i < 300; i++) {
+		switch (i % 4) {
+			case 0: falhas += sim_escreve(1, 2, (i/4 & 1) ? 200 : 1000) != 0; break;
+			case 1: falhas += sim_le(1, 0, 26, v) != 0; break;
+			case 2: falhas += sim_le(1, 32, 48, v) != 0; break;
+			case 3: falhas += sim_escreve_varios(1, 183, 32, v) != 0; break;
+		}
+	}
+	SIM_VERIFICA(falhas == 0, "%u pedidos sem resposta", falhas);
+
+	verifica(SIM_ADC, MAX_ADC);
+	verifica(SIM_USART_RXC, MAX_RXC);
+	verifica(SIM_USART_UDRE, MAX_UDRE);
+	verifica(SIM_USART_TXC, MAX_TXC);
+	verifica(SIM_TIMER2_COMP, MAX_TIMER2);
+	SIM_VERIFICA(sim_processamento.max <= MAX_PROCESSA, "ModBusProcess: %llu ciclos, limite %u",
+		(unsigned long long)sim_processamento.max, MAX_PROCESSA);
+	SIM_VERIFICA(sim_perfil[SIM_TIMER1_COMPB].latencia.max < MAX_LATENCIA_COMPB, "latência do disparo do ADC: %llu ciclos",
+		(unsigned long long)sim_perfil[SIM_TIMER1_COMPB].latencia.max);
+	SIM_VERIFICA(sim_perfil[SIM_USART_RXC].latencia.max < MAX_LATENCIA_RXC, "latência da recepção: %llu ciclos",
+		(unsigned long long)sim_perfil[SIM_USART_RXC].latencia.max);
+	SIM_VERIFICA(sim_controle.amostragem.max - sim_controle.amostragem.min <= SIM_US(8),
+		"jitter da amostragem: %.2fus", SIM_CICLOS_US(sim_controle.amostragem.max - sim_controle.amostragem.min));
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,114 @@
+/*
+ *		Perfil de setpoint (registradores 178 a 214): degraus e rampas entre os pontos, repetição depois do
+ *		último ponto, o setpoint do último ponto mantido no fim, e a tabela escrita durante a execução, que só
+ *		vale a partir do próximo início.
+ */
+
+#include <stdlib.h>
+#include "simulador.h"
+
+extern volatile uint16_t setpoint;
+
+// Escreve o modo, os pontos e a tabela e inicia o perfil, retorna o ciclo do fim da resposta
+static uint64_t inicia(uint16_t modo, uint16_t pontos, const uint16_t *tabela)
+{
+	const uint16_t configuracao[2] = {modo, pontos};
+	SIM_VERIFICA(sim_escreve_varios(1, 179, 2, configuracao) == 0, "modo e número de pontos");
+	SIM_VERIFICA(sim_escreve_varios(1, 183, 2*pontos, tabela) == 0, "tabela com %u pontos", pontos);
+	SIM_VERIFICA(sim_escreve(1, 178, 1) == 0, "início do perfil");
+	return sim_ciclo;
+}
+
+static void espera_ate(uint64_t inicio, double ms)
+{
+	if (inicio + SIM_MS(ms) > sim_ciclo) sim_espera(inicio + SIM_MS(ms) - sim_ciclo);
+}
+
+// Setpoint gerado pelo perfil ms depois do início, com tolerância para a transação que iniciou o perfil
+static void confere(uint64_t inicio, double ms, int esperado, int tolerancia, const char *trecho)
+{
+	espera_ate(inicio, ms);
+	SIM_VERIFICA(abs((int)setpoint - esperado) <= tolerancia, "%s: setpoint %u em %.0fms, esperado %d",
+		trecho, setpoint, ms, esperado);
+}
+
+// Perfil terminado: registrador 178 lido como 0 e o setpoint do último ponto copiado para o registrador 2
+static void confere_fim(uint16_t esperado, const char *trecho)
+{
+	uint16_t v[1];
+	SIM_VERIFICA(sim_le(1, 178, 1, v) == 0 && v[0] == 0, "%s: registrador 178 lido como %u no fim", trecho, v[0]);
+	SIM_VERIFICA(sim_le(1, 2, 1, v) == 0 && v[0] == esperado, "%s: registrador 2 lido como %u no fim, esperado %u",
+		trecho, v[0], esperado);
+	SIM_VERIFICA(setpoint == esperado, "%s: setpoint %u no fim, esperado %u", trecho, setpoint, esperado);
+}
+
+static void roteiro(void)
+{
+	uint16_t v[5];
+	sim_espera_ms(50);
+
+	// degraus: o setpoint fica constante até o ponto seguinte
+	const uint16_t degraus[6] = {0, 200, 30, 600, 60, 100};
+	uint64_t inicio = inicia(0, 3, degraus);
+	confere(inicio, 150, 200, 0, "degraus");
+	confere(inicio, 450, 600, 0, "degraus");
+	SIM_VERIFICA(sim_le(1, 178, 5, v) == 0 && v[0] == 1 && v[3] == 1 && v[4] >= 45 && v[4] <= 50,
+		"degraus: execução %u, trecho %u e tempo %u em 450ms", v[0], v[3], v[4]);
+	espera_ate(inicio, 700);
+	confere_fim(100, "degraus");
+
+	// rampas: 10 por tick de 10ms subindo e 12 por tick descendo, e o valor exato da tabela em cada ponto
+	const uint16_t rampas[6] = {0, 0, 100, 1000, 150, 400};
+	inicio = inicia(1, 3, rampas);
+	confere(inicio, 250, 250, 15, "rampas");
+	confere(inicio, 750, 750, 15, "rampas");
+	confere(inicio, 1250, 700, 15, "rampas");
+	espera_ate(inicio, 1600);
+	confere_fim(400, "rampas");
+
+	// repetição em degraus: 100 nos primeiros 200ms e 300 nos 200ms seguintes, com período de 400ms
+	const uint16_t repeticao[6] = {0, 100, 20, 300, 40, 300};
+	inicio = inicia(2, 3, repeticao);
+	for (int ciclo = 0; ciclo < 5; ciclo++) {
+		confere(inicio, 400*ciclo + 100, 100, 0, "repetição");
+		confere(inicio, 400*ciclo + 300, 300, 0, "repetição");
+	}
+	SIM_VERIFICA(sim_le(1, 178, 5, v) == 0 && v[0] == 1 && v[4] < 40,
+		"repetição: execução %u e tempo %u depois de 5 períodos", v[0], v[4]);
+	SIM_VERIFICA(sim_escreve(1, 178, 0) == 0, "parada da repetição");
+
+	// repetição em rampa: dente de serra de 0 a 200 em 200ms
+	const uint16_t serra[4] = {0, 0, 20, 200};
+	inicio = inicia(3, 2, serra);
+	for (int ciclo = 0; ciclo < 3; ciclo++) {
+		confere(inicio, 200*ciclo + 100, 100, 10, "dente de serra");
+	}
+	SIM_VERIFICA(sim_escreve(1, 178, 0) == 0, "parada do dente de serra");
+	SIM_VERIFICA(sim_le(1, 178, 1, v) == 0 && v[0] == 0, "registrador 178 lido como %u depois da parada", v[0]);
+
+	// a tabela, o modo e o número de pontos escritos durante a execução não mudam o perfil em andamento
+	const uint16_t subida[4] = {0, 0, 100, 1000};
+	const uint16_t outra[6] = {0, 1000, 10, 0, 20, 500};
+	const uint16_t outra_configuracao[2] = {0, 3};
+	inicio = inicia(1, 2, subida);
+	espera_ate(inicio, 300);
+	SIM_VERIFICA(sim_escreve_varios(1, 183, 6, outra) == 0, "tabela durante a execução");
+	SIM_VERIFICA(sim_escreve_varios(1, 179, 2, outra_configuracao) == 0, "modo durante a execução");
+	confere(inicio, 500, 500, 15, "tabela durante a execução");
+	confere(inicio, 900, 900, 15, "tabela durante a execução");
+	espera_ate(inicio, 1100);
+	confere_fim(1000, "tabela durante a execução");
+
+	// e valem no próximo início
+	SIM_VERIFICA(sim_escreve(1, 178, 1) == 0, "início com a nova tabela");
+	inicio = sim_ciclo;
+	confere(inicio, 50, 1000, 0, "nova tabela");
+	confere(inicio, 150, 0, 0, "nova tabela");
+	espera_ate(inicio, 300);
+	confere_fim(500, "nova tabela");
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,62 @@
+/*
+ *		Setpoint preparado (registrador 176) aplicado pela escrita do registrador 177, também por difusão:
+ *		a escrita do 176 arma a aplicação e a do 177 a consome, interrompendo o perfil de setpoint em execução.
+ */
+
+#include "simulador.h"
+
+static void roteiro(void)
+{
+	uint16_t v[1];
+	sim_espera_ms(50);
+
+	SIM_VERIFICA(sim_escreve(1, 177, 1) == 0, "aplicação sem setpoint preparado");
+	SIM_VERIFICA(sim_le(1, 2, 1, v) == 0 && v[0] == 0, "setpoint %u sem setpoint preparado", v[0]);
+
+	SIM_VERIFICA(sim_escreve(1, 176, 500) == 0, "setpoint preparado");
+	SIM_VERIFICA(sim_le(1, 2, 1, v) == 0 && v[0] == 0, "setpoint %u antes da aplicação", v[0]);
+	SIM_VERIFICA(sim_escreve(0, 177, 1) == 0, "aplicação por difusão");
+	SIM_VERIFICA(sim_le(1, 2, 1, v) == 0 && v[0] == 500, "setpoint %u depois da aplicação", v[0]);
+	SIM_VERIFICA(sim_le(1, 177, 1, v) == 0 && v[0] == 0, "registrador 177 lido como %u", v[0]);
+
+	// o lote seguinte não chegou a este nó: a aplicação não volta ao valor preparado do lote anterior
+	SIM_VERIFICA(sim_escreve(1, 2, 300) == 0, "setpoint direto");
+	SIM_VERIFICA(sim_escreve(0, 177, 1) == 0, "aplicação sem preparar");
+	SIM_VERIFICA(sim_le(1, 2, 1, v) == 0 && v[0] == 300, "setpoint %u depois da aplicação desarmada", v[0]);
+
+	// o mesmo valor escrito de novo arma a aplicação
+	SIM_VERIFICA(sim_escreve(1, 176, 500) == 0, "setpoint preparado repetido");
+	SIM_VERIFICA(sim_escreve(0, 177, 1) == 0, "aplicação do valor repetido");
+	SIM_VERIFICA(sim_le(1, 2, 1, v) == 0 && v[0] == 500, "setpoint %u depois do valor repetido", v[0]);
+
+	// preparar e aplicar no mesmo pedido da função 16
+	const uint16_t lote[2] = {700, 1};
+	SIM_VERIFICA(sim_escreve_varios(1, 176, 2, lote) == 0, "preparar e aplicar juntos");
+	SIM_VERIFICA(sim_le(1, 2, 1, v) == 0 && v[0] == 700, "setpoint %u preparado e aplicado juntos", v[0]);
+	sim_espera_ms(300);
+	SIM_VERIFICA(sim_corrente() > 686 && sim_corrente() < 714, "corrente na bobina %.1f", sim_corrente());
+
+	// perfil em rampa de 0 a 1000 em 1s: a aplicação sem preparar não o interrompe
+	const uint16_t perfil[6] = {1, 2, 0, 0, 100, 1000}; // modo rampa, 2 pontos, tabela nos registradores 183 a 186
+	SIM_VERIFICA(sim_escreve_varios(1, 179, 2, perfil) == 0 && sim_escreve_varios(1, 183, 4, perfil + 2) == 0,
+		"tabela do perfil");
+	SIM_VERIFICA(sim_escreve(1, 178, 1) == 0, "início do perfil");
+	sim_espera_ms(200);
+	SIM_VERIFICA(sim_escreve(0, 177, 1) == 0, "aplicação sem preparar durante o perfil");
+	sim_espera_ms(100);
+	SIM_VERIFICA(sim_le(1, 178, 1, v) == 0 && v[0] == 1, "perfil parado pela aplicação desarmada");
+	SIM_VERIFICA(sim_le(1, 2, 1, v) == 0 && v[0] > 250 && v[0] < 400, "setpoint %u do perfil em 300ms", v[0]);
+
+	// a aplicação do setpoint preparado interrompe o perfil, e o valor aplicado é mantido
+	SIM_VERIFICA(sim_escreve(1, 176, 150) == 0, "setpoint preparado durante o perfil");
+	SIM_VERIFICA(sim_escreve(0, 177, 1) == 0, "aplicação durante o perfil");
+	SIM_VERIFICA(sim_le(1, 178, 1, v) == 0 && v[0] == 0, "perfil em execução depois da aplicação");
+	sim_espera_ms(300);
+	SIM_VERIFICA(sim_le(1, 2, 1, v) == 0 && v[0] == 150, "setpoint %u 300ms depois da aplicação", v[0]);
+	SIM_VERIFICA(sim_corrente() > 140 && sim_corrente() < 160, "corrente na bobina %.1f", sim_corrente());
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
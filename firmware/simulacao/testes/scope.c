@@ -0,0 +1,78 @@
+/*
+ *		Captura do scope disparada por um degrau do setpoint, e leitura e escrita dos registradores 32 a 175,
+ *		que ficam compactados fora de data_reg: as escritas são descartadas e os pedidos que cruzam os limites
+ *		do buffer leem e gravam os registradores vizinhos nos lugares certos.
+ */
+
+#include "simulador.h"
+
+#define AMOSTRAS 48
+#define PRE_DISPARO 12
+
+static void roteiro(void)
+{
+	uint16_t v[64], buffer[3*AMOSTRAS];
+	sim_espera_ms(50);
+
+	const uint16_t configuracao[5] = {1, 0, 0, 1, PRE_DISPARO}; // arma, disparo pelo setpoint, dizimação 1
+	SIM_VERIFICA(sim_escreve_varios(1, 26, 5, configuracao) == 0, "configuração da captura");
+	sim_espera_ms(20);
+	SIM_VERIFICA(sim_escreve(1, 2, 600) == 0, "degrau do setpoint");
+	sim_espera_ms(50);
+	SIM_VERIFICA(sim_le(1, 26, 6, v) == 0 && v[0] == 4, "estado da captura %u", v[0]);
+	const uint16_t inicio = v[5];
+	for (int i = 0; i < 3; i++) {
+		SIM_VERIFICA(sim_le(1, 32 + 48*i, 48, &buffer[48*i]) == 0, "leitura %d do buffer", i);
+	}
+
+	uint16_t anterior = 0;
+	for (int n = 0; n < AMOSTRAS; n++) {
+		const uint16_t *amostra = &buffer[3*((inicio + n) % AMOSTRAS)];
+		const uint16_t esperado = n < PRE_DISPARO ? 0 : 600;
+		SIM_VERIFICA(amostra[1] == esperado, "amostra %d: setpoint %u", n, amostra[1]);
+		SIM_VERIFICA(amostra[2] <= 181, "amostra %d: OCR1A %u", n, amostra[2]);
+		SIM_VERIFICA(amostra[0] + 20 >= anterior, "amostra %d: corrente %u depois de %u", n, amostra[0], anterior);
+		anterior = amostra[0];
+	}
+	SIM_VERIFICA(anterior > 300 && anterior < 600, "corrente %u no fim da captura", anterior);
+
+	// escritas no buffer são aceitas e descartadas
+	SIM_VERIFICA(sim_escreve(1, 100, 1234) == 0, "função 6 no buffer");
+	SIM_VERIFICA(sim_le(1, 100, 1, v) == 0 && v[0] == buffer[100 - 32], "registrador 100 lido como %u", v[0]);
+
+	// função 16 cruzando o fim do buffer: 174 e 175 descartados, 176 é o setpoint preparado
+	const uint16_t fim[3] = {1111, 2222, 700};
+	SIM_VERIFICA(sim_escreve_varios(1, 174, 3, fim) == 0, "função 16 cruzando o fim do buffer");
+	SIM_VERIFICA(sim_le(1, 170, 10, v) == 0, "leitura cruzando o fim do buffer");
+	for (int i = 0; i < 6; i++) {
+		SIM_VERIFICA(v[i] == buffer[170 - 32 + i], "registrador %d lido como %u", 170 + i, v[i]);
+	}
+	SIM_VERIFICA(v[6] == 700, "setpoint preparado %u", v[6]);
+
+	// função 16 cruzando o início do buffer: 28 a 30 gravados, 32 e 33 descartados
+	const uint16_t comeco[6] = {500, 3, 5, 0, 4321, 4321};
+	SIM_VERIFICA(sim_escreve_varios(1, 28, 6, comeco) == 0, "função 16 cruzando o início do buffer");
+	SIM_VERIFICA(sim_le(1, 26, 10, v) == 0, "leitura cruzando o início do buffer");
+	SIM_VERIFICA(v[2] == 500 && v[3] == 3 && v[4] == 5, "configuração %u %u %u", v[2], v[3], v[4]);
+	for (int i = 6; i < 10; i++) {
+		SIM_VERIFICA(v[i] == buffer[i - 6], "registrador %d lido como %u", 26 + i, v[i]);
+	}
+
+	// leitura de 64 registradores só do buffer
+	SIM_VERIFICA(sim_le(1, 40, 64, v) == 0, "leitura de 64 registradores do buffer");
+	for (int i = 0; i < 64; i++) {
+		SIM_VERIFICA(v[i] == buffer[40 - 32 + i], "registrador %d lido como %u", 40 + i, v[i]);
+	}
+
+	// função 23 gravando 175 (descartado) e 176, e lendo 175 e 176
+	const uint8_t pedido[] = {1, 23, 0, 175, 0, 2, 0, 175, 0, 2, 4, 0x12, 0x34, 0x02, 0x8A};
+	uint8_t resposta[16];
+	SIM_VERIFICA(sim_transacao(pedido, sizeof pedido, resposta, 9, 100) == 9, "resposta da função 23");
+	SIM_VERIFICA((resposta[3] << 8 | resposta[4]) == buffer[175 - 32] && (resposta[5] << 8 | resposta[6]) == 650,
+		"registradores 175 e 176 lidos como %u e %u", resposta[3] << 8 | resposta[4], resposta[5] << 8 | resposta[6]);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,37 @@
+/*
+ *		Taxa de transmissão: índice inválido na EEPROM, escrita de índices inválidos no registrador 4 e
+ *		respostas completas a 250000bps, a maior taxa aceita.
+ */
+
+#include "simulador.h"
+
+extern uint8_t eeprom_baud_rate;
+
+static void roteiro(void)
+{
+	uint16_t v[1];
+	const uint8_t taxa_antiga = 7; // 1000000bps, gravada por versões anteriores
+	sim_eeprom_escreve(&eeprom_baud_rate, &taxa_antiga, 1);
+	sim_espera_ms(50);
+
+	SIM_VERIFICA(sim_le(1, 4, 1, v) == 0 && v[0] == 1, "índice inválido na EEPROM volta para 19200bps: %u", v[0]);
+	sim_escreve(1, 4, 6);
+	sim_espera_ms(5);
+	SIM_VERIFICA(sim_le(1, 4, 1, v) == 0 && v[0] == 1, "índice 6 ignorado: %u", v[0]);
+
+	sim_escreve(1, 4, 5);
+	sim_linha.taxa = 250000;
+	sim_espera_ms(5);
+	unsigned falhas = 0;
+	for (int i = 0; i < 200; i++) {
+		uint16_t medidas[3];
+		if (sim_le(1, 0, 3, medidas) != 0) falhas++;
+	}
+	SIM_VERIFICA(falhas == 0, "%u leituras falharam a 250000bps", falhas);
+	SIM_VERIFICA(sim_bytes_sem_driver == 0, "%u bytes transmitidos com o driver desligado", sim_bytes_sem_driver);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,45 @@
+/*
+ *		Barramento com outros 14 escravos: pedidos e respostas aleatórios para os endereços 2 a 15, com um
+ *		pedido para este escravo a cada quatro transações. Os pacotes dos outros escravos são ignorados pelo
+ *		tamanho e pelo crc, e o pedido seguinte é respondido mesmo sem o intervalo de 3,5 caracteres.
+ */
+
+#include "simulador.h"
+
+#define TRANSACOES 400
+
+static void roteiro(void)
+{
+	static const double intervalos[] = {3.5, 2, 1, 0}; // caracteres entre os pacotes
+	uint32_t semente = 1;
+	uint8_t pedido[260], resposta[260];
+	uint16_t n_pedido, n_resposta, v[3];
+	sim_timeout_ms = 20;
+	sim_espera_ms(50);
+
+	for (unsigned i = 0; i < sizeof intervalos/sizeof intervalos[0]; i++) {
+		const uint64_t intervalo = (uint64_t)(intervalos[i]*sim_tempo_caractere());
+		unsigned perdidos = 0;
+		for (unsigned t = 0; t < TRANSACOES; t++) {
+			if (t%4 == 3) {
+				sim_espera_silencio(intervalo);
+				if (sim_le(1, 0, 3, v) != 0) perdidos++;
+				continue;
+			}
+			sim_outro_escravo(2 + t%14, &semente, pedido, &n_pedido, resposta, &n_resposta);
+			sim_espera_silencio(intervalo);
+			sim_envia(pedido, n_pedido);
+			sim_espera_silencio(intervalo);
+			sim_envia(resposta, n_resposta);
+		}
+		SIM_VERIFICA(perdidos == 0, "%u de %u pedidos sem resposta com %.1f caracteres entre os pacotes",
+			perdidos, TRANSACOES/4, intervalos[i]);
+		sim_espera_ms(10);
+	}
+	SIM_VERIFICA(sim_bytes_sem_driver == 0, "%u bytes transmitidos com o driver desligado", sim_bytes_sem_driver);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
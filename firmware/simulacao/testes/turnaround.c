@@ -0,0 +1,45 @@
+/*
+ *		Resposta depois do fim do intervalo entre pacotes: com o laço principal ocupado gravando os ganhos na
+ *		EEPROM, o pedido só é processado depois que o timer da ModBus parou. Um byte perdido no barramento
+ *		nesse meio tempo não pode impedir a resposta.
+ */
+
+#include "simulador.h"
+
+static void roteiro(void)
+{
+	uint16_t v[3];
+	sim_timeout_ms = 200;
+	sim_espera_ms(50);
+	SIM_VERIFICA(sim_le(1, 215, 3, v) == 0, "leitura dos ganhos");
+
+	// ganhos novos: a gravação na EEPROM começa 2s depois, e o laço principal fica ocupado por alguns ms
+	const uint16_t ganhos[3] = {v[0] + 1, v[1] + 1, v[2] + 1};
+	SIM_VERIFICA(sim_escreve_varios(1, 215, 3, ganhos) == 0, "escrita dos ganhos");
+	const uint32_t gravacoes = sim_eeprom_gravacoes;
+	const uint64_t escrita = sim_ciclo;
+	while (sim_eeprom_gravacoes == gravacoes && sim_ciclo - escrita < SIM_MS(3000)) sim_espera_us(100);
+	SIM_VERIFICA(SIM_CICLOS_US(sim_ciclo - escrita) > 1990e3, "gravação %.0fms depois da escrita",
+		SIM_CICLOS_US(sim_ciclo - escrita)/1000);
+
+	// leitura durante a gravação, seguida de um byte perdido depois do fim do intervalo entre pacotes
+	uint8_t pedido[8] = {1, 3, 0, 2, 0, 1};
+	sim_num_recebidos = 0;
+	sim_envia(pedido, sim_pacote(pedido, 6));
+	sim_espera(sim_fim_envio() - sim_ciclo + SIM_MS(5));
+	const uint8_t perdido = 0xFF;
+	sim_envia(&perdido, 1);
+	sim_espera_ms(150);
+	SIM_VERIFICA(sim_eeprom_gravacoes - gravacoes >= 3, "%u bytes gravados, o laço principal ficou ocupado durante a leitura",
+		sim_eeprom_gravacoes - gravacoes);
+	SIM_VERIFICA(sim_num_recebidos == 7, "resposta com %u bytes", sim_num_recebidos);
+
+	// e o escravo continua respondendo
+	SIM_VERIFICA(sim_le(1, 215, 3, v) == 0, "leitura seguinte");
+	SIM_VERIFICA(v[0] == ganhos[0] && v[1] == ganhos[1] && v[2] == ganhos[2], "ganhos %u %u %u", v[0], v[1], v[2]);
+}
+
+int main(void)
+{
+	return sim_executa(roteiro);
+}
@@ -0,0 +1,17 @@
+/*
+ *		util/delay.h da simulação no host
+ *
+ *		Os atrasos contam só os ciclos do código que chamou, as interrupções atendidas durante o atraso
+ *		o prolongam como no hardware.
+ */
+
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+#include <stdint.h>
+
+void sim_atraso(uint64_t ciclos);
+#define _delay_us(us) sim_atraso((uint64_t)((us)*(F_CPU/1000000.0)))
+#define _delay_ms(ms) sim_atraso((uint64_t)((ms)*(F_CPU/1000.0)))
+
+#endif
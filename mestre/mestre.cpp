@@ -0,0 +1,866 @@
+/*
+ *		mestre.cpp
+ *
+ *		Mestre Modbus RTU para Linux que trata um segmento RS-485 de controladores de corrente (endereços 1 a 15
+ *		nas dip switches) como uma unidade:
+ *
+ *		- os pedidos são enviados um atrás do outro, e cada resposta é dada como completa pelo tamanho esperado,
+ *		  sem esperar o silêncio do fim do pacote. Há sempre um só pedido pendente, como o RTU exige: o pedido
+ *		  seguinte só sai depois da resposta, ou do timeout, do anterior;
+ *		- os registradores lidos são agrupados em faixas, lendo juntos os que estão próximos;
+ *		- os setpoints recebidos pela entrada padrão são gravados em lote: cada controlador recebe o seu setpoint
+ *		  preparado na mesma transação da leitura (função 23), e um único pedido de difusão aplica todos juntos.
+ *		  Os controladores sem setpoint novo são preparados com o setpoint em uso;
+ *		- com a opção -m, cada controlador é consultado só pelos registradores de mudança, e os demais são lidos
+ *		  quando a sequência de mudanças avança;
+ *		- as leituras são gravadas num arquivo binário mapeado em memória, onde os registros só são acrescentados.
+ *
+ *		Compilação: g++ -std=c++17 -O2 -Wall -o mestre mestre.cpp
+ *
+ *		Uso e formato do arquivo no README.md desta pasta.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/serial.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Registradores do controlador usados pelo mestre
+constexpr uint16_t REG_SETPOINT = 2;
+constexpr uint16_t REG_SETPOINT_STAGED = 176;
+constexpr uint16_t REG_SETPOINT_COMMIT = 177;
+constexpr uint16_t REG_CHANGE_SEQUENCE = 229; // seguido de REG_CHANGE_FLAGS
+constexpr uint16_t REG_CHANGE_CLEAR = 231;
+constexpr uint16_t NUM_REGISTRADORES = 240; // num_reg_words_modbus do firmware
+constexpr uint16_t MAX_REGISTROS = 64; // ModBusMaxRegistros do firmware
+constexpr uint16_t SETPOINT_MAX = 1000;
+constexpr int ENDERECO_MAX = 15;
+constexpr uint8_t ENDERECO_DIFUSAO = 0;
+constexpr uint32_t TAXAS[] = {9600, 19200, 38400, 57600, 115200, 250000}; // ModBusTaxas do firmware, registrador 4
+
+// Uma transação a mais custa o pedido (8 bytes), a resposta sem dados (5 bytes) e dois intervalos t3,5, cerca
+// de 20 caracteres, e cada registrador lido a mais custa 2. Faixas separadas por até 10 registradores são
+// lidas juntas.
+constexpr uint16_t LACUNA_MAX = 10;
+
+// Depois de um pedido de difusão os controladores ficam processando e descartam o que receberem
+constexpr int64_t ATRASO_DIFUSAO_US = 2000;
+
+static volatile sig_atomic_t parar = 0;
+
+static int64_t agora_us()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static uint64_t agora_ns_real()
+{
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint16_t crc16(const uint8_t *dados, size_t n)
+{
+	uint16_t crc = 0xFFFF;
+	for (size_t i = 0; i < n; i++) {
+		crc ^= dados[i];
+		for (int b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+	return crc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Porta serial
+
+class Serial {
+public:
+	~Serial() { if (fd >= 0) close(fd); }
+
+	// Abre a porta em modo bruto, 8 bits sem paridade e 2 stop bits como o firmware
+	bool abre(const char *porta, uint32_t baud, bool rs485)
+	{
+		fd = open(porta, O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", porta, strerror(errno));
+			return false;
+		}
+		termios tio;
+		if (tcgetattr(fd, &tio) < 0) {
+			fprintf(stderr, "%s: %s\n", porta, strerror(errno));
+			return false;
+		}
+		cfmakeraw(&tio);
+		tio.c_cflag &= ~(PARENB | CSIZE | CRTSCTS);
+		tio.c_cflag |= CS8 | CSTOPB | CLOCAL | CREAD;
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 0;
+		const speed_t velocidade = constante_baud(baud);
+		cfsetispeed(&tio, velocidade != B0 ? velocidade : B38400);
+		cfsetospeed(&tio, velocidade != B0 ? velocidade : B38400);
+		if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+			fprintf(stderr, "%s: %s\n", porta, strerror(errno));
+			return false;
+		}
+		if (velocidade == B0 && !baud_arbitrario(baud)) { // 250000 não tem constante Bxxx
+			fprintf(stderr, "%s: taxa %u não suportada pelo driver\n", porta, baud);
+			return false;
+		}
+		if (rs485) { // o driver controla o pino de habilitação da transmissão pelo RTS
+			serial_rs485 conf = {};
+			conf.flags = SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+			if (ioctl(fd, TIOCSRS485, &conf) < 0) {
+				fprintf(stderr, "%s: modo RS-485: %s\n", porta, strerror(errno));
+				return false;
+			}
+		}
+		tcflush(fd, TCIOFLUSH);
+		return true;
+	}
+
+	// Transmite e espera o último byte sair da porta
+	bool envia(const uint8_t *dados, size_t n)
+	{
+		while (n > 0) {
+			const ssize_t r = write(fd, dados, n);
+			if (r < 0) {
+				if (errno == EAGAIN || errno == EINTR) {
+					pollfd p = {fd, POLLOUT, 0};
+					poll(&p, 1, 10);
+					continue;
+				}
+				return false;
+			}
+			dados += r;
+			n -= (size_t)r;
+		}
+		return tcdrain(fd) == 0;
+	}
+
+	// Recebe até completar n bytes ou até o prazo, retorna o número de bytes recebidos
+	size_t recebe(uint8_t *dados, size_t n, int64_t prazo_us)
+	{
+		size_t recebidos = 0;
+		while (recebidos < n) {
+			const ssize_t r = read(fd, dados + recebidos, n - recebidos);
+			if (r > 0) {
+				recebidos += (size_t)r;
+				continue;
+			}
+			if (r < 0 && errno != EAGAIN && errno != EINTR) break;
+			const int64_t falta = prazo_us - agora_us();
+			if (falta <= 0) break;
+			pollfd p = {fd, POLLIN, 0};
+			const timespec espera = {(time_t)(falta/1000000), (long)(falta%1000000)*1000};
+			if (ppoll(&p, 1, &espera, nullptr) < 0 && errno != EINTR) break;
+		}
+		return recebidos;
+	}
+
+	// Descarta bytes atrasados de uma resposta anterior
+	void descarta() { tcflush(fd, TCIFLUSH); }
+
+private:
+	int fd = -1;
+
+	static speed_t constante_baud(uint32_t baud)
+	{
+		switch (baud) {
+			case 9600: return B9600;
+			case 19200: return B19200;
+			case 38400: return B38400;
+			case 57600: return B57600;
+			case 115200: return B115200;
+			default: return B0;
+		}
+	}
+
+	// Taxa sem constante, pela interface termios2 do kernel (BOTHER)
+	bool baud_arbitrario(uint32_t baud)
+	{
+		struct termios2 {
+			tcflag_t c_iflag, c_oflag, c_cflag, c_lflag;
+			cc_t c_line;
+			cc_t c_cc[19];
+			speed_t c_ispeed, c_ospeed;
+		} tio;
+		constexpr tcflag_t BOTHER_ = 0010000;
+		if (ioctl(fd, TCGETS2, &tio) < 0) return false;
+		tio.c_cflag &= ~(tcflag_t)CBAUD;
+		tio.c_cflag |= BOTHER_;
+		tio.c_ispeed = tio.c_ospeed = baud;
+		return ioctl(fd, TCSETS2, &tio) == 0;
+	}
+};
+
+//-------------------------------------------------------------------------------------------------------
+// Registro das leituras
+// O arquivo começa com um cabeçalho de 512 bytes, seguido de registros de tamanho fixo. O número de registros
+// no cabeçalho é atualizado depois de cada registro gravado, então um leitor que acompanhe o arquivo nunca vê
+// um registro pela metade. O arquivo cresce em blocos e é truncado no tamanho exato ao ser fechado.
+
+constexpr char LOG_MAGICA[8] = {'C', 'C', 'L', 'O', 'G', 0, 0, 0};
+constexpr uint32_t LOG_VERSAO = 1;
+constexpr size_t LOG_CABECALHO = 512;
+constexpr size_t LOG_BLOCO = 1 << 20;
+
+struct CabecalhoLog {
+	char magica[8];
+	uint32_t versao;
+	uint32_t tamanho_registro; // bytes por registro
+	uint64_t registros; // registros completos gravados
+	uint16_t num_regs; // registradores em cada registro
+	uint16_t regs[(LOG_CABECALHO - 26)/2]; // endereços dos registradores, em ordem crescente
+};
+static_assert(sizeof(CabecalhoLog) <= LOG_CABECALHO, "cabeçalho maior que o reservado");
+
+// Cada registro tem o instante da leitura em ns desde 1970 (uint64), o endereço do controlador (uint8), o
+// estado da transação (enum Estado, uint8) e os valores lidos (uint16 cada), tudo little-endian e sem
+// alinhamento. Numa falha os valores são 0.
+constexpr size_t LOG_REGISTRO_FIXO = 10;
+
+class Log {
+public:
+	~Log() { fecha(); }
+
+	bool abre(const char *nome, const std::vector<uint16_t> &regs)
+	{
+		fd = open(nome, O_RDWR | O_CREAT, 0644);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", nome, strerror(errno));
+			return false;
+		}
+		struct stat st;
+		fstat(fd, &st);
+		tamanho_registro = LOG_REGISTRO_FIXO + 2*regs.size();
+		const bool novo = st.st_size == 0;
+		if (!mapeia(novo ? LOG_CABECALHO + LOG_BLOCO : (size_t)st.st_size + LOG_BLOCO)) return false;
+		CabecalhoLog *cab = cabecalho();
+		if (novo) {
+			memcpy(cab->magica, LOG_MAGICA, sizeof LOG_MAGICA);
+			cab->versao = LOG_VERSAO;
+			cab->tamanho_registro = (uint32_t)tamanho_registro;
+			cab->num_regs = (uint16_t)regs.size();
+			std::copy(regs.begin(), regs.end(), cab->regs);
+			__atomic_store_n(&cab->registros, 0, __ATOMIC_RELEASE);
+		} else if (memcmp(cab->magica, LOG_MAGICA, sizeof LOG_MAGICA) != 0 || cab->versao != LOG_VERSAO
+				|| cab->num_regs != regs.size() || !std::equal(regs.begin(), regs.end(), cab->regs)) {
+			fprintf(stderr, "%s: arquivo com outro formato ou outros registradores\n", nome);
+			return false;
+		}
+		registros = cab->registros;
+		return true;
+	}
+
+	void grava(uint8_t endereco, uint8_t estado, const uint16_t *valores, size_t n)
+	{
+		if (!mapa) return;
+		const size_t fim = LOG_CABECALHO + (registros + 1)*tamanho_registro;
+		if (fim > tamanho_mapa && !mapeia(tamanho_mapa + LOG_BLOCO)) return;
+		uint8_t *p = mapa + LOG_CABECALHO + registros*tamanho_registro;
+		const uint64_t tempo = agora_ns_real();
+		memcpy(p, &tempo, 8);
+		p[8] = endereco;
+		p[9] = estado;
+		memcpy(p + LOG_REGISTRO_FIXO, valores, 2*n);
+		registros++;
+		__atomic_store_n(&cabecalho()->registros, registros, __ATOMIC_RELEASE);
+	}
+
+	void fecha()
+	{
+		if (mapa) {
+			msync(mapa, tamanho_mapa, MS_SYNC);
+			munmap(mapa, tamanho_mapa);
+			mapa = nullptr;
+			if (ftruncate(fd, (off_t)(LOG_CABECALHO + registros*tamanho_registro)) < 0) perror("ftruncate");
+		}
+		if (fd >= 0) close(fd);
+		fd = -1;
+	}
+
+private:
+	int fd = -1;
+	uint8_t *mapa = nullptr;
+	size_t tamanho_mapa = 0;
+	size_t tamanho_registro = 0;
+	uint64_t registros = 0;
+
+	CabecalhoLog *cabecalho() { return reinterpret_cast<CabecalhoLog *>(mapa); }
+
+	bool mapeia(size_t tamanho)
+	{
+		if (ftruncate(fd, (off_t)tamanho) < 0) {
+			perror("ftruncate");
+			return false;
+		}
+		void *p = mapa ? mremap(mapa, tamanho_mapa, tamanho, MREMAP_MAYMOVE)
+			: mmap(nullptr, tamanho, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			return false;
+		}
+		mapa = static_cast<uint8_t *>(p);
+		tamanho_mapa = tamanho;
+		return true;
+	}
+};
+
+// Converte um arquivo de registro para CSV na saída padrão
+static int despeja_log(const char *nome)
+{
+	const int fd = open(nome, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < LOG_CABECALHO) {
+		fprintf(stderr, "%s: %s\n", nome, fd < 0 ? strerror(errno) : "arquivo inválido");
+		return 1;
+	}
+	void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	const uint8_t *mapa = static_cast<const uint8_t *>(p);
+	const CabecalhoLog *cab = reinterpret_cast<const CabecalhoLog *>(mapa);
+	if (memcmp(cab->magica, LOG_MAGICA, sizeof LOG_MAGICA) != 0 || cab->versao != LOG_VERSAO) {
+		fprintf(stderr, "%s: arquivo inválido\n", nome);
+		return 1;
+	}
+	const uint64_t registros = std::min<uint64_t>(__atomic_load_n(&cab->registros, __ATOMIC_ACQUIRE),
+		((size_t)st.st_size - LOG_CABECALHO)/cab->tamanho_registro);
+	printf("tempo_s,endereco,estado");
+	for (unsigned i = 0; i < cab->num_regs; i++) printf(",r%u", cab->regs[i]);
+	printf("\n");
+	for (uint64_t r = 0; r < registros; r++) {
+		const uint8_t *reg = mapa + LOG_CABECALHO + r*cab->tamanho_registro;
+		uint64_t tempo;
+		memcpy(&tempo, reg, 8);
+		printf("%llu.%09llu,%u,%u", (unsigned long long)(tempo/1000000000ULL),
+			(unsigned long long)(tempo%1000000000ULL), reg[8], reg[9]);
+		for (unsigned i = 0; i < cab->num_regs; i++) {
+			uint16_t v;
+			memcpy(&v, reg + LOG_REGISTRO_FIXO + 2*i, 2);
+			printf(",%u", v);
+		}
+		printf("\n");
+	}
+	munmap(p, (size_t)st.st_size);
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Transações
+
+enum Estado : uint8_t {OK = 0, SEM_RESPOSTA, INCOMPLETA, CRC_INVALIDO, EXCECAO, RESPOSTA_INVALIDA, NUM_ESTADOS};
+static const char *const nome_estado[NUM_ESTADOS] = {"ok", "sem resposta", "incompleta", "crc", "exceção", "inválida"};
+
+struct Faixa {
+	uint16_t inicio;
+	uint16_t quantidade;
+};
+
+// Escrita de um registrador feita junto com a leitura, pela função 23
+struct Escrita {
+	uint16_t registrador;
+	uint16_t valor;
+};
+
+struct Estatisticas {
+	uint32_t transacoes = 0;
+	uint32_t falhas[NUM_ESTADOS] = {};
+	int64_t latencia_soma_us = 0;
+	int64_t latencia_max_us = 0;
+	uint32_t latencias = 0;
+
+	void conta(Estado estado, int64_t latencia_us)
+	{
+		transacoes++;
+		if (estado != OK) {
+			falhas[estado]++;
+			return;
+		}
+		latencia_soma_us += latencia_us;
+		latencias++;
+		if (latencia_us > latencia_max_us) latencia_max_us = latencia_us;
+	}
+};
+
+class Barramento {
+public:
+	Barramento(Serial &serial, uint32_t baud, int64_t intervalo_us, int64_t timeout_us)
+		: serial(serial), intervalo_us(intervalo_us), timeout_us(timeout_us)
+	{
+		// um caractere RTU tem 11 bits, e acima de 19200bps a norma fixa t3,5 em 1750us
+		t35_us = baud > 19200 ? 1750 : (int64_t)(3.5*11e6/baud);
+		if (this->intervalo_us < 0) this->intervalo_us = t35_us;
+	}
+
+	// Lê a faixa para destino, gravando antes um registrador se escrita não for nulo
+	Estado le(uint8_t endereco, Faixa faixa, const Escrita *escrita, uint16_t *destino, uint8_t &excecao)
+	{
+		uint8_t pedido[16];
+		size_t n;
+		pedido[0] = endereco;
+		pedido[2] = (uint8_t)(faixa.inicio >> 8);
+		pedido[3] = (uint8_t)faixa.inicio;
+		pedido[4] = (uint8_t)(faixa.quantidade >> 8);
+		pedido[5] = (uint8_t)faixa.quantidade;
+		if (escrita) {
+			pedido[1] = 23;
+			pedido[6] = (uint8_t)(escrita->registrador >> 8);
+			pedido[7] = (uint8_t)escrita->registrador;
+			pedido[8] = 0;
+			pedido[9] = 1;
+			pedido[10] = 2;
+			pedido[11] = (uint8_t)(escrita->valor >> 8);
+			pedido[12] = (uint8_t)escrita->valor;
+			n = 13;
+		} else {
+			pedido[1] = 3;
+			n = 6;
+		}
+		uint8_t resposta[5 + 2*MAX_REGISTROS];
+		const Estado estado = transacao(pedido, n, resposta, 5 + 2*faixa.quantidade, excecao);
+		if (estado != OK) return estado;
+		if (resposta[2] != 2*faixa.quantidade) return contabiliza(RESPOSTA_INVALIDA);
+		for (uint16_t i = 0; i < faixa.quantidade; i++) destino[i] = (uint16_t)((resposta[3 + 2*i] << 8) | resposta[4 + 2*i]);
+		return OK;
+	}
+
+	// Grava um registrador em todos os controladores, sem resposta
+	void difunde(uint16_t registrador, uint16_t valor)
+	{
+		uint8_t pedido[8] = {ENDERECO_DIFUSAO, 6, (uint8_t)(registrador >> 8), (uint8_t)registrador,
+			(uint8_t)(valor >> 8), (uint8_t)valor};
+		aguarda_intervalo();
+		fecha_pacote(pedido, 6);
+		serial.envia(pedido, 8);
+		fim_barramento_us = agora_us() + std::max(ATRASO_DIFUSAO_US, t35_us);
+	}
+
+	Estatisticas estatisticas;
+
+private:
+	Serial &serial;
+	int64_t intervalo_us;
+	int64_t timeout_us;
+	int64_t t35_us;
+	int64_t fim_barramento_us = 0; // fim da última atividade no barramento
+
+	static void fecha_pacote(uint8_t *pacote, size_t n)
+	{
+		const uint16_t crc = crc16(pacote, n);
+		pacote[n] = (uint8_t)crc;
+		pacote[n + 1] = (uint8_t)(crc >> 8);
+	}
+
+	void aguarda_intervalo()
+	{
+		const int64_t falta = fim_barramento_us + intervalo_us - agora_us();
+		if (falta > 0) {
+			const timespec espera = {(time_t)(falta/1000000), (long)(falta%1000000)*1000};
+			nanosleep(&espera, nullptr);
+		}
+	}
+
+	Estado contabiliza(Estado estado, int64_t latencia_us = 0)
+	{
+		estatisticas.conta(estado, latencia_us);
+		return estado;
+	}
+
+	// Envia o pedido de n bytes mais o crc e recebe a resposta de tamanho esperado, ou uma exceção
+	Estado transacao(uint8_t *pedido, size_t n, uint8_t *resposta, size_t esperado, uint8_t &excecao)
+	{
+		aguarda_intervalo();
+		serial.descarta();
+		fecha_pacote(pedido, n);
+		if (!serial.envia(pedido, n + 2)) return contabiliza(SEM_RESPOSTA);
+		const int64_t enviado = agora_us();
+		const int64_t prazo = enviado + timeout_us;
+		size_t m = serial.recebe(resposta, 5, prazo); // a menor resposta é uma exceção
+		if (m == 5 && resposta[1] == (pedido[1] | 0x80)) esperado = 5;
+		else if (m == 5) m += serial.recebe(resposta + 5, esperado - 5, prazo);
+		fim_barramento_us = agora_us();
+		if (m == 0) return contabiliza(SEM_RESPOSTA);
+		if (m < esperado) return contabiliza(INCOMPLETA);
+		if (crc16(resposta, esperado) != 0) return contabiliza(CRC_INVALIDO);
+		if (resposta[0] != pedido[0]) return contabiliza(RESPOSTA_INVALIDA);
+		if (resposta[1] & 0x80) {
+			excecao = resposta[2];
+			return contabiliza(EXCECAO);
+		}
+		if (resposta[1] != pedido[1]) return contabiliza(RESPOSTA_INVALIDA);
+		return contabiliza(OK, fim_barramento_us - enviado);
+	}
+};
+
+//-------------------------------------------------------------------------------------------------------
+// Segmento
+
+// Agrupa os registradores em faixas, lendo juntos os separados por até LACUNA_MAX registradores
+static std::vector<Faixa> agrupa(const std::vector<uint16_t> &regs)
+{
+	std::vector<Faixa> faixas;
+	for (uint16_t r : regs) {
+		if (!faixas.empty()) {
+			Faixa &ultima = faixas.back();
+			const uint16_t fim = (uint16_t)(ultima.inicio + ultima.quantidade);
+			if (r - fim <= LACUNA_MAX && r + 1 - ultima.inicio <= MAX_REGISTROS) {
+				ultima.quantidade = (uint16_t)(r + 1 - ultima.inicio);
+				continue;
+			}
+		}
+		faixas.push_back({r, 1});
+	}
+	return faixas;
+}
+
+struct No {
+	uint8_t endereco;
+	std::vector<uint16_t> valores; // registradores lidos, na ordem de Segmento::regs
+	bool setpoint_pendente = false;
+	uint16_t setpoint = 0;
+	bool sequencia_valida = false;
+	uint16_t sequencia = 0; // REG_CHANGE_SEQUENCE da última leitura completa
+	uint16_t mudancas = 0; // REG_CHANGE_FLAGS lido, confirmado na consulta seguinte
+	uint32_t falhas_seguidas = 0;
+};
+
+class Segmento {
+public:
+	Segmento(Barramento &barramento, const std::vector<uint8_t> &enderecos, const std::vector<uint16_t> &regs,
+		bool so_mudancas, Log *log)
+		: barramento(barramento), regs(regs), faixas(agrupa(regs)), so_mudancas(so_mudancas), log(log)
+	{
+		for (uint8_t e : enderecos) {
+			No no;
+			no.endereco = e;
+			no.valores.assign(regs.size(), 0);
+			nos.push_back(no);
+		}
+		uint16_t maior = 0;
+		for (const Faixa &f : faixas) maior = std::max(maior, f.quantidade);
+		leitura.resize(maior);
+	}
+
+	// Agenda um setpoint já validado, endereço 0 agenda para todos os controladores
+	void agenda_setpoint(uint8_t endereco, uint16_t setpoint)
+	{
+		for (No &no : nos) {
+			if (endereco == ENDERECO_DIFUSAO || no.endereco == endereco) {
+				no.setpoint_pendente = true;
+				no.setpoint = setpoint;
+			}
+		}
+	}
+
+	bool consulta(uint8_t endereco) const
+	{
+		return std::any_of(nos.begin(), nos.end(), [endereco](const No &no) { return no.endereco == endereco; });
+	}
+
+	// Consulta todos os controladores uma vez. Com mais de um setpoint pendente, cada um é gravado no
+	// registrador preparado junto com a primeira leitura do controlador, e um pedido de difusão aplica todos.
+	// Os controladores sem setpoint pendente também são preparados, com o setpoint em uso lido antes: um
+	// que ficou armado com o valor de um lote anterior, por ter perdido aquela difusão, voltaria a ele.
+	void ciclo()
+	{
+		const size_t pendentes = (size_t)std::count_if(nos.begin(), nos.end(), [](const No &no) { return no.setpoint_pendente; });
+		const uint16_t reg_setpoint = pendentes > 1 ? REG_SETPOINT_STAGED : REG_SETPOINT;
+		bool preparados = false;
+		for (No &no : nos) {
+			Escrita escrita;
+			const Escrita *primeira = nullptr;
+			uint16_t atual;
+			if (no.setpoint_pendente) {
+				escrita = {reg_setpoint, no.setpoint};
+				primeira = &escrita;
+			} else if (pendentes > 1 && le(no, {REG_SETPOINT, 1}, nullptr, &atual) == OK) {
+				escrita = {REG_SETPOINT_STAGED, atual}; // a confirmação das mudanças fica para o próximo ciclo
+				primeira = &escrita;
+			} else if (so_mudancas && no.mudancas != 0) {
+				escrita = {REG_CHANGE_CLEAR, no.mudancas};
+				primeira = &escrita;
+			}
+			Estado estado = OK;
+			bool gravou = false;
+			if (so_mudancas) {
+				uint16_t mudanca[2];
+				estado = le(no, {REG_CHANGE_SEQUENCE, 2}, primeira, mudanca);
+				gravou = estado == OK;
+				if (estado == OK) {
+					if (primeira && primeira->registrador == REG_CHANGE_CLEAR) no.mudancas = 0;
+					no.mudancas |= mudanca[1];
+					if (!no.sequencia_valida || mudanca[0] != no.sequencia) {
+						estado = le_valores(no, nullptr);
+						if (estado == OK) {
+							no.sequencia = mudanca[0];
+							no.sequencia_valida = true;
+						}
+					}
+				}
+			} else {
+				estado = le_valores(no, primeira);
+				gravou = primeira_ok; // a escrita vai na primeira faixa
+			}
+			if (gravou && no.setpoint_pendente) {
+				no.setpoint_pendente = false;
+				preparados |= reg_setpoint == REG_SETPOINT_STAGED;
+			}
+			no.falhas_seguidas = estado == OK ? 0 : no.falhas_seguidas + 1;
+			if (log && estado != OK) {
+				const std::vector<uint16_t> zeros(regs.size(), 0);
+				log->grava(no.endereco, estado, zeros.data(), zeros.size());
+			}
+		}
+		if (preparados) barramento.difunde(REG_SETPOINT_COMMIT, 1);
+	}
+
+	std::vector<No> nos;
+
+private:
+	Barramento &barramento;
+	std::vector<uint16_t> regs; // registradores pedidos, em ordem crescente
+	std::vector<Faixa> faixas;
+	bool so_mudancas;
+	Log *log;
+	std::vector<uint16_t> leitura;
+	bool primeira_ok = false; // a primeira faixa da última leitura teve resposta
+
+	Estado le(No &no, Faixa faixa, const Escrita *escrita, uint16_t *destino)
+	{
+		uint8_t excecao = 0;
+		const Estado estado = barramento.le(no.endereco, faixa, escrita, destino, excecao);
+		if (estado == EXCECAO) {
+			fprintf(stderr, "controlador %u: exceção %u lendo %u registradores a partir de %u\n",
+				no.endereco, excecao, faixa.quantidade, faixa.inicio);
+		}
+		return estado;
+	}
+
+	// Lê todas as faixas, a primeira com a escrita se houver, e grava o registro
+	Estado le_valores(No &no, const Escrita *escrita)
+	{
+		size_t indice = 0; // próximo registrador pedido
+		primeira_ok = false;
+		for (size_t f = 0; f < faixas.size(); f++) {
+			const Faixa &faixa = faixas[f];
+			const Estado estado = le(no, faixa, f == 0 ? escrita : nullptr, leitura.data());
+			if (estado != OK) return estado;
+			if (f == 0) primeira_ok = true;
+			while (indice < regs.size() && regs[indice] < faixa.inicio + faixa.quantidade) {
+				no.valores[indice] = leitura[regs[indice] - faixa.inicio];
+				indice++;
+			}
+		}
+		if (log) log->grava(no.endereco, OK, no.valores.data(), no.valores.size());
+		return OK;
+	}
+};
+
+//-------------------------------------------------------------------------------------------------------
+// Linha de comando
+
+// Interpreta listas como "0-6,229,230", retorna falso se algum valor estiver fora de [minimo, maximo]
+static bool le_lista(const char *texto, int minimo, int maximo, std::vector<uint16_t> &lista)
+{
+	const char *p = texto;
+	while (*p) {
+		char *fim;
+		const long a = strtol(p, &fim, 10);
+		if (fim == p) return false;
+		long b = a;
+		p = fim;
+		if (*p == '-') {
+			b = strtol(p + 1, &fim, 10);
+			if (fim == p + 1) return false;
+			p = fim;
+		}
+		if (a < minimo || b > maximo || a > b) return false;
+		for (long v = a; v <= b; v++) lista.push_back((uint16_t)v);
+		if (*p == ',') p++;
+		else if (*p) return false;
+	}
+	std::sort(lista.begin(), lista.end());
+	lista.erase(std::unique(lista.begin(), lista.end()), lista.end());
+	return !lista.empty();
+}
+
+// Número decimal inteiro em [minimo, maximo], sem nada depois
+static bool le_numero(const char *texto, long minimo, long maximo, long &valor)
+{
+	char *fim;
+	errno = 0;
+	valor = strtol(texto, &fim, 10);
+	return fim != texto && *fim == '\0' && errno == 0 && valor >= minimo && valor <= maximo;
+}
+
+// Lê os comandos disponíveis na entrada padrão sem bloquear: "<endereço> <setpoint>" ou "* <setpoint>". Um
+// comando com erro é descartado inteiro: um endereço mal digitado não pode virar uma difusão, nem um setpoint
+// fora da faixa virar a corrente máxima.
+static void le_comandos(std::string &pendente, Segmento &segmento)
+{
+	char buf[256];
+	for (;;) {
+		pollfd p = {STDIN_FILENO, POLLIN, 0};
+		if (poll(&p, 1, 0) <= 0 || !(p.revents & (POLLIN | POLLHUP))) return;
+		const ssize_t r = read(STDIN_FILENO, buf, sizeof buf);
+		if (r <= 0) return;
+		pendente.append(buf, (size_t)r);
+		size_t fim;
+		while ((fim = pendente.find('\n')) != std::string::npos) {
+			const std::string linha = pendente.substr(0, fim);
+			pendente.erase(0, fim + 1);
+			char alvo[16], valor[16], resto[2];
+			if (sscanf(linha.c_str(), "%15s %15s %1s", alvo, valor, resto) != 2) {
+				if (linha.find_first_not_of(" \t\r") != std::string::npos) fprintf(stderr, "comando inválido: %s\n", linha.c_str());
+				continue;
+			}
+			long endereco = ENDERECO_DIFUSAO, setpoint;
+			if (strcmp(alvo, "*") != 0 && (!le_numero(alvo, 1, ENDERECO_MAX, endereco) || !segmento.consulta((uint8_t)endereco))) {
+				fprintf(stderr, "endereço inválido: %s (\"*\" ou um dos controladores de -n)\n", alvo);
+				continue;
+			}
+			if (!le_numero(valor, 0, SETPOINT_MAX, setpoint)) {
+				fprintf(stderr, "setpoint inválido: %s (0 a %u)\n", valor, SETPOINT_MAX);
+				continue;
+			}
+			segmento.agenda_setpoint((uint8_t)endereco, (uint16_t)setpoint);
+		}
+	}
+}
+
+static void resumo(Segmento &segmento, Barramento &barramento, uint32_t ciclos, int64_t duracao_us)
+{
+	Estatisticas &e = barramento.estatisticas;
+	const double s = duracao_us/1e6;
+	fprintf(stderr, "%.0f ciclos/s, %.0f transações/s, latência média %.2fms máx %.2fms",
+		ciclos/s, e.transacoes/s, e.latencias ? e.latencia_soma_us/1e3/e.latencias : 0.0, e.latencia_max_us/1e3);
+	for (int i = 1; i < NUM_ESTADOS; i++) {
+		if (e.falhas[i]) fprintf(stderr, ", %s %u", nome_estado[i], e.falhas[i]);
+	}
+	bool primeiro = true;
+	for (const No &no : segmento.nos) {
+		if (no.falhas_seguidas == 0) continue;
+		fprintf(stderr, "%s%u", primeiro ? ", sem comunicação:" : " ", no.endereco);
+		primeiro = false;
+	}
+	fprintf(stderr, "\n");
+	e = Estatisticas();
+}
+
+static void uso(const char *programa)
+{
+	fprintf(stderr,
+		"uso: %s -p porta [-b taxa] [-n endereços] [-r registradores] [-l arquivo] [-m] [-g us] [-t ms] [-R]\n"
+		"     %s -d arquivo\n"
+		"  -p  porta serial, por exemplo /dev/ttyUSB0\n"
+		"  -b  taxa de transmissão: 9600, 19200, 38400, 57600, 115200 ou 250000 (padrão 19200)\n"
+		"  -n  endereços dos controladores, por exemplo 1-15 ou 1,3,5 (padrão 1)\n"
+		"  -r  registradores lidos, por exemplo 0-6,229 (padrão 0-6)\n"
+		"  -l  grava as leituras no arquivo, acrescentando se ele já existir\n"
+		"  -m  lê os registradores só quando a sequência de mudanças do controlador avançar\n"
+		"  -g  intervalo entre o fim de uma resposta e o pedido seguinte em us (padrão t3,5)\n"
+		"  -t  tempo máximo de espera da resposta em ms (padrão 50)\n"
+		"  -R  liga o modo RS-485 do driver, que controla a transmissão pelo RTS\n"
+		"  -d  converte um arquivo de leituras para CSV\n"
+		"Setpoints são lidos da entrada padrão, uma linha \"<endereço> <setpoint>\" ou \"* <setpoint>\" cada.\n",
+		programa, programa);
+}
+
+static void sinal(int) { parar = 1; }
+
+int main(int argc, char **argv)
+{
+	const char *porta = nullptr;
+	const char *arquivo = nullptr;
+	uint32_t baud = 19200;
+	std::vector<uint16_t> enderecos_lidos, regs;
+	bool so_mudancas = false, rs485 = false;
+	int64_t intervalo_us = -1, timeout_us = 50000;
+	int opcao;
+	while ((opcao = getopt(argc, argv, "p:b:n:r:l:mg:t:Rd:h")) != -1) {
+		switch (opcao) {
+			case 'p': porta = optarg; break;
+			case 'b': baud = (uint32_t)strtoul(optarg, nullptr, 10); break;
+			case 'n':
+				if (!le_lista(optarg, 1, ENDERECO_MAX, enderecos_lidos)) {
+					fprintf(stderr, "endereços inválidos: %s\n", optarg);
+					return 2;
+				}
+				break;
+			case 'r':
+				if (!le_lista(optarg, 0, NUM_REGISTRADORES - 1, regs)) {
+					fprintf(stderr, "registradores inválidos: %s\n", optarg);
+					return 2;
+				}
+				break;
+			case 'l': arquivo = optarg; break;
+			case 'm': so_mudancas = true; break;
+			case 'g': intervalo_us = atol(optarg); break;
+			case 't': timeout_us = atol(optarg)*1000; break;
+			case 'R': rs485 = true; break;
+			case 'd': return despeja_log(optarg);
+			default: uso(argv[0]); return 2;
+		}
+	}
+	if (!porta || baud == 0) {
+		uso(argv[0]);
+		return 2;
+	}
+	if (std::find(std::begin(TAXAS), std::end(TAXAS), baud) == std::end(TAXAS)) {
+		fprintf(stderr, "taxa %u não é uma das taxas do registrador 4 dos controladores\n", baud);
+		return 2;
+	}
+	if (enderecos_lidos.empty()) enderecos_lidos.push_back(1);
+	if (regs.empty()) le_lista("0-6", 0, NUM_REGISTRADORES - 1, regs);
+	const std::vector<uint8_t> enderecos(enderecos_lidos.begin(), enderecos_lidos.end());
+
+	Serial serial;
+	if (!serial.abre(porta, baud, rs485)) return 1;
+	Log log;
+	if (arquivo && !log.abre(arquivo, regs)) return 1;
+	Barramento barramento(serial, baud, intervalo_us, timeout_us);
+	Segmento segmento(barramento, enderecos, regs, so_mudancas, arquivo ? &log : nullptr);
+
+	signal(SIGINT, sinal);
+	signal(SIGTERM, sinal);
+	fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+	std::string comandos;
+	uint32_t ciclos = 0;
+	int64_t inicio = agora_us();
+	while (!parar) {
+		le_comandos(comandos, segmento);
+		segmento.ciclo();
+		ciclos++;
+		const int64_t agora = agora_us();
+		if (agora - inicio >= 1000000) {
+			resumo(segmento, barramento, ciclos, agora - inicio);
+			ciclos = 0;
+			inicio = agora;
+		}
+	}
+	log.fecha();
+	return 0;
+}